@@ -0,0 +1,95 @@
+#ifndef COLLISIONWORLD_H_DEF
+#define COLLISIONWORLD_H_DEF
+
+#include <vector>
+
+// Contacts between moving axis-aligned ellipsoids (targets) and static
+// axis-aligned boxes (booth geometry).
+//
+// The broad phase is sort and sweep along x. Every body has an entry
+// holding its bounds and the entries stay sorted by their lower x bound.
+// Update() refreshes the bounds and restores the order with an insertion
+// sort, which is close to linear because bodies barely move between ticks.
+// Bodies added since the last Update() are sorted apart and merged in.
+// The axis is fixed: x is the gallery's lane axis, along which the field
+// is long and shallow, so the sweep windows stay short.
+// It then sweeps the array: each entry is only compared with the entries
+// after it that start before it ends, and y and z overlap is checked from
+// the same entry before any narrow test. Entries are 32 bytes and the
+// sweep reads them in order.
+//
+// Narrow tests are approximations that are exact for spheres.
+// Ellipsoids touch when the centre distance, scaled per axis by the sum of
+// the radii, is at most one. An ellipsoid touches a box when the point of
+// the box closest to its centre lies inside it. Box pairs are never
+// reported.
+//
+// RemoveBody() drops a body's entry at the next Update(), and only then is
+// its id handed out again, so ids in the last pair list stay unambiguous.
+// Include Vectors.h before this file.
+
+class CollisionWorld
+{
+public:
+	struct Pair
+	{
+		int a;
+		int b;
+	};
+
+private:
+	struct Entry
+	{
+		float minX;
+		float maxX;
+		float minY;
+		float maxY;
+		float minZ;
+		float maxZ;
+		int body;
+		int isBox;
+	};
+
+	std::vector<Vector3> centers;
+	std::vector<Vector3> extents;
+	std::vector<unsigned char> boxes;
+	std::vector<unsigned char> live;
+	std::vector<Entry> entries;
+	std::vector<Pair> pairs;
+	// removed since the last Update(), and free for reuse
+	std::vector<int> removedBodies;
+	std::vector<int> freeBodies;
+	// appended to entries since the last sort, and scratch to sort them in
+	int addedCount;
+	std::vector<Entry> added;
+	int candidateCount;
+
+private:
+	int AddBody(const Vector3 &center, const Vector3 &extent, bool isBox);
+	void RefreshEntry(Entry &entry) const;
+	void SortEntries();
+	bool Touch(int a, int b) const;
+
+public:
+	CollisionWorld();
+
+	int AddEllipsoid(const Vector3 &center, const Vector3 &radii);
+	int AddBox(const Vector3 &center, const Vector3 &halfSize);
+	void RemoveBody(int body);
+	void SetCenter(int body, const Vector3 &center) { centers[body] = center; }
+	void Clear();
+
+	// Finds every touching pair for the current centres.
+	void Update();
+
+	// a < b
+	const std::vector<Pair> &GetPairs() const { return pairs; }
+	// pairs whose bounds overlapped in the last Update()
+	int GetCandidateCount() const { return candidateCount; }
+	// one more than the highest body id handed out, removed ones included
+	int GetBodyCount() const { return (int)centers.size(); }
+	const Vector3 &GetCenter(int body) const { return centers[body]; }
+	bool IsBox(int body) const { return boxes[body] != 0; }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef COMMANDBUFFER_H_DEF
+#define COMMANDBUFFER_H_DEF
+
+#include "FrameArena.h"
+
+// Records GL work as a byte stream so it can be prepared on any thread and
+// issued later on the GL thread with Replay(). Recording never touches GL.
+//
+// Every argument is copied into the buffer, including client-side vertex
+// data and multi-draw ranges, so the caller's memory may go away as soon
+// as the record call returns. Fixed-function geometry that has no command
+// of its own (GLUT/GLU shapes) goes through Call(), which stores a function
+// pointer and up to four float arguments.
+//
+// Storage comes from the recording thread's frame arena: a buffer is only
+// valid for the frame it was recorded in and must be Reset() before it is
+// recorded again in a later frame.
+//
+// Include GL/glew.h before this file.
+
+typedef void (*CommandBufferFunc)(const float *args);
+
+class CommandBuffer
+{
+private:
+	enum Opcode
+	{
+		OpBindVertexArray,
+		OpUseProgram,
+		OpBindBuffer,
+		OpBufferData,
+		OpBindTexture,
+		OpUniform1f,
+		OpUniform4fv,
+		OpUniformMatrix4fv,
+		OpMaterial,
+		OpPushMatrix,
+		OpPopMatrix,
+		OpTranslate,
+		OpRotate,
+		OpScale,
+		OpMultMatrix,
+		OpDrawElements,
+		OpDrawElementsInstanced,
+		OpMultiDrawElements,
+		OpMultiDrawElementsIndirect,
+		OpMultiDrawArrays,
+		OpDrawClientArrays,
+		OpCall
+	};
+
+	// whole words, so inline vertex data stays float-aligned
+	FrameVector<unsigned int> data;
+	int commandCount;
+
+private:
+	void PutBytes(const void *bytes, size_t size);
+	template <typename T>
+	void Put(const T &value) { PutBytes(&value, sizeof(T)); }
+
+public:
+	CommandBuffer();
+
+	void Reset();
+
+	void BindVertexArray(GLuint vao);
+	void UseProgram(GLuint program);
+	void BindBuffer(GLenum target, GLuint buffer);
+	// replaces the bound buffer's storage with a copy of data (stream draw)
+	void BufferData(GLenum target, const void *bytes, size_t size);
+	// unit is GL_TEXTUREi; the active unit is back to 0 afterwards
+	void BindTexture(GLenum unit, GLenum target, GLuint texture);
+	void Uniform1f(GLint location, GLfloat value);
+	void Uniform4fv(GLint location, GLsizei count, const GLfloat *values);
+	void UniformMatrix4fv(GLint location, const GLfloat *matrix);
+	// fixed-function front material, as glMaterialfv
+	void Material(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4], GLfloat shininess);
+
+	void PushMatrix();
+	void PopMatrix();
+	void Translate(GLfloat x, GLfloat y, GLfloat z);
+	void Rotate(GLfloat angle, GLfloat x, GLfloat y, GLfloat z);
+	void Scale(GLfloat x, GLfloat y, GLfloat z);
+	// column-major, as glMultMatrixf
+	void MultMatrix(const GLfloat *matrix);
+
+	// index offsets are byte offsets into the bound element buffer
+	void DrawElements(GLenum mode, GLsizei count, GLenum type, size_t offset);
+	void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, size_t offset, GLsizei instances);
+	void MultiDrawElements(GLenum mode, const GLsizei *counts, GLenum type, const size_t *offsets, GLsizei drawCount);
+	// reads the commands from the bound GL_DRAW_INDIRECT_BUFFER at offset;
+	// indexTotal is only reported to PerfCounters, which can't see them
+	void MultiDrawElementsIndirect(GLenum mode, GLenum type, size_t offset, GLsizei drawCount, GLsizei stride, GLsizei indexTotal = 0);
+	void MultiDrawArrays(GLenum mode, const GLint *firsts, const GLsizei *counts, GLsizei drawCount);
+	// positions and normals are 3 floats per vertex; normals may be NULL
+	void DrawClientArrays(GLenum mode, const GLfloat *positions, const GLfloat *normals, GLsizei vertexCount);
+
+	void Call(CommandBufferFunc func, float a = 0.0f, float b = 0.0f, float c = 0.0f, float d = 0.0f);
+
+	// Issues the recorded commands in order; GL thread only.
+	void Replay() const;
+
+	int GetCommandCount() const { return commandCount; }
+	bool IsEmpty() const { return commandCount == 0; }
+};
+
+#endif
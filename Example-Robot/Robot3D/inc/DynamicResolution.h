@@ -0,0 +1,87 @@
+#ifndef DYNAMICRESOLUTION_H_DEF
+#define DYNAMICRESOLUTION_H_DEF
+
+// Offscreen scene target whose effective resolution follows the measured
+// frame time. The target is allocated at window size and the scene is
+// rendered into a scaled sub-rectangle of it, so changing the scale never
+// reallocates; EndFrame() upscales the sub-rectangle to the window, or to
+// another window-sized framebuffer such as a post-processing target.
+//
+// The scale only moves after the smoothed frame time has stayed outside
+// the [lowerBound, upperBound] band around the budget for several frames,
+// which keeps it from oscillating around the threshold.
+//
+// Include GL/glew.h before this file.
+
+class DynamicResolution
+{
+private:
+	static const int queryCount = 3;
+
+	int windowWidth;
+	int windowHeight;
+	int renderWidth;
+	int renderHeight;
+
+	GLuint fbo;
+	GLuint colorTexture;
+	GLuint depthRenderbuffer;
+
+	GLuint timerQueries[queryCount];
+	bool queryIssued[queryCount];
+	int currentQuery;
+	bool useTimerQueries;
+	int cpuFrameStart;
+
+	bool enabled;
+	float scale;
+	float minScale;
+	float maxScale;
+	float scaleStep;
+
+	float targetFrameMs;
+	float smoothedFrameMs;
+	int framesOverBudget;
+	int framesUnderBudget;
+	int cooldownFrames;
+
+private:
+	bool CreateTarget();
+	void UpdateRenderSize();
+
+public:
+	// budget slack before the scale is lowered / raised
+	static const float upperBound;
+	static const float lowerBound;
+	static const int framesBeforeDownscale = 6;
+	static const int framesBeforeUpscale = 60;
+	static const int framesAfterChange = 10;
+
+	DynamicResolution(float targetFrameMs = 1000.0f / 60.0f);
+	~DynamicResolution();
+
+	bool Init(int width, int height);
+	void Resize(int width, int height);
+	void FreeMemory();
+
+	// Binds the offscreen target and sets the scaled viewport.
+	void BeginFrame();
+	// Upscales into the given framebuffer (single-sampled, window-sized; 0 is
+	// the window), leaves it bound and updates the scale.
+	void EndFrame(GLuint targetFramebuffer = 0);
+
+	// Feeds one frame's render time (ms) into the hysteresis controller.
+	void ReportFrameTime(float frameMs);
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return enabled && fbo != 0; }
+	void SetTargetFrameTime(float frameMs) { targetFrameMs = frameMs; }
+	void SetScaleRange(float minScale, float maxScale);
+
+	float GetScale() const { return scale; }
+	float GetFrameTime() const { return smoothedFrameMs; }
+	int GetRenderWidth() const { return renderWidth; }
+	int GetRenderHeight() const { return renderHeight; }
+};
+
+#endif
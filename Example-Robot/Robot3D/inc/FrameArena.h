@@ -0,0 +1,101 @@
+#ifndef FRAMEARENA_H_DEF
+#define FRAMEARENA_H_DEF
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for data that only lives for one frame.
+//
+// Every thread gets its own arena through Current(), so allocating never
+// locks. NextFrame() starts a new frame; each arena rewinds itself the
+// next time its thread asks for it, which keeps the reset off the workers'
+// critical path and needs no cross-thread bookkeeping. Memory comes from
+// blocks that are kept across frames, so once the arenas have grown to the
+// frame's peak the steady state performs no heap allocations at all.
+//
+// Nothing allocated here may be used after the next NextFrame() call, and
+// NextFrame() must only be called while no thread is using arena memory.
+//
+// The module also replaces the global operator new/delete with versions
+// that count calls, so the per-frame heap traffic can be checked. Every
+// form of operator new is counted (plain, array, nothrow and over-aligned);
+// code that calls malloc() directly, such as C libraries and drivers, is
+// not.
+
+class FrameArena
+{
+private:
+	struct Block
+	{
+		Block *next;
+		size_t size;
+	};
+
+	Block *first;
+	Block *current;
+	size_t offset;
+	size_t used;
+	size_t highWater;
+	size_t blockSize;
+	unsigned int frame;
+
+private:
+	Block *NewBlock(size_t minSize);
+	static char *BlockData(Block *block) { return reinterpret_cast<char *>(block + 1); }
+
+public:
+	explicit FrameArena(size_t blockSize = 1 << 20);
+	~FrameArena();
+
+	void *Allocate(size_t size, size_t alignment);
+	// Rewinds to the start; blocks are kept for reuse.
+	void Reset();
+
+	size_t GetUsed() const { return used; }
+	size_t GetHighWater() const { return highWater; }
+
+	// The calling thread's arena, rewound if a new frame has started.
+	static FrameArena &Current();
+	static void NextFrame();
+
+	// operator new calls and arena blocks since startup, from every thread;
+	// direct malloc() calls are not included
+	static unsigned long long GetHeapAllocationCount();
+};
+
+// Stateless STL allocator on the calling thread's frame arena.
+// deallocate() is a no-op; memory comes back when the frame ends.
+template <typename T>
+class FrameAllocator
+{
+public:
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind
+	{
+		typedef FrameAllocator<U> other;
+	};
+
+	FrameAllocator() {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U> &) {}
+
+	T *allocate(size_t n)
+	{
+		return static_cast<T *>(FrameArena::Current().Allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T *, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T> &, const FrameAllocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T> &, const FrameAllocator<U> &) { return false; }
+
+// A vector holding one of these must be emptied with swap() (not clear())
+// before it is reused in a later frame.
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T> >;
+
+#endif
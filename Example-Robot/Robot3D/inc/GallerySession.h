@@ -0,0 +1,137 @@
+#ifndef GALLERYSESSION_H_DEF
+#define GALLERYSESSION_H_DEF
+
+class WaterSim;
+
+// One shooting gallery's simulation: the waves, the target's trip across
+// the water and down to the ground, and the orbit camera. Update() steps
+// it by dt and reports what happened as event bits; the ripple field and
+// particles belong to whoever renders the gallery, which reacts to the
+// events and can hand its WaterSim to SetRipples() so the target rides
+// the ripples too.
+//
+// A session is a flat block of floats and enums with no heap storage, so
+// an array of them is contiguous and sessions step independently on any
+// thread. Results depend only on the sequence of dt values and calls.
+// Include Vectors.h before this file.
+
+// gallery layout, shared with the renderer
+const float waterWidth = 14.0f;
+const float waterDepth = 4.0f;
+const float waterSurfaceY = 5.8f;
+const float waterCenterZ = 1.5f;
+
+const float waterLeftX = -waterWidth * 0.5f;
+const float waterRightX = waterWidth * 0.5f;
+const float waterBackZ = waterCenterZ - waterDepth * 0.5f;
+const float waterFrontZ = waterCenterZ + waterDepth * 0.5f;
+
+const float pathLeftX = waterLeftX + 0.6f;
+const float pathRightX = waterRightX - 0.6f;
+const float pathZ = waterCenterZ;
+
+const float objectFloatOffset = 1.0f;
+const float objectGroundRestY = 1.1f;
+
+enum class WaterState
+{
+	Wavy,
+	Flat
+};
+
+enum class ObjectState
+{
+	Duck,
+	TargetOnly
+};
+
+enum class CameraState
+{
+	Front,
+	Perspective
+};
+
+enum class MovementPhase
+{
+	MoveAcross,
+	Falling,
+	GroundPause
+};
+
+class GallerySession
+{
+public:
+	// Update() result bits
+	enum Event
+	{
+		SplashEvent = 1,	// the target left the water at pathRightX
+		LandingEvent = 2	// the target came to rest on the ground
+	};
+
+	static const float waveAmplitude;
+	static const float waveSpeed;
+	static const float primaryWaveFrequency;
+	static const float secondaryWaveFrequency;
+
+private:
+	WaterState waterState;
+	ObjectState objectState;
+	CameraState cameraState;
+	MovementPhase movementPhase;
+	bool paused;
+
+	float wavePhase;
+	float objectPosX;
+	float objectPosY;
+	float objectPosZ;
+	float verticalVelocity;
+	float groundPauseTimer;
+
+	float cameraAzimuth;
+	float cameraElevation;
+	float cameraRadius;
+	float cameraTargetRadius;
+
+	const WaterSim *ripples;
+
+public:
+	GallerySession();
+
+	// Returns the Event bits raised during this step.
+	unsigned int Update(float dt);
+
+	void ToggleWater();
+	void ToggleObject();
+	void ToggleCamera();
+	void TogglePaused() { paused = !paused; }
+	// Back to the left end of the path, floating.
+	void ResetTarget();
+
+	// Orbit in degrees and zoom in world units, clamped to the gallery's
+	// limits. Zooming moves the target radius; Update() eases towards it.
+	void Orbit(float azimuthDelta, float elevationDelta);
+	void Zoom(float radiusDelta);
+
+	// NULL for analytic waves only.
+	void SetRipples(const WaterSim *sim) { ripples = sim; }
+
+	float GetWaterHeight(float x, float z) const;
+	Vector3 GetWaterNormal(float x, float z) const;
+	Vector3 GetCameraEye() const;
+	Vector3 GetObjectPosition() const { return Vector3(objectPosX, objectPosY, objectPosZ); }
+
+	// false once only input can change the session
+	bool IsAnimating() const;
+
+	// FNV-1a over every field but the ripple pointer, chained through seed
+	unsigned long long Hash(unsigned long long seed = 14695981039346656037ULL) const;
+
+	WaterState GetWaterState() const { return waterState; }
+	ObjectState GetObjectState() const { return objectState; }
+	CameraState GetCameraState() const { return cameraState; }
+	MovementPhase GetMovementPhase() const { return movementPhase; }
+	bool IsPaused() const { return paused; }
+	float GetWavePhase() const { return wavePhase; }
+};
+
+#endif
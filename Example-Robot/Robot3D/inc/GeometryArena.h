@@ -0,0 +1,138 @@
+#ifndef GEOMETRYARENA_H_DEF
+#define GEOMETRYARENA_H_DEF
+
+#include "FrameArena.h"
+
+// One shared vertex and index buffer that meshes suballocate from, so any
+// number of them can be drawn with a single glMultiDrawElementsIndirect.
+//
+// Vertices are position + normal. Each indirect draw also gets two vec4s of
+// per-draw data (xyz translation, w material slot, then the view mask) that
+// shaders fetch from a buffer texture by draw index. The draw index is gl_DrawIDARB when
+// ARB_shader_draw_parameters is present; otherwise every draw's
+// baseInstance is its index and an instanced attribute feeds it back.
+// Shaders get this through GetShaderPrelude(), which must be the start of
+// the vertex shader source, and call getDrawData() and getDrawViews().
+//
+// A draw is instanced once per bit of its view mask, so a shader that
+// routes primitives to viewports (see MultiView) draws it into every view
+// it was culled into. Single-view programs leave the mask at 1.
+//
+// Draw lists are plain CPU data and can be filled on any thread; Record()
+// turns one into commands for the GL thread.
+//
+// Include GL/glew.h before this file.
+
+class CommandBuffer;
+
+struct GeometryArenaVertex
+{
+	GLfloat position[3];
+	GLfloat normal[3];
+};
+
+class GeometryArena
+{
+public:
+	// attribute locations programs drawn from the arena must use
+	enum Attribute
+	{
+		AttribPosition,
+		AttribNormal,
+		AttribDrawIndex,
+		AttributeCount
+	};
+
+	// texture unit of the per-draw data
+	static const int drawDataUnit = 4;
+	// view mask bits a draw may use
+	static const int maxDrawViews = 8;
+
+	struct Mesh
+	{
+		GLint baseVertex;
+		GLuint firstIndex;
+		GLsizei indexCount;
+	};
+
+	// layout fixed by glMultiDrawElementsIndirect
+	struct IndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	struct DrawData
+	{
+		GLfloat x;
+		GLfloat y;
+		GLfloat z;
+		GLfloat material;
+		GLfloat views;
+		GLfloat padding[3];
+	};
+
+	class DrawList
+	{
+	private:
+		FrameVector<IndirectCommand> commands;
+		FrameVector<DrawData> data;
+
+		friend class GeometryArena;
+
+	public:
+		// firstIndex is relative to the mesh; nothing is added for an
+		// empty view mask
+		void Add(const Mesh &mesh, GLuint firstIndex, GLsizei count, float x, float y, float z, float material, unsigned int views = 1);
+		// must be called before the list is reused in a later frame
+		void Clear();
+
+		int GetDrawCount() const { return (int)commands.size(); }
+	};
+
+private:
+	int vertexCapacity;
+	int indexCapacity;
+	int maxDraws;
+	int vertexCount;
+	int indexCount;
+	bool drawParameters;
+
+	GLuint vao;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	GLuint drawIndexBuffer;
+	GLuint indirectBuffer;
+	GLuint drawDataBuffer;
+	GLuint drawDataTexture;
+
+public:
+	GeometryArena(int vertexCapacity, int indexCapacity, int maxDraws);
+	~GeometryArena();
+
+	// false when multi-draw indirect or buffer textures are unavailable
+	bool Init();
+	void FreeMemory();
+
+	// Copies a mesh into the arena; indices are relative to its vertices.
+	bool Allocate(const GeometryArenaVertex *vertices, int meshVertexCount, const unsigned int *indices, int meshIndexCount, Mesh &mesh);
+
+	// Version line, draw-index plumbing and getDrawData() for vertex shaders.
+	const char *GetShaderPrelude() const;
+	static const char *const *GetAttributeNames();
+	// Points the program's draw-data sampler at drawDataUnit.
+	void SetupProgram(GLuint program) const;
+
+	// Records one indirect multi-draw of the whole list with the program
+	// that is current at replay. Lists longer than maxDraws are truncated.
+	void Record(CommandBuffer &commands, const DrawList &list) const;
+
+	int GetVertexCount() const { return vertexCount; }
+	int GetIndexCount() const { return indexCount; }
+	bool HasDrawParameters() const { return drawParameters; }
+};
+
+#endif
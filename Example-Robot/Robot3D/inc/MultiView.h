@@ -0,0 +1,86 @@
+#ifndef MULTIVIEW_H_DEF
+#define MULTIVIEW_H_DEF
+
+#include <string>
+
+// Several cameras sharing one window and one scene submission.
+//
+// Each view owns a rectangle of the frame (fractions of the viewport that
+// is current at BeginFrame(), so it follows dynamic resolution) and a
+// camera captured from the GL matrices. The scene is culled against every
+// view with CullBox(), which returns a bit per view, and is submitted and
+// recorded once; the render queue then either replays an item per view
+// with BeginView(), or draws it once with BeginBroadcast() when its program
+// routes each primitive to its view's viewport itself.
+//
+// Broadcast programs are GeometryArena programs built with
+// GetBroadcastPrelude(): every draw is instanced once per bit of its view
+// mask, selectView() turns gl_InstanceID into the view and writes
+// gl_ViewportIndex from the vertex shader. They light in the first view's
+// eye space (its matrices are loaded while broadcasting) with each view's
+// viewer direction. Single-view programs get the same three functions
+// from GetSingleViewSource(), so shader bodies are shared.
+//
+// Needs ARB_viewport_array and either ARB_shader_viewport_layer_array or
+// AMD_vertex_shader_viewport_index for broadcasting.
+// Include GL/glew.h and Vectors.h before this file.
+
+class MultiView
+{
+public:
+	static const int maxViews = 4;
+
+private:
+	struct View
+	{
+		float rect[4];
+		GLint viewport[4];
+		GLfloat projection[16];
+		GLfloat modelView[16];
+		GLfloat viewProjection[16];
+		GLfloat planes[6][4];
+	};
+
+	View views[maxViews];
+	int viewCount;
+	GLint frame[4];
+
+private:
+	static void ExtractPlanes(View &view);
+
+public:
+	MultiView();
+
+	static bool IsBroadcastSupported();
+	// Inserts the viewport extension after the arena prelude's version line
+	// and appends selectView(), viewPosition() and viewerDirection().
+	static std::string GetBroadcastPrelude(const std::string &arenaPrelude);
+	static const char *GetSingleViewSource();
+
+	void SetViewCount(int count);
+	// x, y, width, height as fractions of the frame, origin bottom left
+	void SetRect(int view, float x, float y, float width, float height);
+
+	// Takes the current viewport as the frame the views divide.
+	void BeginFrame();
+	// Takes the current projection and modelview matrices as the camera.
+	void CaptureCamera(int view);
+	float GetAspect(int view) const;
+
+	// Bit v is set when the box touches view v's frustum.
+	unsigned int CullBox(const Vector3 &boxMin, const Vector3 &boxMax) const;
+
+	// One view's viewport and matrices, for drawing into it on its own.
+	void BeginView(int view) const;
+	// Every view's viewport at once and the first view's matrices.
+	void BeginBroadcast() const;
+	// Back to the whole frame; the matrices are left as they are.
+	void EndViews() const;
+	// Per-view matrices and viewer directions of a broadcast program.
+	void SetUniforms(GLuint program) const;
+
+	int GetViewCount() const { return viewCount; }
+	unsigned int GetAllViews() const { return (1u << viewCount) - 1; }
+};
+
+#endif
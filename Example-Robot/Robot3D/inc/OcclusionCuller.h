@@ -0,0 +1,70 @@
+#ifndef OCCLUSIONCULLER_H_DEF
+#define OCCLUSIONCULLER_H_DEF
+
+#include <vector>
+
+// Conservative hardware occlusion culling with bounding-box queries.
+//
+// Occluders are drawn first, then Query() rasterizes each occludee's box
+// against the depth buffer with colour and depth writes off. Results are
+// only read once GL reports them available, so the decision for a frame
+// comes from an earlier frame and the CPU never waits on the GPU. Anything
+// without a result yet, or containing the eye, counts as visible.
+//
+// Include GL/glew.h and Vectors.h before this file.
+
+class OcclusionCuller
+{
+private:
+	struct Entry
+	{
+		GLuint query;
+		bool pending;
+		bool visible;
+	};
+
+	std::vector<Entry> entries;
+
+	GLuint boxVbo;
+	GLuint boxIbo;
+	GLenum queryTarget;
+	bool enabled;
+	bool inQueries;
+	Vector3 eye;
+
+	int queriesIssued;
+	int culledCount;
+
+private:
+	void DrawBox(const Vector3 &boxMin, const Vector3 &boxMax);
+
+public:
+	OcclusionCuller();
+	~OcclusionCuller();
+
+	bool Init();
+	void FreeMemory();
+
+	// Returns an id for a new occludee.
+	int Register();
+
+	// Sets up depth-test-only state; eye is used to skip boxes it is inside.
+	void BeginQueries(const Vector3 &eye);
+	// Collects a finished result for the occludee, then issues a new query
+	// if none is outstanding.
+	void Query(int id, const Vector3 &boxMin, const Vector3 &boxMax);
+	void EndQueries();
+
+	// Latest known visibility; always true while disabled.
+	bool IsVisible(int id);
+
+	// Re-enabling forgets old answers, they may be arbitrarily stale.
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return enabled && boxVbo != 0; }
+
+	int GetQueriesIssued() const { return queriesIssued; }
+	int GetCulledCount() const { return culledCount; }
+	void ResetStats() { queriesIssued = 0; culledCount = 0; }
+};
+
+#endif
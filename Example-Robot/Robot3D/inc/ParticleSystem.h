@@ -0,0 +1,89 @@
+#ifndef PARTICLESYSTEM_H_DEF
+#define PARTICLESYSTEM_H_DEF
+
+// Fixed-capacity particle pool for splashes and debris.
+//
+// Particles live in structure-of-arrays form in one aligned block that is
+// allocated up front; Emit() never allocates and silently drops particles
+// once the pool is full. Update() integrates four particles at a time with
+// SSE and then removes dead ones by swapping the last live particle into
+// their slot, so the live range [0, count) never has holes.
+//
+// Draw() streams the live range of each attribute array straight into one
+// buffer and renders every particle with a single instanced billboard draw.
+//
+// Include GL/glew.h and Vectors.h before this file.
+
+class WorkerPool;
+
+class ParticleSystem
+{
+public:
+	enum Attribute
+	{
+		PosX,
+		PosY,
+		PosZ,
+		Life,
+		Kind,
+		VelX,
+		VelY,
+		VelZ,
+		AttributeCount
+	};
+
+	// attributes uploaded for drawing, in buffer order
+	static const int drawAttributes = Kind + 1;
+
+private:
+	int capacity;
+	int count;
+	float *block;
+	float *arrays[AttributeCount];
+	unsigned int rngState;
+
+	float gravity;
+	float floorY;
+	WorkerPool *pool;
+	float stepDt;
+
+	GLuint vao;
+	GLuint quadVbo;
+	GLuint instanceVbo;
+
+private:
+	float Random();
+	void Integrate(int begin, int end);
+	static void IntegrateTask(void *context, int begin, int end, int worker);
+	void Compact();
+
+public:
+	explicit ParticleSystem(int capacity);
+	~ParticleSystem();
+
+	void SetWorkerPool(WorkerPool *pool) { this->pool = pool; }
+	void SetGravity(float gravity) { this->gravity = gravity; }
+	// particles that drop below this height die
+	void SetFloor(float floorY) { this->floorY = floorY; }
+
+	// Spawns up to count particles around origin; velocities are baseVelocity
+	// plus a uniform random offset of up to spread on each axis. Returns the
+	// number actually spawned.
+	int Emit(const Vector3 &origin, const Vector3 &baseVelocity, float spread, int count, float lifetime, float kind);
+
+	void Update(float dt);
+	void Clear() { count = 0; }
+
+	// attribCorner is the per-vertex quad corner; attribInstance is the first
+	// of drawAttributes consecutive per-instance float attributes.
+	bool InitGL(GLint attribCorner, GLint attribInstance);
+	void Draw(GLuint program);
+	void FreeGL();
+
+	int GetLiveCount() const { return count; }
+	// live particles are [0, GetLiveCount()) of each array
+	const float *GetArray(Attribute attribute) const { return arrays[attribute]; }
+	int GetCapacity() const { return capacity; }
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef PERFCOUNTERS_H_DEF
+#define PERFCOUNTERS_H_DEF
+
+#include <cstddef>
+
+// Per-frame counts of the work handed to GL, plus frame and simulation
+// times.
+//
+// Call sites bump counters with Add() or CountDraws() right next to the GL
+// call they describe; EndFrame() closes the frame, so Get() always returns
+// the last complete one. Draw calls are GL calls that draw, so a multi-draw
+// counts once. Vertices are the ones each call asks for (indices for
+// indexed draws, control points for patches), split by whether they come
+// from client memory or from buffers; GLUT and GLU shapes count the
+// vertices they are known to emit. Frame times also go into a histogram
+// that covers every frame since the last ResetHistogram().
+//
+// Counting is plain additions on statics: GL thread only.
+
+class PerfCounters
+{
+public:
+	enum Counter
+	{
+		DrawCalls,
+		ProgramBinds,
+		MaterialChanges,
+		ImmediateVertices,
+		BufferVertices,
+		UploadBytes,
+		CounterCount
+	};
+
+	static const int histogramBuckets = 8;
+
+private:
+	static unsigned long long counts[CounterCount];
+	static unsigned long long lastFrame[CounterCount];
+	static unsigned int histogram[histogramBuckets];
+	static float simulationMs;
+	static float lastFrameMs;
+	static float lastSimulationMs;
+
+public:
+	static void Add(Counter counter, unsigned long long amount = 1) { counts[counter] += amount; }
+	static void CountDraws(unsigned long long calls, unsigned long long vertices, bool immediate)
+	{
+		counts[DrawCalls] += calls;
+		counts[immediate ? ImmediateVertices : BufferVertices] += vertices;
+	}
+	// Simulation ticks are added to the frame they run before.
+	static void AddSimulationTime(float ms) { simulationMs += ms; }
+	static void EndFrame(float frameMs);
+
+	static unsigned long long Get(Counter counter) { return lastFrame[counter]; }
+	static const char *GetName(Counter counter);
+	static float GetFrameTime() { return lastFrameMs; }
+	static float GetSimulationTime() { return lastSimulationMs; }
+
+	// Bucket i holds frames up to GetBucketLimit(i) ms and over the limit
+	// of the bucket before; the last bucket has no limit.
+	static unsigned int GetHistogram(int bucket) { return histogram[bucket]; }
+	static float GetBucketLimit(int bucket);
+	static void ResetHistogram();
+
+	// The last frame as a few lines of text; returns the length.
+	static int Format(char *text, size_t size);
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef POSTPROCESS_H_DEF
+#define POSTPROCESS_H_DEF
+
+#include <cstddef>
+
+// Final stage between the rendered scene and the window, with a choice of
+// anti-aliasing:
+//   Off       the scene is drawn straight into the window
+//   Fxaa      one full-screen pass that blurs along the local luma gradient
+//   SmaaLite  a luma edge pass into an edge texture, then a pass that
+//             follows each edge up to maxSearch pixels either way, reads
+//             the crossing edges at its ends and blends by the area the
+//             reconstructed line covers (MLAA-style, no precomputed area
+//             texture and no diagonal patterns)
+//   Msaa      the scene is drawn into a multisampled target and resolved
+//             with a blit
+// Every mode but Off renders the scene into a window-sized offscreen
+// target; BeginFrame() binds it and GetTarget() names it for anyone
+// blitting a finished scene in, such as dynamic resolution. The Msaa
+// target is only allocated once that mode is first selected.
+//
+// GPU time is measured with timestamp queries around the scene and around
+// the post pass, read back a few frames later without stalling, and kept
+// as a running average per mode, so switching modes fills in a cost table
+// that shows what each one adds on this machine.
+//
+// Include GL/glew.h before this file.
+
+class PostProcess
+{
+public:
+	enum Mode
+	{
+		Off,
+		Fxaa,
+		SmaaLite,
+		Msaa,
+		ModeCount
+	};
+
+	static const int maxSearch = 8;
+	static const int maxSamples = 4;
+
+private:
+	static const int queryFrames = 3;
+
+	int width;
+	int height;
+	Mode mode;
+	int samples;
+
+	GLuint sceneFbo;
+	GLuint sceneColor;
+	GLuint sceneDepth;
+	GLuint edgeFbo;
+	GLuint edgeTexture;
+	GLuint msaaFbo;
+	GLuint msaaColor;
+	GLuint msaaDepth;
+
+	GLuint fxaaProgram;
+	GLuint edgeProgram;
+	GLuint blendProgram;
+
+	// scene start, post start and post end for each frame in flight
+	GLuint timestampQueries[queryFrames][3];
+	Mode queryMode[queryFrames];
+	bool queryIssued[queryFrames];
+	int currentQuery;
+	bool useTimerQueries;
+
+	float sceneMs[ModeCount];
+	float postMs[ModeCount];
+
+private:
+	bool CreateTargets();
+	bool CreateMsaaTarget();
+	void BuildPrograms();
+	void DrawPass(GLuint program, GLuint colorTexture, GLuint edges);
+	void ReadTimestamps();
+
+public:
+	PostProcess();
+	~PostProcess();
+
+	bool Init(int width, int height);
+	void Resize(int width, int height);
+	void FreeMemory();
+
+	// false, leaving the mode alone, if this GL can't do the one asked for
+	bool SetMode(Mode mode);
+	Mode GetMode() const { return mode; }
+	bool IsSupported(Mode mode) const;
+	// the next supported mode after the current one
+	void CycleMode();
+	static const char *GetModeName(Mode mode);
+
+	// Binds the target the scene should be drawn into at window size.
+	void BeginFrame();
+	// framebuffer the finished scene belongs in, 0 for the window
+	GLuint GetTarget() const;
+	// Resolves or filters the scene into the window.
+	void EndFrame();
+
+	// running GPU averages in ms, 0 until the mode has been measured
+	float GetSceneTime(Mode mode) const { return sceneMs[mode]; }
+	float GetPostTime(Mode mode) const { return postMs[mode]; }
+	// Writes the current mode and the cost table; returns the length.
+	int Format(char *text, size_t size) const;
+};
+
+#endif
@@ -1,3 +1,8 @@
+#include "GeometryArena.h"
+#include "VertexCache.h"
+
+class CommandBuffer;
+
 struct MeshVertex
 {
 	Vector3	position;
@@ -15,6 +20,19 @@ struct MeshQuad
 
 class QuadMesh
 {
+public:
+	// TriangleStrip stores one strip per row of quads (2 indices per quad)
+	// separated by the fixed restart index instead of 6 indices per quad.
+	enum Topology
+	{
+		TriangleList,
+		TriangleStrip
+	};
+
+	static const unsigned int restartIndex = 0xFFFFFFFFu;
+	// texture unit of the optional height map of a procedural mesh
+	static const int heightTextureUnit = 5;
+
 private:
 	
 	int maxMeshSize;
@@ -32,7 +50,8 @@ private:
         std::vector<float> verticesVBO;
         std::vector<float> normalsVBO;
         std::vector<unsigned int> indices;
-        std::vector<unsigned int> triangleIndices;
+        std::vector<unsigned int> triangleIndices; // strips in TriangleStrip mode
+        Topology topology;
 
 	int numFacesDrawn;
 	
@@ -44,6 +63,22 @@ private:
         GLuint vao;
         GLuint vbos[3];
         GLsizei indexCount;
+
+        GeometryArena::Mesh arenaMesh;
+        bool inArena;
+
+        // set by Simplify(): triangleIndices is then grouped by block
+        // (blockSize x blockSize quads, row-major) instead of by quad
+        int blockSize;
+        std::vector<unsigned int> blockFirstIndex;
+
+        // set by InitProceduralMesh(): no vertex or index data at all, the
+        // vertex shader rebuilds every vertex from gl_VertexID
+        bool procedural;
+        GLfloat gridOrigin[4];  // w = meshSize
+        GLfloat gridStep1[4];
+        GLfloat gridStep2[4];   // w = height scale
+        GLuint heightTexture;
 	
 	
 	
@@ -52,6 +87,9 @@ private:
 private:
 	bool CreateMemory();
 	void FreeMemory();
+	void RecordProceduralRegion(CommandBuffer &commands, int meshSize, int row0, int row1, int col0, int col1) const;
+	// index ranges covering the quads of a region, one per row or block row
+	void GetRegionRanges(int meshSize, int row0, int row1, int col0, int col1, FrameVector<unsigned int> &firsts, FrameVector<GLsizei> &counts) const;
 
 public:
 
@@ -71,15 +109,75 @@ public:
 	void QuadMesh::addVertex(float x, float y, float z);
 	void QuadMesh::addNormal(float nx, float ny, float nz);
 	void QuadMesh::addIndices(unsigned int i1, unsigned int i2, unsigned int i3, unsigned int i4);
-	bool InitMesh(int meshSize, Vector3 origin, double meshLength, double meshWidth,Vector3 dir1, Vector3 dir2);
+	// A triangle list is grouped by blockSize x blockSize blocks of quads,
+	// as Simplify() leaves it, when blockSize divides meshSize; regions are
+	// then drawn at block granularity. 0 keeps plain row-major order.
+	bool InitMesh(int meshSize, Vector3 origin, double meshLength, double meshWidth,Vector3 dir1, Vector3 dir2, Topology topology = TriangleList, int blockSize = 0);
+	// Keeps only the grid parameters; the mesh is drawn with
+	// glMultiDrawArrays and a program built on GetProceduralVertexPrelude(),
+	// so any resolution costs no vertex memory. Not limited to maxMeshSize.
+	bool InitProceduralMesh(int meshSize, Vector3 origin, double meshLength, double meshWidth, Vector3 dir1, Vector3 dir2);
+	// Optional (meshSize + 1)^2 texture whose red channel displaces each
+	// vertex along the plane normal; 0 for a flat grid.
+	void SetHeightTexture(GLuint texture, float heightScale);
+	// Version line and proceduralGridVertex(out position, out normal) for
+	// vertex shaders; must be the start of the source.
+	static const char *GetProceduralVertexPrelude();
+	// Stores this grid's parameters in the program's uniforms. Uniform
+	// values persist, so a program serves one grid.
+	void SetupProceduralProgram(GLuint program) const;
+	bool IsProcedural() const { return procedural; }
+
 	void DrawMesh(int meshSize); // Draws using Immediate Mode Rendering
 	
 	// Draw using VBOs - you need to fill in this code as well as CreateMeshVBO and then in 
 	// Robot3D.cpp you need to call DrawMeshVBO() instead of DrawMesh()
 	void DrawMeshVBO(int meshSize); 
 	void QuadMesh::CreateMeshVBO(int meshSize, GLint attribVertexPosition, GLint attribVertexNormal);
+
+	// Draws only the quads in rows [row0, row1) and columns [col0, col1),
+	// with one glMultiDrawElements range per row, or per block row once the
+	// triangles are grouped by block (then partly covered blocks are drawn
+	// whole). Used for tile culling.
+	void DrawMeshVBORegion(int meshSize, int row0, int row1, int col0, int col1);
+	// Same as DrawMeshVBORegion() but recorded for later replay; safe to
+	// call from any thread.
+	void RecordMeshVBORegion(CommandBuffer &commands, int meshSize, int row0, int row1, int col0, int col1) const;
+
+	// Copies the mesh into a shared arena for indirect drawing; the region
+	// then adds one indirect draw per range DrawMeshVBORegion() would use
+	// (a row, or a block row when grouped by block) to a draw list, with
+	// the given view mask. Triangle lists only.
+	bool AddToArena(GeometryArena &arena);
+	// Forgets the arena copy; call before the arena is deleted.
+	void RemoveFromArena();
+	void AddArenaRegion(GeometryArena::DrawList &list, int meshSize, int row0, int row1, int col0, int col1, float material, unsigned int views = 1) const;
 	
 	
+	// Replaces the triangles with a restricted quadtree per blockSize block:
+	// a node becomes one leaf when its vertices lie within maxError / 2 of a
+	// plane, so the surface stays within maxError of the full grid. Adjacent
+	// leaves differ by at most one level and the larger one takes the shared
+	// midpoint, so there are no T-junction cracks. Unused vertices are
+	// dropped. blockSize must be a power of two dividing meshSize; regions
+	// are then drawn at block granularity. Call after InitMesh() and before
+	// CreateMeshVBO() / AddToArena().
+	// Triangle lists only.
+	bool Simplify(int meshSize, float maxError, int blockSize);
+	// Reorders the triangles for the post-transform vertex cache within each
+	// range regions draw from (a row of quads, or a block when InitMesh() or
+	// Simplify() grouped them), so region drawing is unaffected. A single
+	// row has no vertices to share with the next, so only blocks gain, and
+	// a range keeps its order unless the new one measures better.
+	// CreateMeshVBO() calls this.
+	void OptimizeIndexOrder(int meshSize, int cacheSize = defaultVertexCacheSize);
+	float GetACMR(int cacheSize = defaultVertexCacheSize) const;
+	float GetATVR(int cacheSize = defaultVertexCacheSize) const;
+
+	int GetTriangleCount() const;
+	Topology GetTopology() const { return topology; }
+	int GetVertexCount() const { return (int)(verticesVBO.size() / 3); }
+
 	void SetMaterial(Vector3 ambient, Vector3 diffuse, Vector3 specular, double shininess);
 	void ComputeNormals();
 	
@@ -0,0 +1,131 @@
+#ifndef RENDERQUEUE_H_DEF
+#define RENDERQUEUE_H_DEF
+
+#include <vector>
+
+#include "FrameArena.h"
+
+// Collects opaque draws for a frame and issues them front-to-back by view
+// depth, so near surfaces fill the depth buffer before far ones are shaded.
+//
+// Items are grouped into layers that are flushed separately (occluders
+// before the occlusion queries, everything else after). Items that share
+// GL state name the same state id and the queue only switches state when
+// the id changes. Items with a depth callback take part in the optional
+// depth-only pre-pass, after which the colour pass runs with GL_LEQUAL.
+//
+// With several views (SetViews()) every layer is drawn once per view from
+// the same sorted list: the view callback sets up view v, then the items
+// whose view mask has bit v are drawn. Broadcast items are drawn once
+// before that, after the callback is called with -1, and reach every view
+// through their own shaders.
+//
+// Overdraw is measured with GL_SAMPLES_PASSED around every colour pass (the
+// depth pre-pass is left out) and reported as shaded samples per viewport
+// pixel, a few frames late so the query never stalls. A frame's queries are
+// kept until their results have all been read; while the oldest frame is
+// still waiting on them, new frames go unmeasured.
+//
+// Include GL/glew.h and Vectors.h before this file.
+
+typedef void (*RenderQueueDrawFunc)(int param);
+typedef void (*RenderQueueStateFunc)();
+typedef void (*RenderQueueViewFunc)(int view);
+
+class RenderQueue
+{
+public:
+	enum Layer
+	{
+		Occluders,
+		Opaque,
+		LayerCount
+	};
+
+	// item view masks
+	static const unsigned int AllViews = 0x7fffffffu;
+	static const unsigned int Broadcast = 0x80000000u;
+
+private:
+	struct Item
+	{
+		float depth;
+		int state;
+		int param;
+		unsigned int views;
+		RenderQueueDrawFunc draw;
+		RenderQueueDrawFunc drawDepth;
+	};
+
+	struct State
+	{
+		RenderQueueStateFunc begin;
+		RenderQueueStateFunc end;
+	};
+
+	// one query per colour pass: each layer is drawn once per view plus
+	// once for broadcast items
+	static const int passQueries = 16;
+
+	struct OverdrawFrame
+	{
+		GLuint queries[passQueries];
+		int used;
+		long long pixels;
+	};
+
+	static const int overdrawFrames = 3;
+
+	// per-frame lists, allocated from the frame arena
+	FrameVector<Item> items[LayerCount];
+	std::vector<State> states;
+
+	Vector3 eye;
+	Vector3 forward;
+	bool depthPrepass;
+	int viewCount;
+	RenderQueueViewFunc beginView;
+
+	OverdrawFrame frames[overdrawFrames];
+	int currentFrame;
+	bool countOverdraw;
+	// this frame's slot was free, so its colour passes are being counted
+	bool measuring;
+	float overdraw;
+	int itemsDrawn;
+
+private:
+	void SwitchState(int &current, int next);
+	int DrawPass(const FrameVector<Item> &list, unsigned int views);
+	void CollectOverdraw(OverdrawFrame &frame);
+
+public:
+	RenderQueue();
+	~RenderQueue();
+
+	bool Init();
+	void FreeMemory();
+
+	// Registers begin/end callbacks for a shared GL state; returns its id.
+	// Either callback may be NULL.
+	int AddState(RenderQueueStateFunc begin, RenderQueueStateFunc end);
+
+	void BeginFrame(const Vector3 &eye, const Vector3 &lookAt);
+	// center is used for the sort key only. drawDepth may be NULL, in which
+	// case the item is skipped by the pre-pass.
+	void Submit(Layer layer, const Vector3 &center, int state, RenderQueueDrawFunc draw, RenderQueueDrawFunc drawDepth, int param, unsigned int views = AllViews);
+	void Flush(Layer layer);
+	void EndFrame();
+
+	// one view (the default) never calls beginView
+	void SetViews(int count, RenderQueueViewFunc beginView);
+
+	void SetDepthPrepass(bool enabled) { depthPrepass = enabled; }
+	bool IsDepthPrepass() const { return depthPrepass; }
+
+	// shaded samples per pixel in the most recent completed frame
+	float GetOverdraw() const { return overdraw; }
+	int GetItemsDrawn() const { return itemsDrawn; }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef REPLAYLOG_H_DEF
+#define REPLAYLOG_H_DEF
+
+#include <cstdio>
+#include <vector>
+
+// Binary log of everything that drives the simulation: keyboard and mouse
+// events as GLUT delivered them and the integer millisecond dt of every
+// animation tick. Feeding the same events and ticks back in the same order
+// reproduces a session bit for bit, so a log doubles as a benchmark
+// workload.
+//
+// Every record starts with one varint holding (value << 3) | type. For a
+// tick the value is the zigzag-encoded change in dt, so a steady frame
+// rate costs one byte per tick; for input events it is the time since the
+// last tick in ms, followed by the payload with the pointer position as a
+// zigzag delta from the previous event's. Checkpoints carry a 64-bit hash
+// of the simulation state so a replay can tell where it diverged, and the
+// end record the hash at the moment recording stopped.
+//
+// Writing buffers records and appends them to the file in blocks; reading
+// loads the whole file up front.
+
+class ReplayLog
+{
+public:
+	enum EventType
+	{
+		EventTick,
+		EventKey,
+		EventMouse,
+		EventMotion,
+		EventCheckpoint,
+		EventEnd
+	};
+
+	struct Event
+	{
+		EventType type;
+		// ms since the previous tick (input) or the tick's dt (tick)
+		int time;
+		// key or mouse button
+		int code;
+		int state;
+		int x;
+		int y;
+		unsigned long long hash;
+	};
+
+private:
+	std::FILE *file;
+	bool writing;
+	std::vector<unsigned char> buffer;
+	size_t readPos;
+	bool corrupt;
+
+	int lastDt;
+	int lastX;
+	int lastY;
+	int tickCount;
+
+private:
+	void PutVarint(unsigned long long value);
+	void PutHeader(EventType type, unsigned int value);
+	void PutPointer(int x, int y);
+	bool GetVarint(unsigned long long &value);
+	bool GetPointer(int &x, int &y);
+	void Flush();
+
+public:
+	ReplayLog();
+	~ReplayLog();
+
+	bool OpenWrite(const char *path);
+	bool OpenRead(const char *path);
+	// A log being written gets its end record here.
+	void Close(unsigned long long finalHash = 0);
+
+	void WriteTick(int dtMs);
+	void WriteKey(unsigned char key, int x, int y, int time);
+	void WriteMouse(int button, int state, int x, int y, int time);
+	void WriteMotion(int x, int y, int time);
+	void WriteCheckpoint(unsigned long long hash);
+
+	// false at the end of the log, or at the first malformed record
+	bool Read(Event &event);
+	bool IsCorrupt() const { return corrupt; }
+
+	bool IsWriting() const { return file && writing; }
+	int GetTickCount() const { return tickCount; }
+
+	// FNV-1a, chained through seed
+	static unsigned long long Hash(const void *bytes, size_t size, unsigned long long seed = 14695981039346656037ULL);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SCENEGRAPH_H_DEF
+#define SCENEGRAPH_H_DEF
+
+#include <vector>
+
+// Flat transform hierarchy: nodes live in arrays in the order they were
+// added, and a node's parent must already exist, so every parent comes
+// before its children. Update() is then one pass from front to back that
+// recomputes the world matrix of each node whose local matrix changed or
+// whose parent's world matrix did; untouched subtrees cost one flag test
+// per node.
+//
+// Matrices are column-major 4x4, as GL takes them, and compose like the
+// matrix stack: world = parent world * local.
+
+class SceneGraph
+{
+public:
+	static const int noParent = -1;
+
+	struct Matrix
+	{
+		float m[16];
+	};
+
+private:
+	std::vector<int> parents;
+	std::vector<Matrix> locals;
+	std::vector<Matrix> worlds;
+	// local matrix changed since the last Update()
+	std::vector<unsigned char> dirty;
+	// world matrix changed in the last Update(); read by the children
+	std::vector<unsigned char> moved;
+
+public:
+	// Returns the node index, or -1 if parent doesn't exist yet.
+	int AddNode(int parent, const Matrix &local);
+	// Marks the node dirty only if the matrix actually differs.
+	void SetLocal(int node, const Matrix &local);
+	void Update();
+
+	const float *GetWorld(int node) const { return worlds[node].m; }
+	int GetParent(int node) const { return parents[node]; }
+	int GetNodeCount() const { return (int)parents.size(); }
+	// true if the last Update() gave the node a new world matrix
+	bool HasMoved(int node) const { return moved[node] != 0; }
+
+	// Builders matching glTranslatef, glRotatef (degrees, any axis) and
+	// glScalef, and their product a * b.
+	static Matrix Identity();
+	static Matrix Translation(float x, float y, float z);
+	static Matrix Rotation(float degrees, float x, float y, float z);
+	static Matrix Scaling(float x, float y, float z);
+	static Matrix Multiply(const Matrix &a, const Matrix &b);
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef SHADERUTIL_H_DEF
+#define SHADERUTIL_H_DEF
+
+// Shader compile/link helpers shared by every GLSL program in the app.
+// Include GL/glew.h before this file.
+
+GLuint compileShader(GLenum type, const char *src);
+
+// Links the given shader objects. attribNames[i] is bound to attribute
+// location i before linking (NULL entries are skipped). The shaders are
+// deleted whether or not linking succeeds; returns 0 on failure.
+GLuint linkProgram(const GLuint *shaders, int shaderCount, const char *const *attribNames, int attribCount);
+
+// Convenience wrapper for the common vertex + fragment case.
+GLuint buildProgram(const char *vertexSrc, const char *fragmentSrc, const char *const *attribNames, int attribCount);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef SHADOWMAP_H_DEF
+#define SHADOWMAP_H_DEF
+
+// Cached shadow map for a single light.
+//
+// Static casters are rendered into their own depth map, which is only
+// rebuilt when the light moves or Invalidate() is called. Each frame the
+// cached depth is blitted into the composite map and only the dynamic
+// casters are rendered on top of it, so per-frame shadow cost scales with
+// the number of moving objects.
+//
+// Requires a GL context; include GL/glew.h and Vectors.h before this file.
+
+class ShadowMap
+{
+private:
+	int mapSize;
+
+	// static casters only, rebuilt on invalidation
+	GLuint staticFbo;
+	GLuint staticDepth;
+
+	// cached static depth + dynamic casters, sampled by receivers
+	GLuint fbo;
+	GLuint depthTexture;
+
+	GLfloat lightPosition[4];
+	Vector3 lightTarget;
+	float fieldOfView;
+	float nearPlane;
+	float farPlane;
+
+	GLfloat lightProjection[16];
+	GLfloat lightView[16];
+	GLfloat shadowMatrix[16];
+
+	bool staticValid;
+	bool hasLight;
+	int staticRebuilds;
+
+	GLint savedFramebuffer;
+	GLint savedViewport[4];
+
+private:
+	bool CreateDepthTarget(GLuint &target, GLuint &texture, bool compare);
+	void ComputeMatrices();
+	void BeginPass(GLuint target);
+	void EndPass();
+
+public:
+	ShadowMap(int mapSize = 1024);
+	~ShadowMap();
+
+	bool Init();
+	void FreeMemory();
+
+	// Invalidates the static map only if the light actually changed.
+	void SetLight(const GLfloat position[4], Vector3 target, float fieldOfView, float nearPlane, float farPlane);
+
+	// Call whenever static caster geometry changes.
+	void Invalidate() { staticValid = false; }
+	bool IsStaticValid() const { return staticValid; }
+
+	// Loads the light's view/projection onto the GL matrix stacks and
+	// binds the corresponding depth target. Casters are drawn in world space.
+	void BeginStaticPass();
+	void EndStaticPass();
+	void BeginDynamicPass();
+	void EndDynamicPass();
+
+	GLuint GetDepthTexture() const { return depthTexture; }
+
+	// bias * projection * view, maps world positions to shadow map coordinates
+	const GLfloat *GetShadowMatrix() const { return shadowMatrix; }
+
+	int GetStaticRebuildCount() const { return staticRebuilds; }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef STATEEXPORT_H_DEF
+#define STATEEXPORT_H_DEF
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Live simulation state in a named shared-memory segment, for scoreboards
+// and overlays running as separate processes.
+//
+// The segment is a header followed by a ring of slots, each a fixed-layout
+// Snapshot guarded by its own sequence counter (a seqlock). Publish()
+// writes the next slot, with the counter odd while it writes and even
+// afterwards, then moves the header's latest index. It never waits for
+// anyone. Read() copies the latest slot and retries only if the counter
+// moved meanwhile, which with a ring needs a reader stalled for several
+// ticks. Reading is plain loads from the mapping: no syscalls and no
+// copies beyond the snapshot itself.
+//
+// POSIX shm_open() names ("/robot3d"), or a file mapping name on Windows.
+
+class StateExport
+{
+public:
+	static const int slotCount = 8;
+
+	// Every field is 4 or 8 bytes, so the layout is the same for any
+	// compiler on the same architecture.
+	struct Snapshot
+	{
+		uint64_t tick;
+		uint32_t timeMs;
+		uint32_t movementPhase;
+		uint32_t waterState;
+		uint32_t objectState;
+		uint32_t cameraState;
+		uint32_t paused;
+		float targetPosition[3];
+		float wavePhase;
+		float cameraEye[3];
+		float padding;
+	};
+
+private:
+	struct Slot
+	{
+		std::atomic<uint32_t> sequence;
+		uint32_t padding;
+		Snapshot snapshot;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t slotCount;
+		uint32_t snapshotSize;
+		// ~0 until the first Publish()
+		std::atomic<uint64_t> latest;
+	};
+
+	Header *header;
+	Slot *slots;
+	size_t size;
+	bool publishing;
+	uint64_t published;
+
+#ifdef _WIN32
+	void *mapping;
+#else
+	int fd;
+	char name[64];
+#endif
+
+private:
+	bool Map(bool write);
+
+public:
+	StateExport();
+	~StateExport();
+
+	// Creates (or takes over) the segment and publishes into it.
+	bool Create(const char *name);
+	// Maps an existing segment read-only; false if it isn't one of ours.
+	bool Attach(const char *name);
+	// Unmaps; the publisher also removes the name.
+	void Close();
+
+	void Publish(const Snapshot &snapshot);
+	// false before the first Publish() or if the writer kept lapping us
+	bool Read(Snapshot &snapshot) const;
+
+	bool IsOpen() const { return header != NULL; }
+};
+
+#endif
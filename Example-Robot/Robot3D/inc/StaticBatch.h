@@ -0,0 +1,109 @@
+#ifndef STATICBATCH_H_DEF
+#define STATICBATCH_H_DEF
+
+#include <vector>
+
+#include "GeometryArena.h"
+
+class CommandBuffer;
+
+// Merges static, axis-aligned boxes into one pre-transformed vertex/index
+// buffer. Each vertex carries a material id that indexes a material table
+// uploaded as uniforms, and indices are grouped by material so every
+// material is one contiguous range. All instances of the batch are drawn
+// with one instanced call per material.
+//
+// Include GL/glew.h and Vectors.h before this file.
+
+struct StaticBatchMaterial
+{
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+	GLfloat shininess;
+};
+
+struct StaticBatchVertex
+{
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat material;
+};
+
+class StaticBatch
+{
+public:
+	static const int maxMaterials = 8;
+
+private:
+	struct Box
+	{
+		Vector3 center;
+		Vector3 size;
+		int material;
+	};
+
+	struct Range
+	{
+		int material;
+		GLsizei first;
+		GLsizei count;
+	};
+
+	std::vector<StaticBatchMaterial> materials;
+	std::vector<Box> boxes;
+	std::vector<Range> ranges;
+	std::vector<Vector3> instances;
+
+	GLuint vao;
+	GLuint vbos[3];
+	GLsizei vertexCount;
+	GLsizei indexCount;
+	bool instancesDirty;
+
+	GeometryArena::Mesh arenaMesh;
+	bool inArena;
+
+private:
+	void Generate(std::vector<StaticBatchVertex> &vertexData, std::vector<unsigned int> &indexData);
+
+public:
+	StaticBatch();
+	~StaticBatch();
+
+	int AddMaterial(const StaticBatchMaterial &material);
+	void AddBox(Vector3 center, Vector3 size, int material);
+
+	// Pre-transforms all boxes and uploads them. Attribute locations follow
+	// the program the batch is drawn with.
+	bool Build(GLint attribPosition, GLint attribNormal, GLint attribMaterial, GLint attribInstance);
+
+	// World-space offset of every copy of the batch.
+	void SetInstances(const std::vector<Vector3> &offsets);
+
+	// Uploads the material table; call once per program after linking.
+	void BindMaterials(GLuint program) const;
+
+	void Draw(GLuint program);
+	// Records the same draws as Draw() from any thread. The instance
+	// buffer must be current, so call UploadInstances() on the GL thread
+	// before replaying.
+	void Record(CommandBuffer &commands, GLuint program) const;
+	void UploadInstances();
+
+	// Copies the batch into a shared arena. Each instance then becomes one
+	// indirect draw per material, with the material in the per-draw data.
+	// views is the draws' view mask.
+	bool AddToArena(GeometryArena &arena);
+	// Forgets the arena copy; call before the arena is deleted.
+	void RemoveFromArena();
+	void AddArenaDraws(GeometryArena::DrawList &list, unsigned int views = 1) const;
+	void FreeMemory();
+
+	GLsizei GetVertexCount() const { return vertexCount; }
+	GLsizei GetIndexCount() const { return indexCount; }
+	int GetInstanceCount() const { return (int)instances.size(); }
+	int GetDrawCallCount() const { return (int)ranges.size(); }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TARGETPOOL_H_DEF
+#define TARGETPOOL_H_DEF
+
+#include <vector>
+
+// Live targets as a slot map. The targets themselves sit packed in a dense
+// array with no holes, so iterating them is a walk over 0..GetCount()-1.
+// Callers hold Handles, which name a slot in a sparse array; the slot
+// records where its target currently is in the dense array. Despawn()
+// moves the last target into the freed place and repoints that target's
+// slot, so spawn, despawn and lookup are all O(1).
+//
+// Every slot has a generation that Despawn() bumps, and a handle only
+// resolves while its generation matches. A stale handle to a retired
+// target therefore fails Get() even after its slot is reused. Freed slots
+// are chained into a free list and reused before new ones are added, so
+// once the pool has grown to its peak it never allocates again; Reserve()
+// can do that growth up front.
+//
+// Despawning while iterating moves the last target into the current
+// place, so either walk backwards or collect handles and despawn after.
+// Include Vectors.h before this file.
+
+struct Target
+{
+	Vector3 position;
+	Vector3 velocity;
+	// collision world body, or -1
+	int body;
+};
+
+class TargetPool
+{
+public:
+	struct Handle
+	{
+		unsigned int slot;
+		// 0 is never live, so a zeroed handle is always invalid
+		unsigned int generation;
+	};
+
+private:
+	static const unsigned int noSlot = 0xffffffffu;
+
+	struct Slot
+	{
+		// dense index while live, next free slot while free
+		unsigned int index;
+		unsigned int generation;
+	};
+
+	std::vector<Target> targets;
+	// dense index -> slot, to repoint the target moved by Despawn()
+	std::vector<unsigned int> owners;
+	std::vector<Slot> slots;
+	unsigned int freeSlot;
+
+private:
+	// dense index, or noSlot if the handle is stale
+	unsigned int Find(Handle handle) const;
+
+public:
+	TargetPool();
+
+	void Reserve(int capacity);
+	Handle Spawn(const Target &target);
+	// false if the handle was already stale
+	bool Despawn(Handle handle);
+	void Clear();
+
+	// NULL for a stale handle
+	Target *Get(Handle handle);
+	const Target *Get(Handle handle) const;
+	bool IsAlive(Handle handle) const { return Get(handle) != NULL; }
+
+	int GetCount() const { return (int)targets.size(); }
+	Target &GetTarget(int index) { return targets[index]; }
+	const Target &GetTarget(int index) const { return targets[index]; }
+	Handle GetHandle(int index) const;
+};
+
+#endif
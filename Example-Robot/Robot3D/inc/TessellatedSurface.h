@@ -0,0 +1,62 @@
+#ifndef TESSELLATEDSURFACE_H_DEF
+#define TESSELLATEDSURFACE_H_DEF
+
+// A height field drawn as a coarse grid of quad patches that the GPU
+// subdivides. Only the patch corners live in a buffer (4 xz pairs per
+// patch); the control stage picks each edge's level from its projected
+// length in pixels and the evaluation stage places every generated vertex
+// with the program's surfaceHeight(), normals from central differences.
+// Both patches sharing an edge compute its level from the same two
+// corners, so the surface has no cracks.
+//
+// Programs come from BuildProgram(). surfaceSrc is pasted into the
+// evaluation shader (GLSL 4.00 compatibility) and must define
+//     float surfaceHeight(vec2 xz);
+//     void shadeVertex(vec3 position, vec3 normal);
+// where shadeVertex() writes gl_Position and the fragment inputs. Outputs
+// may be declared VERTEX_OUT (defined as out here), so shading code can be
+// shared with vertex shaders that define it as varying. uBaseHeight holds
+// the rest height.
+//
+// Needs GL 4.0 or ARB_tessellation_shader.
+// Include GL/glew.h before this file.
+
+class TessellatedSurface
+{
+private:
+	float originX;
+	float originZ;
+	float sizeX;
+	float sizeZ;
+	int patchesX;
+	int patchesZ;
+	float baseHeight;
+	float pixelsPerSegment;
+	float maxLevel;
+
+	GLuint vao;
+	GLuint vbo;
+
+public:
+	// Patches are numbered row-major, rows along z. Sizes may be negative
+	// to number them the other way.
+	TessellatedSurface(float originX, float originZ, float sizeX, float sizeZ, int patchesX, int patchesZ, float baseHeight);
+	~TessellatedSurface();
+
+	static bool IsSupported();
+	static GLuint BuildProgram(const char *surfaceSrc, const char *fragmentSrc);
+
+	bool Init();
+	void FreeMemory();
+
+	// Target on-screen length of one generated segment, and the cap.
+	void SetDetail(float pixelsPerSegment, float maxLevel);
+
+	// Draws the listed patches (all of them for NULL) with program, which
+	// must be current. The level uniforms are set here from the viewport.
+	void Draw(GLuint program, const int *patches, int patchCount) const;
+
+	int GetPatchCount() const { return patchesX * patchesZ; }
+};
+
+#endif
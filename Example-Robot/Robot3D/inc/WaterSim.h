@@ -0,0 +1,93 @@
+#ifndef WATERSIM_H_DEF
+#define WATERSIM_H_DEF
+
+#include <vector>
+
+class WorkerPool;
+
+// Height-field wave-equation solver over a rectangle of the xz plane.
+//
+// Heights are displacements from the rest level. Two buffers hold the
+// current and previous step; each step writes the next state over the
+// previous one (every cell only reads its own previous value) and swaps,
+// so there is no third buffer and no copying. The border is held at zero.
+//
+// Rows are split across a WorkerPool and the inner loop runs four cells
+// at a time with SSE where available. Steps are fixed-size and driven
+// from Advance() with an accumulator, so results only depend on the
+// sequence of dt values.
+
+class WaterSim
+{
+private:
+	struct Impulse
+	{
+		float x;
+		float z;
+		float radius;
+		float strength;
+	};
+
+	int cellsX;
+	int cellsZ;
+	float originX;
+	float originZ;
+	float sizeX;
+	float sizeZ;
+	float cellSizeX;
+	float cellSizeZ;
+
+	std::vector<float> current;
+	std::vector<float> previous;
+	std::vector<Impulse> impulses;
+	std::vector<float> rowActivity;
+
+	float stepTime;
+	float accumulator;
+	float waveSpeed;
+	float damping;
+	float coefX;
+	float coefZ;
+	float activity;
+	int maxStepsPerAdvance;
+
+	WorkerPool *pool;
+
+private:
+	void ApplyImpulses();
+	void StepRows(int rowBegin, int rowEnd);
+	static void StepTask(void *context, int begin, int end, int worker);
+	void UpdateCoefficients();
+
+public:
+	// Heights at rest are below this, and it counts as settled.
+	static const float restThreshold;
+
+	WaterSim(int cellsX, int cellsZ, float originX, float originZ, float sizeX, float sizeZ, float stepHz = 120.0f);
+
+	void SetWorkerPool(WorkerPool *pool) { this->pool = pool; }
+	// Speed is clamped so the explicit scheme stays stable for the grid.
+	void SetWaveSpeed(float speed);
+	void SetDamping(float damping) { this->damping = damping; }
+
+	// Queues a circular depression (negative strength) or bump in world
+	// coordinates; it is applied at the start of the next step.
+	void AddImpulse(float x, float z, float radius, float strength);
+
+	// Runs as many fixed steps as dt covers.
+	void Advance(float dt);
+	void Step();
+	void Reset();
+
+	// Bilinear lookup of the displacement; 0 outside the grid.
+	float SampleHeight(float x, float z) const;
+
+	bool IsAtRest() const { return impulses.empty() && activity < restThreshold; }
+
+	int GetCellsX() const { return cellsX; }
+	int GetCellsZ() const { return cellsZ; }
+	const float *GetHeights() const { return &current[0]; }
+	float GetStepTime() const { return stepTime; }
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef WORKERPOOL_H_DEF
+#define WORKERPOOL_H_DEF
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for data-parallel loops. ParallelFor() splits
+// [0, count) into one contiguous chunk per thread (the calling thread takes
+// the first one) and returns once every chunk is done. The split depends
+// only on count and the thread count, so results are deterministic as long
+// as chunks write disjoint data. ParallelFor() must not be called from
+// more than one thread at a time.
+
+typedef void (*WorkerPoolTask)(void *context, int begin, int end, int worker);
+
+class WorkerPool
+{
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	WorkerPoolTask task;
+	void *context;
+	int count;
+	unsigned int generation;
+	int remaining;
+	bool stopping;
+
+private:
+	void WorkerMain(int worker);
+	void RunChunk(int worker);
+
+public:
+	// threadCount includes the calling thread; 0 picks the hardware count.
+	explicit WorkerPool(int threadCount = 0);
+	~WorkerPool();
+
+	void ParallelFor(int count, WorkerPoolTask task, void *context);
+
+	int GetThreadCount() const { return (int)threads.size() + 1; }
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <vector>
+
+#include "Vectors.h"
+#include "CollisionWorld.h"
+
+namespace
+{
+	struct EntryLess
+	{
+		template <typename T>
+		bool operator()(const T &a, const T &b) const
+		{
+			return a.minX < b.minX;
+		}
+	};
+}
+
+CollisionWorld::CollisionWorld()
+{
+	addedCount = 0;
+	candidateCount = 0;
+}
+
+int CollisionWorld::AddEllipsoid(const Vector3 &center, const Vector3 &radii)
+{
+	return AddBody(center, radii, false);
+}
+
+int CollisionWorld::AddBox(const Vector3 &center, const Vector3 &halfSize)
+{
+	return AddBody(center, halfSize, true);
+}
+
+int CollisionWorld::AddBody(const Vector3 &center, const Vector3 &extent, bool isBox)
+{
+	Entry entry;
+	entry.isBox = isBox ? 1 : 0;
+	if (!freeBodies.empty())
+	{
+		entry.body = freeBodies.back();
+		freeBodies.pop_back();
+		centers[entry.body] = center;
+		extents[entry.body] = extent;
+		boxes[entry.body] = isBox ? 1 : 0;
+		live[entry.body] = 1;
+	}
+	else
+	{
+		entry.body = (int)centers.size();
+		centers.push_back(center);
+		extents.push_back(extent);
+		boxes.push_back(isBox ? 1 : 0);
+		live.push_back(1);
+	}
+	RefreshEntry(entry);
+	entries.push_back(entry);
+	addedCount++;
+	return entry.body;
+}
+
+void CollisionWorld::RemoveBody(int body)
+{
+	if (!live[body])
+		return;
+
+	live[body] = 0;
+	removedBodies.push_back(body);
+}
+
+void CollisionWorld::Clear()
+{
+	centers.clear();
+	extents.clear();
+	boxes.clear();
+	live.clear();
+	entries.clear();
+	pairs.clear();
+	removedBodies.clear();
+	freeBodies.clear();
+	addedCount = 0;
+	candidateCount = 0;
+}
+
+void CollisionWorld::RefreshEntry(Entry &entry) const
+{
+	const Vector3 &c = centers[entry.body];
+	const Vector3 &e = extents[entry.body];
+	entry.minX = c.x - e.x;
+	entry.maxX = c.x + e.x;
+	entry.minY = c.y - e.y;
+	entry.maxY = c.y + e.y;
+	entry.minZ = c.z - e.z;
+	entry.maxZ = c.z + e.z;
+}
+
+// Entries already in the array are insertion sorted: each only moves past
+// the few it overtook. New entries sit at the end in no particular order and
+// could each travel the whole array, so they are sorted on their own and
+// merged in from the back, one pass whatever their count.
+void CollisionWorld::SortEntries()
+{
+	size_t count = entries.size();
+	size_t settled = count - std::min((size_t)addedCount, count);
+	addedCount = 0;
+
+	for (size_t i = 1; i < settled; ++i)
+	{
+		if (entries[i - 1].minX <= entries[i].minX)
+			continue;
+
+		Entry entry = entries[i];
+		size_t j = i;
+		while (j > 0 && entries[j - 1].minX > entry.minX)
+		{
+			entries[j] = entries[j - 1];
+			--j;
+		}
+		entries[j] = entry;
+	}
+
+	if (settled == count)
+		return;
+
+	added.assign(entries.begin() + settled, entries.end());
+	std::sort(added.begin(), added.end(), EntryLess());
+	size_t from = settled;
+	size_t next = added.size();
+	size_t to = count;
+	while (next > 0)
+	{
+		if (from > 0 && entries[from - 1].minX > added[next - 1].minX)
+			entries[--to] = entries[--from];
+		else
+			entries[--to] = added[--next];
+	}
+}
+
+bool CollisionWorld::Touch(int a, int b) const
+{
+	if (boxes[a])
+		std::swap(a, b);
+
+	const Vector3 &ca = centers[a];
+	const Vector3 &ra = extents[a];
+	const Vector3 &cb = centers[b];
+	const Vector3 &eb = extents[b];
+	float dx, dy, dz;
+	if (boxes[b])
+	{
+		dx = std::max(cb.x - eb.x, std::min(ca.x, cb.x + eb.x)) - ca.x;
+		dy = std::max(cb.y - eb.y, std::min(ca.y, cb.y + eb.y)) - ca.y;
+		dz = std::max(cb.z - eb.z, std::min(ca.z, cb.z + eb.z)) - ca.z;
+		dx /= ra.x;
+		dy /= ra.y;
+		dz /= ra.z;
+	}
+	else
+	{
+		dx = (cb.x - ca.x) / (ra.x + eb.x);
+		dy = (cb.y - ca.y) / (ra.y + eb.y);
+		dz = (cb.z - ca.z) / (ra.z + eb.z);
+	}
+	return dx * dx + dy * dy + dz * dz <= 1.0f;
+}
+
+void CollisionWorld::Update()
+{
+	// drop removed bodies' entries in the same pass, keeping the order
+	size_t kept = 0;
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		Entry &entry = entries[i];
+		if (!live[entry.body])
+			continue;
+		if (!entry.isBox)
+			RefreshEntry(entry);
+		entries[kept++] = entry;
+	}
+	entries.resize(kept);
+	freeBodies.insert(freeBodies.end(), removedBodies.begin(), removedBodies.end());
+	removedBodies.clear();
+	SortEntries();
+
+	pairs.clear();
+	candidateCount = 0;
+	size_t count = entries.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Entry &first = entries[i];
+		for (size_t j = i + 1; j < count && entries[j].minX <= first.maxX; ++j)
+		{
+			// one branch instead of five; most x overlaps fail here
+			const Entry &second = entries[j];
+			int overlap = (first.maxY >= second.minY) & (second.maxY >= first.minY) &
+				(first.maxZ >= second.minZ) & (second.maxZ >= first.minZ) & !(first.isBox & second.isBox);
+			if (!overlap)
+				continue;
+
+			candidateCount++;
+			if (Touch(first.body, second.body))
+			{
+				Pair pair = { std::min(first.body, second.body), std::max(first.body, second.body) };
+				pairs.push_back(pair);
+			}
+		}
+	}
+}
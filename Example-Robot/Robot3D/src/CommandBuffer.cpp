@@ -0,0 +1,437 @@
+#include <cstring>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "FrameArena.h"
+#include "CommandBuffer.h"
+#include "PerfCounters.h"
+
+#define BUFFER_OFFSET(offset) ((void*)(offset))
+
+namespace
+{
+	const size_t wordSize = sizeof(unsigned int);
+
+	template <typename T>
+	T Get(const unsigned int *&p)
+	{
+		T value;
+		std::memcpy(&value, p, sizeof(T));
+		p += (sizeof(T) + wordSize - 1) / wordSize;
+		return value;
+	}
+
+	const GLfloat *GetFloats(const unsigned int *&p, size_t count)
+	{
+		const GLfloat *values = reinterpret_cast<const GLfloat *>(p);
+		p += count;
+		return values;
+	}
+}
+
+CommandBuffer::CommandBuffer()
+{
+	commandCount = 0;
+}
+
+void CommandBuffer::Reset()
+{
+	// the old storage may belong to an arena that has been rewound
+	FrameVector<unsigned int>().swap(data);
+	commandCount = 0;
+}
+
+void CommandBuffer::PutBytes(const void *bytes, size_t size)
+{
+	size_t start = data.size();
+	data.resize(start + (size + wordSize - 1) / wordSize, 0);
+	std::memcpy(&data[start], bytes, size);
+}
+
+void CommandBuffer::BindVertexArray(GLuint vao)
+{
+	Put((int)OpBindVertexArray);
+	Put(vao);
+	commandCount++;
+}
+
+void CommandBuffer::UseProgram(GLuint program)
+{
+	Put((int)OpUseProgram);
+	Put(program);
+	commandCount++;
+}
+
+void CommandBuffer::BindBuffer(GLenum target, GLuint buffer)
+{
+	Put((int)OpBindBuffer);
+	Put(target);
+	Put(buffer);
+	commandCount++;
+}
+
+void CommandBuffer::BufferData(GLenum target, const void *bytes, size_t size)
+{
+	Put((int)OpBufferData);
+	Put(target);
+	Put(size);
+	PutBytes(bytes, size);
+	commandCount++;
+}
+
+void CommandBuffer::BindTexture(GLenum unit, GLenum target, GLuint texture)
+{
+	Put((int)OpBindTexture);
+	Put(unit);
+	Put(target);
+	Put(texture);
+	commandCount++;
+}
+
+void CommandBuffer::Uniform1f(GLint location, GLfloat value)
+{
+	Put((int)OpUniform1f);
+	Put(location);
+	Put(value);
+	commandCount++;
+}
+
+void CommandBuffer::Uniform4fv(GLint location, GLsizei count, const GLfloat *values)
+{
+	Put((int)OpUniform4fv);
+	Put(location);
+	Put(count);
+	PutBytes(values, count * 4 * sizeof(GLfloat));
+	commandCount++;
+}
+
+void CommandBuffer::UniformMatrix4fv(GLint location, const GLfloat *matrix)
+{
+	Put((int)OpUniformMatrix4fv);
+	Put(location);
+	PutBytes(matrix, 16 * sizeof(GLfloat));
+	commandCount++;
+}
+
+void CommandBuffer::Material(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4], GLfloat shininess)
+{
+	Put((int)OpMaterial);
+	PutBytes(ambient, 4 * sizeof(GLfloat));
+	PutBytes(diffuse, 4 * sizeof(GLfloat));
+	PutBytes(specular, 4 * sizeof(GLfloat));
+	Put(shininess);
+	commandCount++;
+}
+
+void CommandBuffer::PushMatrix()
+{
+	Put((int)OpPushMatrix);
+	commandCount++;
+}
+
+void CommandBuffer::PopMatrix()
+{
+	Put((int)OpPopMatrix);
+	commandCount++;
+}
+
+void CommandBuffer::Translate(GLfloat x, GLfloat y, GLfloat z)
+{
+	const GLfloat values[] = { x, y, z };
+	Put((int)OpTranslate);
+	PutBytes(values, sizeof(values));
+	commandCount++;
+}
+
+void CommandBuffer::Rotate(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
+{
+	const GLfloat values[] = { angle, x, y, z };
+	Put((int)OpRotate);
+	PutBytes(values, sizeof(values));
+	commandCount++;
+}
+
+void CommandBuffer::Scale(GLfloat x, GLfloat y, GLfloat z)
+{
+	const GLfloat values[] = { x, y, z };
+	Put((int)OpScale);
+	PutBytes(values, sizeof(values));
+	commandCount++;
+}
+
+void CommandBuffer::MultMatrix(const GLfloat *matrix)
+{
+	Put((int)OpMultMatrix);
+	PutBytes(matrix, 16 * sizeof(GLfloat));
+	commandCount++;
+}
+
+void CommandBuffer::DrawElements(GLenum mode, GLsizei count, GLenum type, size_t offset)
+{
+	Put((int)OpDrawElements);
+	Put(mode);
+	Put(count);
+	Put(type);
+	Put(offset);
+	commandCount++;
+}
+
+void CommandBuffer::DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, size_t offset, GLsizei instances)
+{
+	Put((int)OpDrawElementsInstanced);
+	Put(mode);
+	Put(count);
+	Put(type);
+	Put(offset);
+	Put(instances);
+	commandCount++;
+}
+
+void CommandBuffer::MultiDrawElements(GLenum mode, const GLsizei *counts, GLenum type, const size_t *offsets, GLsizei drawCount)
+{
+	Put((int)OpMultiDrawElements);
+	Put(mode);
+	Put(type);
+	Put(drawCount);
+	PutBytes(counts, drawCount * sizeof(GLsizei));
+	for (GLsizei i = 0; i < drawCount; ++i)
+		Put(offsets[i]);
+	commandCount++;
+}
+
+void CommandBuffer::MultiDrawElementsIndirect(GLenum mode, GLenum type, size_t offset, GLsizei drawCount, GLsizei stride, GLsizei indexTotal)
+{
+	Put((int)OpMultiDrawElementsIndirect);
+	Put(mode);
+	Put(type);
+	Put(offset);
+	Put(drawCount);
+	Put(stride);
+	Put(indexTotal);
+	commandCount++;
+}
+
+void CommandBuffer::MultiDrawArrays(GLenum mode, const GLint *firsts, const GLsizei *counts, GLsizei drawCount)
+{
+	Put((int)OpMultiDrawArrays);
+	Put(mode);
+	Put(drawCount);
+	PutBytes(firsts, drawCount * sizeof(GLint));
+	PutBytes(counts, drawCount * sizeof(GLsizei));
+	commandCount++;
+}
+
+void CommandBuffer::DrawClientArrays(GLenum mode, const GLfloat *positions, const GLfloat *normals, GLsizei vertexCount)
+{
+	Put((int)OpDrawClientArrays);
+	Put(mode);
+	Put(vertexCount);
+	Put((int)(normals != NULL));
+	PutBytes(positions, vertexCount * 3 * sizeof(GLfloat));
+	if (normals)
+		PutBytes(normals, vertexCount * 3 * sizeof(GLfloat));
+	commandCount++;
+}
+
+void CommandBuffer::Call(CommandBufferFunc func, float a, float b, float c, float d)
+{
+	const float args[] = { a, b, c, d };
+	Put((int)OpCall);
+	Put(func);
+	PutBytes(args, sizeof(args));
+	commandCount++;
+}
+
+void CommandBuffer::Replay() const
+{
+	if (data.empty())
+		return;
+
+	const unsigned int *p = &data[0];
+	const unsigned int *end = p + data.size();
+	// multi-draw offsets are unpacked here; at most one frame's worth
+	FrameVector<const GLvoid *> pointers;
+
+	while (p < end)
+	{
+		switch (Get<int>(p))
+		{
+		case OpBindVertexArray:
+			glBindVertexArray(Get<GLuint>(p));
+			break;
+		case OpUseProgram:
+			glUseProgram(Get<GLuint>(p));
+			PerfCounters::Add(PerfCounters::ProgramBinds);
+			break;
+		case OpBindBuffer:
+		{
+			GLenum target = Get<GLenum>(p);
+			glBindBuffer(target, Get<GLuint>(p));
+			break;
+		}
+		case OpBufferData:
+		{
+			GLenum target = Get<GLenum>(p);
+			size_t size = Get<size_t>(p);
+			glBufferData(target, size, p, GL_STREAM_DRAW);
+			PerfCounters::Add(PerfCounters::UploadBytes, size);
+			p += (size + wordSize - 1) / wordSize;
+			break;
+		}
+		case OpBindTexture:
+		{
+			GLenum unit = Get<GLenum>(p);
+			GLenum target = Get<GLenum>(p);
+			glActiveTexture(unit);
+			glBindTexture(target, Get<GLuint>(p));
+			glActiveTexture(GL_TEXTURE0);
+			break;
+		}
+		case OpUniform1f:
+		{
+			GLint location = Get<GLint>(p);
+			glUniform1f(location, Get<GLfloat>(p));
+			break;
+		}
+		case OpUniform4fv:
+		{
+			GLint location = Get<GLint>(p);
+			GLsizei count = Get<GLsizei>(p);
+			glUniform4fv(location, count, GetFloats(p, count * 4));
+			break;
+		}
+		case OpUniformMatrix4fv:
+		{
+			GLint location = Get<GLint>(p);
+			glUniformMatrix4fv(location, 1, GL_FALSE, GetFloats(p, 16));
+			break;
+		}
+		case OpMaterial:
+		{
+			glMaterialfv(GL_FRONT, GL_AMBIENT, GetFloats(p, 4));
+			glMaterialfv(GL_FRONT, GL_DIFFUSE, GetFloats(p, 4));
+			glMaterialfv(GL_FRONT, GL_SPECULAR, GetFloats(p, 4));
+			glMaterialfv(GL_FRONT, GL_SHININESS, GetFloats(p, 1));
+			PerfCounters::Add(PerfCounters::MaterialChanges);
+			break;
+		}
+		case OpPushMatrix:
+			glPushMatrix();
+			break;
+		case OpPopMatrix:
+			glPopMatrix();
+			break;
+		case OpTranslate:
+		{
+			const GLfloat *v = GetFloats(p, 3);
+			glTranslatef(v[0], v[1], v[2]);
+			break;
+		}
+		case OpRotate:
+		{
+			const GLfloat *v = GetFloats(p, 4);
+			glRotatef(v[0], v[1], v[2], v[3]);
+			break;
+		}
+		case OpScale:
+		{
+			const GLfloat *v = GetFloats(p, 3);
+			glScalef(v[0], v[1], v[2]);
+			break;
+		}
+		case OpMultMatrix:
+			glMultMatrixf(GetFloats(p, 16));
+			break;
+		case OpDrawElements:
+		{
+			GLenum mode = Get<GLenum>(p);
+			GLsizei count = Get<GLsizei>(p);
+			GLenum type = Get<GLenum>(p);
+			glDrawElements(mode, count, type, BUFFER_OFFSET(Get<size_t>(p)));
+			PerfCounters::CountDraws(1, count, false);
+			break;
+		}
+		case OpDrawElementsInstanced:
+		{
+			GLenum mode = Get<GLenum>(p);
+			GLsizei count = Get<GLsizei>(p);
+			GLenum type = Get<GLenum>(p);
+			size_t offset = Get<size_t>(p);
+			GLsizei instances = Get<GLsizei>(p);
+			glDrawElementsInstanced(mode, count, type, BUFFER_OFFSET(offset), instances);
+			PerfCounters::CountDraws(1, (unsigned long long)count * instances, false);
+			break;
+		}
+		case OpMultiDrawElements:
+		{
+			GLenum mode = Get<GLenum>(p);
+			GLenum type = Get<GLenum>(p);
+			GLsizei drawCount = Get<GLsizei>(p);
+			const GLsizei *counts = reinterpret_cast<const GLsizei *>(p);
+			p += drawCount;
+			pointers.resize(drawCount);
+			unsigned long long indices = 0;
+			for (GLsizei i = 0; i < drawCount; ++i)
+			{
+				pointers[i] = BUFFER_OFFSET(Get<size_t>(p));
+				indices += counts[i];
+			}
+			glMultiDrawElements(mode, counts, type, &pointers[0], drawCount);
+			PerfCounters::CountDraws(1, indices, false);
+			break;
+		}
+		case OpMultiDrawElementsIndirect:
+		{
+			GLenum mode = Get<GLenum>(p);
+			GLenum type = Get<GLenum>(p);
+			size_t offset = Get<size_t>(p);
+			GLsizei drawCount = Get<GLsizei>(p);
+			GLsizei stride = Get<GLsizei>(p);
+			glMultiDrawElementsIndirect(mode, type, BUFFER_OFFSET(offset), drawCount, stride);
+			PerfCounters::CountDraws(1, Get<GLsizei>(p), false);
+			break;
+		}
+		case OpMultiDrawArrays:
+		{
+			GLenum mode = Get<GLenum>(p);
+			GLsizei drawCount = Get<GLsizei>(p);
+			const GLint *firsts = reinterpret_cast<const GLint *>(p);
+			p += drawCount;
+			const GLsizei *counts = reinterpret_cast<const GLsizei *>(p);
+			p += drawCount;
+			glMultiDrawArrays(mode, firsts, counts, drawCount);
+			unsigned long long vertices = 0;
+			for (GLsizei i = 0; i < drawCount; ++i)
+				vertices += counts[i];
+			PerfCounters::CountDraws(1, vertices, false);
+			break;
+		}
+		case OpDrawClientArrays:
+		{
+			GLenum mode = Get<GLenum>(p);
+			GLsizei vertexCount = Get<GLsizei>(p);
+			bool hasNormals = Get<int>(p) != 0;
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glVertexPointer(3, GL_FLOAT, 0, GetFloats(p, vertexCount * 3));
+			if (hasNormals)
+			{
+				glEnableClientState(GL_NORMAL_ARRAY);
+				glNormalPointer(GL_FLOAT, 0, GetFloats(p, vertexCount * 3));
+			}
+			glDrawArrays(mode, 0, vertexCount);
+			PerfCounters::CountDraws(1, vertexCount, true);
+			glDisableClientState(GL_NORMAL_ARRAY);
+			glDisableClientState(GL_VERTEX_ARRAY);
+			break;
+		}
+		case OpCall:
+		{
+			CommandBufferFunc func = Get<CommandBufferFunc>(p);
+			func(GetFloats(p, 4));
+			break;
+		}
+		}
+	}
+}
@@ -0,0 +1,260 @@
+#include <algorithm>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define FREEGLUT_STATIC
+#include <GL/freeglut.h>
+
+#include "DynamicResolution.h"
+
+const float DynamicResolution::upperBound = 1.1f;
+const float DynamicResolution::lowerBound = 0.8f;
+
+DynamicResolution::DynamicResolution(float targetFrameMs)
+{
+	windowWidth = windowHeight = 0;
+	renderWidth = renderHeight = 0;
+
+	fbo = 0;
+	colorTexture = 0;
+	depthRenderbuffer = 0;
+
+	for (int i = 0; i < queryCount; ++i)
+	{
+		timerQueries[i] = 0;
+		queryIssued[i] = false;
+	}
+	currentQuery = 0;
+	useTimerQueries = false;
+	cpuFrameStart = 0;
+
+	enabled = true;
+	scale = 1.0f;
+	minScale = 0.5f;
+	maxScale = 1.0f;
+	scaleStep = 0.05f;
+
+	this->targetFrameMs = targetFrameMs;
+	smoothedFrameMs = 0.0f;
+	framesOverBudget = 0;
+	framesUnderBudget = 0;
+	cooldownFrames = 0;
+}
+
+DynamicResolution::~DynamicResolution()
+{
+	FreeMemory();
+}
+
+bool DynamicResolution::Init(int width, int height)
+{
+	windowWidth = width;
+	windowHeight = height;
+
+	useTimerQueries = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (useTimerQueries)
+		glGenQueries(queryCount, timerQueries);
+
+	if (!CreateTarget())
+	{
+		FreeMemory();
+		return false;
+	}
+	UpdateRenderSize();
+	return true;
+}
+
+bool DynamicResolution::CreateTarget()
+{
+	if (windowWidth <= 0 || windowHeight <= 0)
+		return false;
+
+	if (!fbo)
+		glGenFramebuffers(1, &fbo);
+	if (!colorTexture)
+		glGenTextures(1, &colorTexture);
+	if (!depthRenderbuffer)
+		glGenRenderbuffers(1, &depthRenderbuffer);
+
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, windowWidth, windowHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, windowWidth, windowHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return status == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void DynamicResolution::Resize(int width, int height)
+{
+	// a minimised window reports 0x0; keep the old target for when it returns
+	if (width <= 0 || height <= 0 || (width == windowWidth && height == windowHeight))
+		return;
+
+	windowWidth = width;
+	windowHeight = height;
+	if (fbo && !CreateTarget())
+	{
+		FreeMemory();
+		return;
+	}
+	UpdateRenderSize();
+}
+
+void DynamicResolution::FreeMemory()
+{
+	if (fbo)
+		glDeleteFramebuffers(1, &fbo);
+	if (colorTexture)
+		glDeleteTextures(1, &colorTexture);
+	if (depthRenderbuffer)
+		glDeleteRenderbuffers(1, &depthRenderbuffer);
+	if (timerQueries[0])
+		glDeleteQueries(queryCount, timerQueries);
+
+	fbo = 0;
+	colorTexture = 0;
+	depthRenderbuffer = 0;
+	for (int i = 0; i < queryCount; ++i)
+	{
+		timerQueries[i] = 0;
+		queryIssued[i] = false;
+	}
+}
+
+void DynamicResolution::UpdateRenderSize()
+{
+	renderWidth = std::max(1, (int)(windowWidth * scale + 0.5f));
+	renderHeight = std::max(1, (int)(windowHeight * scale + 0.5f));
+}
+
+void DynamicResolution::SetEnabled(bool enabled)
+{
+	this->enabled = enabled;
+	if (!enabled)
+	{
+		scale = maxScale;
+		UpdateRenderSize();
+	}
+	smoothedFrameMs = 0.0f;
+	framesOverBudget = framesUnderBudget = 0;
+}
+
+void DynamicResolution::SetScaleRange(float minScale, float maxScale)
+{
+	this->minScale = std::min(minScale, maxScale);
+	this->maxScale = maxScale;
+	scale = std::max(this->minScale, std::min(this->maxScale, scale));
+	UpdateRenderSize();
+}
+
+void DynamicResolution::BeginFrame()
+{
+	if (!IsEnabled())
+		return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, renderWidth, renderHeight);
+
+	if (useTimerQueries)
+	{
+		glBeginQuery(GL_TIME_ELAPSED, timerQueries[currentQuery]);
+	}
+	else
+	{
+		cpuFrameStart = glutGet(GLUT_ELAPSED_TIME);
+	}
+}
+
+void DynamicResolution::EndFrame(GLuint targetFramebuffer)
+{
+	if (!IsEnabled())
+		return;
+
+	if (useTimerQueries)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		queryIssued[currentQuery] = true;
+		currentQuery = (currentQuery + 1) % queryCount;
+
+		// the oldest query is from a few frames ago; read it without stalling
+		if (queryIssued[currentQuery])
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(timerQueries[currentQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(timerQueries[currentQuery], GL_QUERY_RESULT, &elapsed);
+				queryIssued[currentQuery] = false;
+				ReportFrameTime(elapsed * 1.0e-6f);
+			}
+		}
+	}
+	else
+	{
+		// no timer queries: wait for the frame so wall time means something
+		glFinish();
+		ReportFrameTime((float)(glutGet(GLUT_ELAPSED_TIME) - cpuFrameStart));
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFramebuffer);
+	glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+	glViewport(0, 0, windowWidth, windowHeight);
+}
+
+void DynamicResolution::ReportFrameTime(float frameMs)
+{
+	smoothedFrameMs = smoothedFrameMs <= 0.0f ? frameMs : smoothedFrameMs * 0.9f + frameMs * 0.1f;
+
+	// give the average time to reflect a scale change before reacting again
+	if (cooldownFrames > 0)
+	{
+		cooldownFrames--;
+		return;
+	}
+
+	if (smoothedFrameMs > targetFrameMs * upperBound)
+	{
+		framesOverBudget++;
+		framesUnderBudget = 0;
+	}
+	else if (smoothedFrameMs < targetFrameMs * lowerBound)
+	{
+		framesUnderBudget++;
+		framesOverBudget = 0;
+	}
+	else
+	{
+		framesOverBudget = framesUnderBudget = 0;
+	}
+
+	float newScale = scale;
+	if (framesOverBudget >= framesBeforeDownscale)
+		newScale = std::max(minScale, scale - scaleStep);
+	else if (framesUnderBudget >= framesBeforeUpscale)
+		newScale = std::min(maxScale, scale + scaleStep);
+
+	if (newScale != scale)
+	{
+		scale = newScale;
+		UpdateRenderSize();
+		framesOverBudget = framesUnderBudget = 0;
+		cooldownFrames = framesAfterChange;
+	}
+}
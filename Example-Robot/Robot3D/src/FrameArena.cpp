@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if defined(__cpp_aligned_new) && defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#include "FrameArena.h"
+
+static std::atomic<unsigned int> frameNumber(0);
+static std::atomic<unsigned long long> heapAllocations(0);
+
+FrameArena::FrameArena(size_t blockSize)
+{
+	this->blockSize = blockSize;
+	first = NULL;
+	current = NULL;
+	offset = 0;
+	used = 0;
+	highWater = 0;
+	frame = frameNumber.load(std::memory_order_relaxed);
+}
+
+FrameArena::~FrameArena()
+{
+	while (first)
+	{
+		Block *next = first->next;
+		std::free(first);
+		first = next;
+	}
+}
+
+FrameArena::Block *FrameArena::NewBlock(size_t minSize)
+{
+	size_t size = std::max(blockSize, minSize);
+	// growing the arena is heap traffic too
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	Block *block = static_cast<Block *>(std::malloc(sizeof(Block) + size));
+	if (!block)
+		throw std::bad_alloc();
+	block->next = NULL;
+	block->size = size;
+	return block;
+}
+
+void *FrameArena::Allocate(size_t size, size_t alignment)
+{
+	if (size == 0)
+		size = 1;
+
+	for (;;)
+	{
+		if (current)
+		{
+			uintptr_t base = reinterpret_cast<uintptr_t>(BlockData(current));
+			uintptr_t start = (base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			if (start + size <= base + current->size)
+			{
+				used += start + size - (base + offset);
+				highWater = std::max(highWater, used);
+				offset = start + size - base;
+				return reinterpret_cast<void *>(start);
+			}
+		}
+
+		// the rest of this block is wasted until the next reset
+		Block *next = current ? current->next : first;
+		if (!next || next->size < size + alignment)
+		{
+			Block *block = NewBlock(size + alignment);
+			block->next = next;
+			if (current)
+				current->next = block;
+			else
+				first = block;
+			next = block;
+		}
+		current = next;
+		offset = 0;
+	}
+}
+
+void FrameArena::Reset()
+{
+	current = first;
+	offset = 0;
+	used = 0;
+}
+
+FrameArena &FrameArena::Current()
+{
+	static thread_local FrameArena arena;
+	unsigned int now = frameNumber.load(std::memory_order_relaxed);
+	if (arena.frame != now)
+	{
+		arena.Reset();
+		arena.frame = now;
+	}
+	return arena;
+}
+
+void FrameArena::NextFrame()
+{
+	frameNumber.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long FrameArena::GetHeapAllocationCount()
+{
+	return heapAllocations.load(std::memory_order_relaxed);
+}
+
+// Counting replacements for the global allocation functions. The array,
+// nothrow and (from C++17) over-aligned forms are replaced too so no
+// operator new bypasses the count; direct malloc() calls still do.
+
+static void *countedAlloc(size_t size)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0)
+		size = 1;
+	for (;;)
+	{
+		void *p = std::malloc(size);
+		if (p)
+			return p;
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void *operator new(size_t size)
+{
+	return countedAlloc(size);
+}
+
+void *operator new[](size_t size)
+{
+	return countedAlloc(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return countedAlloc(size);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return countedAlloc(size);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+// Types aligned beyond the default go through these. aligned_alloc() wants
+// a size that is a multiple of the alignment; MSVC has no aligned_alloc()
+// and needs its own free for the result.
+static void *countedAlignedAlloc(size_t size, std::align_val_t alignment)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	size_t align = static_cast<size_t>(alignment);
+	size = size == 0 ? align : (size + align - 1) / align * align;
+	for (;;)
+	{
+#ifdef _WIN32
+		void *p = _aligned_malloc(size, align);
+#else
+		void *p = std::aligned_alloc(align, size);
+#endif
+		if (p)
+			return p;
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void alignedFree(void *p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+	return countedAlignedAlloc(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+	return countedAlignedAlloc(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return countedAlignedAlloc(size, alignment);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return countedAlignedAlloc(size, alignment);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	alignedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+	alignedFree(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+	alignedFree(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+	alignedFree(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	alignedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	alignedFree(p);
+}
+#endif
@@ -0,0 +1,223 @@
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "Vectors.h"
+#include "WaterSim.h"
+#include "ReplayLog.h"
+#include "GallerySession.h"
+
+namespace
+{
+	const float moveSpeed = 4.6f;
+	const float gravityAccel = 28.0f;
+	const float groundPauseDuration = 1.6f;
+
+	const float maxAzimuth = 70.0f;
+	const float minElevation = 10.0f;
+	const float maxElevation = 55.0f;
+	const float minRadius = 20.0f;
+	const float maxRadius = 46.0f;
+	const float cameraConvergeEpsilon = 0.001f;
+}
+
+const float GallerySession::waveAmplitude = 0.65f;
+const float GallerySession::waveSpeed = 1.3f;
+const float GallerySession::primaryWaveFrequency = 2.0f * static_cast<float>(M_PI);
+const float GallerySession::secondaryWaveFrequency = 1.1f * static_cast<float>(M_PI);
+
+GallerySession::GallerySession()
+{
+	waterState = WaterState::Wavy;
+	objectState = ObjectState::Duck;
+	cameraState = CameraState::Front;
+	movementPhase = MovementPhase::MoveAcross;
+	paused = false;
+
+	wavePhase = 0.0f;
+	objectPosX = pathLeftX;
+	objectPosY = waterSurfaceY + objectFloatOffset;
+	objectPosZ = pathZ;
+	verticalVelocity = 0.0f;
+	groundPauseTimer = 0.0f;
+
+	cameraAzimuth = 0.0f;
+	cameraElevation = 18.0f;
+	cameraRadius = 34.0f;
+	cameraTargetRadius = 34.0f;
+
+	ripples = NULL;
+}
+
+unsigned int GallerySession::Update(float dt)
+{
+	const float twoPi = 2.0f * static_cast<float>(M_PI);
+	// flat water ignores the phase, so keep it frozen while flat
+	if (waterState == WaterState::Wavy)
+	{
+		wavePhase += dt * waveSpeed;
+		if (wavePhase > twoPi)
+			wavePhase = std::fmod(wavePhase, twoPi);
+	}
+
+	float smoothing = std::min(1.0f, dt * 5.0f);
+	cameraRadius += (cameraTargetRadius - cameraRadius) * smoothing;
+	if (std::fabs(cameraTargetRadius - cameraRadius) <= cameraConvergeEpsilon)
+		cameraRadius = cameraTargetRadius;
+
+	if (paused)
+		return 0;
+
+	unsigned int events = 0;
+	switch (movementPhase)
+	{
+	case MovementPhase::MoveAcross:
+		objectPosX += moveSpeed * dt;
+		if (objectPosX >= pathRightX)
+		{
+			objectPosX = pathRightX;
+			movementPhase = MovementPhase::Falling;
+			verticalVelocity = 0.0f;
+			events |= SplashEvent;
+		}
+		objectPosY = GetWaterHeight(objectPosX, pathZ) + objectFloatOffset;
+		break;
+	case MovementPhase::Falling:
+		verticalVelocity += gravityAccel * dt;
+		objectPosY -= verticalVelocity * dt;
+		if (objectPosY <= objectGroundRestY)
+		{
+			objectPosY = objectGroundRestY;
+			movementPhase = MovementPhase::GroundPause;
+			groundPauseTimer = 0.0f;
+			events |= LandingEvent;
+		}
+		break;
+	case MovementPhase::GroundPause:
+		groundPauseTimer += dt;
+		if (groundPauseTimer >= groundPauseDuration)
+			ResetTarget();
+		break;
+	}
+	return events;
+}
+
+void GallerySession::ToggleWater()
+{
+	waterState = (waterState == WaterState::Wavy) ? WaterState::Flat : WaterState::Wavy;
+	if (movementPhase == MovementPhase::MoveAcross)
+		objectPosY = GetWaterHeight(objectPosX, pathZ) + objectFloatOffset;
+}
+
+void GallerySession::ToggleObject()
+{
+	objectState = (objectState == ObjectState::Duck) ? ObjectState::TargetOnly : ObjectState::Duck;
+}
+
+void GallerySession::ToggleCamera()
+{
+	cameraState = (cameraState == CameraState::Front) ? CameraState::Perspective : CameraState::Front;
+	if (cameraState == CameraState::Front)
+	{
+		cameraAzimuth = 0.0f;
+		cameraElevation = 18.0f;
+		cameraRadius = cameraTargetRadius = 34.0f;
+	}
+	else
+	{
+		cameraAzimuth = -32.0f;
+		cameraElevation = 24.0f;
+		cameraRadius = cameraTargetRadius = 36.0f;
+	}
+}
+
+void GallerySession::ResetTarget()
+{
+	movementPhase = MovementPhase::MoveAcross;
+	objectPosX = pathLeftX;
+	objectPosZ = pathZ;
+	verticalVelocity = 0.0f;
+	groundPauseTimer = 0.0f;
+	objectPosY = GetWaterHeight(objectPosX, pathZ) + objectFloatOffset;
+}
+
+void GallerySession::Orbit(float azimuthDelta, float elevationDelta)
+{
+	cameraAzimuth = std::max(-maxAzimuth, std::min(maxAzimuth, cameraAzimuth + azimuthDelta));
+	cameraElevation = std::max(minElevation, std::min(maxElevation, cameraElevation + elevationDelta));
+}
+
+void GallerySession::Zoom(float radiusDelta)
+{
+	cameraTargetRadius = std::max(minRadius, std::min(maxRadius, cameraTargetRadius + radiusDelta));
+}
+
+float GallerySession::GetWaterHeight(float x, float z) const
+{
+	float height = waterSurfaceY;
+	if (waterState == WaterState::Wavy)
+	{
+		float xRatio = (x - waterLeftX) / (waterRightX - waterLeftX);
+		float zRatio = (z - waterBackZ) / (waterFrontZ - waterBackZ);
+		float primary = std::sin(primaryWaveFrequency * xRatio + wavePhase);
+		float secondary = std::sin(secondaryWaveFrequency * zRatio + wavePhase * 0.6f);
+		height += waveAmplitude * (0.7f * primary + 0.3f * secondary);
+	}
+	if (ripples)
+		height += ripples->SampleHeight(x, z);
+	return height;
+}
+
+Vector3 GallerySession::GetWaterNormal(float x, float z) const
+{
+	if (waterState == WaterState::Flat && (!ripples || ripples->IsAtRest()))
+		return Vector3(0.0f, 1.0f, 0.0f);
+
+	const float eps = 0.1f;
+	float hL = GetWaterHeight(x - eps, z);
+	float hR = GetWaterHeight(x + eps, z);
+	float hB = GetWaterHeight(x, z - eps);
+	float hF = GetWaterHeight(x, z + eps);
+
+	Vector3 tangentX(2.0f * eps, hR - hL, 0.0f);
+	Vector3 tangentZ(0.0f, hF - hB, 2.0f * eps);
+	Vector3 normal = tangentZ.cross(tangentX);
+	normal.normalize();
+	return normal;
+}
+
+Vector3 GallerySession::GetCameraEye() const
+{
+	const float degToRad = static_cast<float>(M_PI) / 180.0f;
+	float azRad = cameraAzimuth * degToRad;
+	float elRad = cameraElevation * degToRad;
+	float cosEl = std::cos(elRad);
+	return Vector3(cameraRadius * std::sin(azRad) * cosEl,
+		cameraRadius * std::sin(elRad),
+		cameraRadius * std::cos(azRad) * cosEl);
+}
+
+bool GallerySession::IsAnimating() const
+{
+	if (std::fabs(cameraTargetRadius - cameraRadius) > cameraConvergeEpsilon)
+		return true;
+	if (waterState == WaterState::Wavy)
+		return true;
+	return !paused;
+}
+
+unsigned long long GallerySession::Hash(unsigned long long seed) const
+{
+	const float values[] =
+	{
+		wavePhase, objectPosX, objectPosY, objectPosZ, verticalVelocity, groundPauseTimer,
+		cameraAzimuth, cameraElevation, cameraRadius, cameraTargetRadius
+	};
+	const int states[] =
+	{
+		(int)waterState, (int)objectState, (int)cameraState, (int)movementPhase, paused ? 1 : 0
+	};
+	unsigned long long hash = ReplayLog::Hash(values, sizeof(values), seed);
+	return ReplayLog::Hash(states, sizeof(states), hash);
+}
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "FrameArena.h"
+#include "CommandBuffer.h"
+#include "GeometryArena.h"
+
+#define BUFFER_OFFSET(offset) ((void*)(offset))
+
+namespace
+{
+	const char *preludeDrawParameters =
+		"#version 150 compatibility\n"
+		"#extension GL_ARB_shader_draw_parameters : require\n"
+		"uniform samplerBuffer uDrawData;\n"
+		"vec4 getDrawData()\n"
+		"{\n"
+		"    return texelFetch(uDrawData, 2 * gl_DrawIDARB);\n"
+		"}\n"
+		"float getDrawViews()\n"
+		"{\n"
+		"    return texelFetch(uDrawData, 2 * gl_DrawIDARB + 1).x;\n"
+		"}\n";
+
+	// baseInstance carries the draw index into an instanced attribute; its
+	// divisor keeps it constant over the instances of one draw
+	const char *preludeBaseInstance =
+		"#version 150 compatibility\n"
+		"attribute float drawIndex;\n"
+		"uniform samplerBuffer uDrawData;\n"
+		"vec4 getDrawData()\n"
+		"{\n"
+		"    return texelFetch(uDrawData, 2 * int(drawIndex));\n"
+		"}\n"
+		"float getDrawViews()\n"
+		"{\n"
+		"    return texelFetch(uDrawData, 2 * int(drawIndex) + 1).x;\n"
+		"}\n";
+
+	const char *const attributeNames[GeometryArena::AttributeCount] = { "position", "normal", "drawIndex" };
+}
+
+void GeometryArena::DrawList::Add(const Mesh &mesh, GLuint firstIndex, GLsizei count, float x, float y, float z, float material, unsigned int views)
+{
+	views &= (1u << maxDrawViews) - 1;
+	GLuint instances = 0;
+	for (unsigned int bits = views; bits; bits &= bits - 1)
+		instances++;
+	if (instances == 0)
+		return;
+
+	IndirectCommand command;
+	command.count = count;
+	command.instanceCount = instances;
+	command.firstIndex = mesh.firstIndex + firstIndex;
+	command.baseVertex = mesh.baseVertex;
+	command.baseInstance = (GLuint)commands.size();
+	commands.push_back(command);
+
+	DrawData draw;
+	draw.x = x;
+	draw.y = y;
+	draw.z = z;
+	draw.material = material;
+	draw.views = (GLfloat)views;
+	draw.padding[0] = draw.padding[1] = draw.padding[2] = 0.0f;
+	data.push_back(draw);
+}
+
+void GeometryArena::DrawList::Clear()
+{
+	FrameVector<IndirectCommand>().swap(commands);
+	FrameVector<DrawData>().swap(data);
+}
+
+GeometryArena::GeometryArena(int vertexCapacity, int indexCapacity, int maxDraws)
+{
+	this->vertexCapacity = vertexCapacity;
+	this->indexCapacity = indexCapacity;
+	this->maxDraws = maxDraws;
+	vertexCount = 0;
+	indexCount = 0;
+	drawParameters = false;
+
+	vao = 0;
+	vertexBuffer = 0;
+	indexBuffer = 0;
+	drawIndexBuffer = 0;
+	indirectBuffer = 0;
+	drawDataBuffer = 0;
+	drawDataTexture = 0;
+}
+
+GeometryArena::~GeometryArena()
+{
+	FreeMemory();
+}
+
+bool GeometryArena::Init()
+{
+	if (!(GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect))
+		return false;
+	if (!(GLEW_VERSION_3_1 || GLEW_ARB_texture_buffer_object))
+		return false;
+	drawParameters = GLEW_ARB_shader_draw_parameters != 0;
+	if (!drawParameters && !(GLEW_VERSION_4_2 || GLEW_ARB_base_instance))
+		return false;
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vertexBuffer);
+	glGenBuffers(1, &indexBuffer);
+	glGenBuffers(1, &drawIndexBuffer);
+	glGenBuffers(1, &indirectBuffer);
+	glGenBuffers(1, &drawDataBuffer);
+	glGenTextures(1, &drawDataTexture);
+
+	std::vector<GLfloat> drawIndices(maxDraws);
+	for (int i = 0; i < maxDraws; ++i)
+		drawIndices[i] = (GLfloat)i;
+
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)vertexCapacity * sizeof(GeometryArenaVertex), NULL, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(AttribPosition);
+	glVertexAttribPointer(AttribPosition, 3, GL_FLOAT, GL_FALSE, sizeof(GeometryArenaVertex), BUFFER_OFFSET(offsetof(GeometryArenaVertex, position)));
+	glEnableVertexAttribArray(AttribNormal);
+	glVertexAttribPointer(AttribNormal, 3, GL_FLOAT, GL_FALSE, sizeof(GeometryArenaVertex), BUFFER_OFFSET(offsetof(GeometryArenaVertex, normal)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, drawIndices.size() * sizeof(GLfloat), &drawIndices[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(AttribDrawIndex);
+	glVertexAttribPointer(AttribDrawIndex, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(AttribDrawIndex, maxDrawViews);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, drawDataBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, (size_t)maxDraws * sizeof(DrawData), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawDataBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, (size_t)maxDraws * sizeof(IndirectCommand), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+void GeometryArena::FreeMemory()
+{
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	GLuint buffers[] = { vertexBuffer, indexBuffer, drawIndexBuffer, indirectBuffer, drawDataBuffer };
+	for (int i = 0; i < 5; ++i)
+	{
+		if (buffers[i])
+			glDeleteBuffers(1, &buffers[i]);
+	}
+	if (drawDataTexture)
+		glDeleteTextures(1, &drawDataTexture);
+
+	vao = 0;
+	vertexBuffer = 0;
+	indexBuffer = 0;
+	drawIndexBuffer = 0;
+	indirectBuffer = 0;
+	drawDataBuffer = 0;
+	drawDataTexture = 0;
+	vertexCount = 0;
+	indexCount = 0;
+}
+
+bool GeometryArena::Allocate(const GeometryArenaVertex *vertices, int meshVertexCount, const unsigned int *indices, int meshIndexCount, Mesh &mesh)
+{
+	if (!vao || vertexCount + meshVertexCount > vertexCapacity || indexCount + meshIndexCount > indexCapacity)
+		return false;
+
+	// copy-write binding keeps the upload out of any VAO's state
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (size_t)vertexCount * sizeof(GeometryArenaVertex), (size_t)meshVertexCount * sizeof(GeometryArenaVertex), vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (size_t)indexCount * sizeof(unsigned int), (size_t)meshIndexCount * sizeof(unsigned int), indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	mesh.baseVertex = vertexCount;
+	mesh.firstIndex = indexCount;
+	mesh.indexCount = meshIndexCount;
+	vertexCount += meshVertexCount;
+	indexCount += meshIndexCount;
+	return true;
+}
+
+const char *GeometryArena::GetShaderPrelude() const
+{
+	return drawParameters ? preludeDrawParameters : preludeBaseInstance;
+}
+
+const char *const *GeometryArena::GetAttributeNames()
+{
+	return attributeNames;
+}
+
+void GeometryArena::SetupProgram(GLuint program) const
+{
+	if (!program)
+		return;
+
+	GLint previous = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "uDrawData"), drawDataUnit);
+	glUseProgram(previous);
+}
+
+void GeometryArena::Record(CommandBuffer &commands, const DrawList &list) const
+{
+	GLsizei drawCount = (GLsizei)std::min((int)list.commands.size(), maxDraws);
+	if (!vao || drawCount == 0)
+		return;
+
+	commands.BindBuffer(GL_TEXTURE_BUFFER, drawDataBuffer);
+	commands.BufferData(GL_TEXTURE_BUFFER, &list.data[0], drawCount * sizeof(DrawData));
+	commands.BindBuffer(GL_TEXTURE_BUFFER, 0);
+	commands.BindTexture(GL_TEXTURE0 + drawDataUnit, GL_TEXTURE_BUFFER, drawDataTexture);
+
+	GLsizei indexTotal = 0;
+	for (GLsizei i = 0; i < drawCount; ++i)
+		indexTotal += list.commands[i].count * list.commands[i].instanceCount;
+
+	commands.BindVertexArray(vao);
+	commands.BindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	commands.BufferData(GL_DRAW_INDIRECT_BUFFER, &list.commands[0], drawCount * sizeof(IndirectCommand));
+	commands.MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, drawCount, sizeof(IndirectCommand), indexTotal);
+	commands.BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	commands.BindVertexArray(0);
+
+	commands.BindTexture(GL_TEXTURE0 + drawDataUnit, GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,254 @@
+#include <string>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Vectors.h"
+#include "MultiView.h"
+#include "PerfCounters.h"
+
+namespace
+{
+	// the loop bound is MultiView::maxViews
+	const char *broadcastSrc =
+		"uniform mat4 uViewProjection[4];\n"
+		"uniform vec3 uViewerDirection[4];\n"
+		"int currentView;\n"
+		"void selectView()\n"
+		"{\n"
+		"    int views = int(getDrawViews());\n"
+		"    int n = gl_InstanceID;\n"
+		"    currentView = 0;\n"
+		"    for (int v = 0; v < 4; ++v)\n"
+		"    {\n"
+		"        if ((views & (1 << v)) != 0 && n-- == 0)\n"
+		"        {\n"
+		"            currentView = v;\n"
+		"            break;\n"
+		"        }\n"
+		"    }\n"
+		"    gl_ViewportIndex = currentView;\n"
+		"}\n"
+		"vec4 viewPosition(vec4 worldPos)\n"
+		"{\n"
+		"    return uViewProjection[currentView] * worldPos;\n"
+		"}\n"
+		"vec3 viewerDirection()\n"
+		"{\n"
+		"    return uViewerDirection[currentView];\n"
+		"}\n";
+
+	const char *singleViewSrc =
+		"void selectView()\n"
+		"{\n"
+		"}\n"
+		"vec4 viewPosition(vec4 worldPos)\n"
+		"{\n"
+		"    return gl_ModelViewProjectionMatrix * worldPos;\n"
+		"}\n"
+		"vec3 viewerDirection()\n"
+		"{\n"
+		"    return vec3(0.0, 0.0, 1.0);\n"
+		"}\n";
+
+	// column-major, as GL stores them
+	void MultiplyMatrices(const GLfloat *a, const GLfloat *b, GLfloat *out)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			for (int r = 0; r < 4; ++r)
+			{
+				out[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+			}
+		}
+	}
+}
+
+MultiView::MultiView()
+{
+	viewCount = 1;
+	for (int i = 0; i < 4; ++i)
+		frame[i] = 0;
+
+	for (int v = 0; v < maxViews; ++v)
+	{
+		SetRect(v, 0.0f, 0.0f, 1.0f, 1.0f);
+		for (int i = 0; i < 16; ++i)
+		{
+			GLfloat identity = (i % 5 == 0) ? 1.0f : 0.0f;
+			views[v].projection[i] = identity;
+			views[v].modelView[i] = identity;
+			views[v].viewProjection[i] = identity;
+		}
+		for (int i = 0; i < 4; ++i)
+			views[v].viewport[i] = 0;
+		ExtractPlanes(views[v]);
+	}
+}
+
+bool MultiView::IsBroadcastSupported()
+{
+	return GLEW_ARB_viewport_array && (GLEW_ARB_shader_viewport_layer_array || GLEW_AMD_vertex_shader_viewport_index);
+}
+
+std::string MultiView::GetBroadcastPrelude(const std::string &arenaPrelude)
+{
+	// extension directives have to come before any declaration
+	size_t versionEnd = arenaPrelude.find('\n') + 1;
+	const char *extension = GLEW_ARB_shader_viewport_layer_array ?
+		"#extension GL_ARB_shader_viewport_layer_array : require\n" :
+		"#extension GL_AMD_vertex_shader_viewport_index : require\n";
+	return arenaPrelude.substr(0, versionEnd) + extension + arenaPrelude.substr(versionEnd) + broadcastSrc;
+}
+
+const char *MultiView::GetSingleViewSource()
+{
+	return singleViewSrc;
+}
+
+void MultiView::SetViewCount(int count)
+{
+	viewCount = count < 1 ? 1 : (count > maxViews ? maxViews : count);
+}
+
+void MultiView::SetRect(int view, float x, float y, float width, float height)
+{
+	if (view < 0 || view >= maxViews)
+		return;
+
+	views[view].rect[0] = x;
+	views[view].rect[1] = y;
+	views[view].rect[2] = width;
+	views[view].rect[3] = height;
+}
+
+void MultiView::BeginFrame()
+{
+	glGetIntegerv(GL_VIEWPORT, frame);
+	for (int v = 0; v < viewCount; ++v)
+	{
+		View &view = views[v];
+		GLint x0 = frame[0] + (GLint)(view.rect[0] * frame[2] + 0.5f);
+		GLint y0 = frame[1] + (GLint)(view.rect[1] * frame[3] + 0.5f);
+		GLint x1 = frame[0] + (GLint)((view.rect[0] + view.rect[2]) * frame[2] + 0.5f);
+		GLint y1 = frame[1] + (GLint)((view.rect[1] + view.rect[3]) * frame[3] + 0.5f);
+		view.viewport[0] = x0;
+		view.viewport[1] = y0;
+		view.viewport[2] = x1 > x0 ? x1 - x0 : 1;
+		view.viewport[3] = y1 > y0 ? y1 - y0 : 1;
+	}
+}
+
+void MultiView::CaptureCamera(int view)
+{
+	if (view < 0 || view >= viewCount)
+		return;
+
+	View &target = views[view];
+	glGetFloatv(GL_PROJECTION_MATRIX, target.projection);
+	glGetFloatv(GL_MODELVIEW_MATRIX, target.modelView);
+	MultiplyMatrices(target.projection, target.modelView, target.viewProjection);
+	ExtractPlanes(target);
+}
+
+float MultiView::GetAspect(int view) const
+{
+	if (view < 0 || view >= viewCount || views[view].viewport[3] == 0)
+		return 1.0f;
+	return (float)views[view].viewport[2] / (float)views[view].viewport[3];
+}
+
+// Gribb/Hartmann: each clip plane is the last row of the matrix plus or
+// minus one of the others
+void MultiView::ExtractPlanes(View &view)
+{
+	const GLfloat *m = view.viewProjection;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (int side = 0; side < 2; ++side)
+		{
+			GLfloat sign = side == 0 ? 1.0f : -1.0f;
+			GLfloat *plane = view.planes[axis * 2 + side];
+			for (int i = 0; i < 4; ++i)
+				plane[i] = m[i * 4 + 3] + sign * m[i * 4 + axis];
+		}
+	}
+}
+
+unsigned int MultiView::CullBox(const Vector3 &boxMin, const Vector3 &boxMax) const
+{
+	unsigned int mask = 0;
+	for (int v = 0; v < viewCount; ++v)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; ++p)
+		{
+			// the corner furthest along the plane normal
+			const GLfloat *plane = views[v].planes[p];
+			float x = plane[0] >= 0.0f ? boxMax.x : boxMin.x;
+			float y = plane[1] >= 0.0f ? boxMax.y : boxMin.y;
+			float z = plane[2] >= 0.0f ? boxMax.z : boxMin.z;
+			inside = plane[0] * x + plane[1] * y + plane[2] * z + plane[3] >= 0.0f;
+		}
+		if (inside)
+			mask |= 1u << v;
+	}
+	return mask;
+}
+
+void MultiView::BeginView(int view) const
+{
+	const View &source = views[view];
+	glViewport(source.viewport[0], source.viewport[1], source.viewport[2], source.viewport[3]);
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(source.projection);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(source.modelView);
+}
+
+void MultiView::BeginBroadcast() const
+{
+	BeginView(0);
+	for (int v = 1; v < viewCount; ++v)
+	{
+		const GLint *viewport = views[v].viewport;
+		glViewportIndexedf(v, (GLfloat)viewport[0], (GLfloat)viewport[1], (GLfloat)viewport[2], (GLfloat)viewport[3]);
+	}
+}
+
+void MultiView::EndViews() const
+{
+	// glViewport resets every indexed viewport as well
+	glViewport(frame[0], frame[1], frame[2], frame[3]);
+}
+
+void MultiView::SetUniforms(GLuint program) const
+{
+	if (!program)
+		return;
+
+	GLfloat viewProjection[maxViews * 16];
+	GLfloat viewerDirection[maxViews * 3];
+	const GLfloat *main = views[0].modelView;
+	for (int v = 0; v < maxViews; ++v)
+	{
+		const View &view = views[v < viewCount ? v : 0];
+		for (int i = 0; i < 16; ++i)
+			viewProjection[v * 16 + i] = view.viewProjection[i];
+
+		// the view's backward axis in world space, then in the first view's
+		// eye space, where the lights are
+		const GLfloat *m = view.modelView;
+		GLfloat bx = m[2], by = m[6], bz = m[10];
+		for (int i = 0; i < 3; ++i)
+			viewerDirection[v * 3 + i] = main[i] * bx + main[4 + i] * by + main[8 + i] * bz;
+	}
+
+	GLint previous = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+	glUseProgram(program);
+	glUniformMatrix4fv(glGetUniformLocation(program, "uViewProjection"), maxViews, GL_FALSE, viewProjection);
+	glUniform3fv(glGetUniformLocation(program, "uViewerDirection"), maxViews, viewerDirection);
+	glUseProgram(previous);
+	PerfCounters::Add(PerfCounters::ProgramBinds, 2);
+}
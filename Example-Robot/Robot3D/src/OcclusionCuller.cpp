@@ -0,0 +1,192 @@
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Vectors.h"
+#include "OcclusionCuller.h"
+#include "PerfCounters.h"
+
+OcclusionCuller::OcclusionCuller()
+{
+	boxVbo = 0;
+	boxIbo = 0;
+	queryTarget = GL_SAMPLES_PASSED;
+	enabled = true;
+	inQueries = false;
+	queriesIssued = 0;
+	culledCount = 0;
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+	FreeMemory();
+}
+
+bool OcclusionCuller::Init()
+{
+	// unit cube, drawn scaled to each box
+	static const GLfloat corners[8 * 3] =
+	{
+		0, 0, 0,  1, 0, 0,  1, 1, 0,  0, 1, 0,
+		0, 0, 1,  1, 0, 1,  1, 1, 1,  0, 1, 1
+	};
+	static const GLubyte faces[36] =
+	{
+		0, 2, 1,  0, 3, 2,
+		4, 5, 6,  4, 6, 7,
+		0, 1, 5,  0, 5, 4,
+		3, 6, 2,  3, 7, 6,
+		0, 4, 7,  0, 7, 3,
+		1, 2, 6,  1, 6, 5
+	};
+
+	// any-samples is enough and lets the implementation stop early
+	queryTarget = (GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2) ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+
+	glGenBuffers(1, &boxVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, boxVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &boxIbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxIbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	return boxVbo != 0 && boxIbo != 0;
+}
+
+void OcclusionCuller::FreeMemory()
+{
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].query)
+			glDeleteQueries(1, &entries[i].query);
+	}
+	entries.clear();
+
+	if (boxVbo)
+		glDeleteBuffers(1, &boxVbo);
+	if (boxIbo)
+		glDeleteBuffers(1, &boxIbo);
+	boxVbo = boxIbo = 0;
+}
+
+int OcclusionCuller::Register()
+{
+	Entry entry;
+	entry.query = 0;
+	entry.pending = false;
+	entry.visible = true;
+	glGenQueries(1, &entry.query);
+	entries.push_back(entry);
+	return (int)entries.size() - 1;
+}
+
+void OcclusionCuller::BeginQueries(const Vector3 &eye)
+{
+	if (!IsEnabled())
+		return;
+
+	this->eye = eye;
+	inQueries = true;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glUseProgram(0);
+	PerfCounters::Add(PerfCounters::ProgramBinds);
+
+	glBindBuffer(GL_ARRAY_BUFFER, boxVbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxIbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, 0);
+}
+
+void OcclusionCuller::DrawBox(const Vector3 &boxMin, const Vector3 &boxMax)
+{
+	glPushMatrix();
+	glTranslatef(boxMin.x, boxMin.y, boxMin.z);
+	glScalef(boxMax.x - boxMin.x, boxMax.y - boxMin.y, boxMax.z - boxMin.z);
+	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+	PerfCounters::CountDraws(1, 36, false);
+	glPopMatrix();
+}
+
+void OcclusionCuller::Query(int id, const Vector3 &boxMin, const Vector3 &boxMax)
+{
+	if (!inQueries || id < 0 || id >= (int)entries.size())
+		return;
+
+	Entry &entry = entries[id];
+
+	if (entry.pending)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(entry.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return; // keep the previous answer rather than stall
+
+		GLuint samples = 0;
+		glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT, &samples);
+		entry.visible = samples != 0;
+		entry.pending = false;
+	}
+
+	// a box around the eye may be clipped away by the near plane
+	const float margin = 0.5f;
+	if (eye.x > boxMin.x - margin && eye.x < boxMax.x + margin &&
+		eye.y > boxMin.y - margin && eye.y < boxMax.y + margin &&
+		eye.z > boxMin.z - margin && eye.z < boxMax.z + margin)
+	{
+		entry.visible = true;
+		return;
+	}
+
+	glBeginQuery(queryTarget, entry.query);
+	DrawBox(boxMin, boxMax);
+	glEndQuery(queryTarget);
+	entry.pending = true;
+	queriesIssued++;
+}
+
+void OcclusionCuller::EndQueries()
+{
+	if (!inQueries)
+		return;
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glPopAttrib();
+	inQueries = false;
+}
+
+void OcclusionCuller::SetEnabled(bool enabled)
+{
+	if (enabled && !this->enabled)
+	{
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			entries[i].visible = true;
+		}
+	}
+	this->enabled = enabled;
+}
+
+bool OcclusionCuller::IsVisible(int id)
+{
+	if (!IsEnabled() || id < 0 || id >= (int)entries.size())
+		return true;
+
+	if (!entries[id].visible)
+	{
+		culledCount++;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,232 @@
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLES_USE_SSE 1
+#endif
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Vectors.h"
+#include "PerfCounters.h"
+#include "WorkerPool.h"
+#include "ParticleSystem.h"
+
+#define BUFFER_OFFSET(offset) ((void*)(offset))
+
+// below this many particles threading costs more than it saves
+static const int parallelThreshold = 16384;
+
+ParticleSystem::ParticleSystem(int capacity)
+{
+	// whole SSE lanes per array keeps every array 16-byte aligned
+	this->capacity = ((capacity < 4 ? 4 : capacity) + 3) & ~3;
+	count = 0;
+
+	block = new float[(size_t)this->capacity * AttributeCount + 4];
+	float *aligned = (float *)(((uintptr_t)block + 15) & ~(uintptr_t)15);
+	for (int a = 0; a < AttributeCount; ++a)
+	{
+		arrays[a] = aligned + (size_t)a * this->capacity;
+	}
+
+	rngState = 0x9e3779b9u;
+	gravity = 9.8f;
+	floorY = 0.0f;
+	pool = NULL;
+	stepDt = 0.0f;
+
+	vao = 0;
+	quadVbo = 0;
+	instanceVbo = 0;
+}
+
+ParticleSystem::~ParticleSystem()
+{
+	FreeGL();
+	delete [] block;
+}
+
+// xorshift32, deterministic so recorded sessions replay identically
+float ParticleSystem::Random()
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return (rngState >> 8) * (1.0f / 16777216.0f);
+}
+
+int ParticleSystem::Emit(const Vector3 &origin, const Vector3 &baseVelocity, float spread, int emitCount, float lifetime, float kind)
+{
+	if (emitCount > capacity - count)
+		emitCount = capacity - count;
+
+	for (int n = 0; n < emitCount; ++n)
+	{
+		int i = count + n;
+		arrays[PosX][i] = origin.x;
+		arrays[PosY][i] = origin.y;
+		arrays[PosZ][i] = origin.z;
+		arrays[VelX][i] = baseVelocity.x + spread * (2.0f * Random() - 1.0f);
+		arrays[VelY][i] = baseVelocity.y + spread * (2.0f * Random() - 1.0f);
+		arrays[VelZ][i] = baseVelocity.z + spread * (2.0f * Random() - 1.0f);
+		arrays[Life][i] = lifetime * (0.6f + 0.4f * Random());
+		arrays[Kind][i] = kind;
+	}
+	count += emitCount;
+	return emitCount;
+}
+
+void ParticleSystem::Integrate(int begin, int end)
+{
+	float *px = arrays[PosX];
+	float *py = arrays[PosY];
+	float *pz = arrays[PosZ];
+	float *vx = arrays[VelX];
+	float *vy = arrays[VelY];
+	float *vz = arrays[VelZ];
+	float *life = arrays[Life];
+	const float dt = stepDt;
+	const float dv = gravity * stepDt;
+	int i = begin;
+
+#ifdef PARTICLES_USE_SSE
+	const __m128 vDt = _mm_set1_ps(dt);
+	const __m128 vDv = _mm_set1_ps(dv);
+	const __m128 vFloor = _mm_set1_ps(floorY);
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 velY = _mm_sub_ps(_mm_loadu_ps(vy + i), vDv);
+		_mm_storeu_ps(vy + i, velY);
+
+		_mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(_mm_loadu_ps(vx + i), vDt)));
+		__m128 posY = _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(velY, vDt));
+		_mm_storeu_ps(py + i, posY);
+		_mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(_mm_loadu_ps(vz + i), vDt)));
+
+		// below the floor -> life 0
+		__m128 remaining = _mm_sub_ps(_mm_loadu_ps(life + i), vDt);
+		remaining = _mm_and_ps(remaining, _mm_cmpge_ps(posY, vFloor));
+		_mm_storeu_ps(life + i, remaining);
+	}
+#endif
+
+	for (; i < end; ++i)
+	{
+		vy[i] -= dv;
+		px[i] += vx[i] * dt;
+		py[i] += vy[i] * dt;
+		pz[i] += vz[i] * dt;
+		life[i] = py[i] >= floorY ? life[i] - dt : 0.0f;
+	}
+}
+
+void ParticleSystem::IntegrateTask(void *context, int begin, int end, int worker)
+{
+	static_cast<ParticleSystem *>(context)->Integrate(begin, end);
+}
+
+void ParticleSystem::Compact()
+{
+	float *life = arrays[Life];
+	int i = 0;
+	while (i < count)
+	{
+		if (life[i] > 0.0f)
+		{
+			i++;
+			continue;
+		}
+		// swap-remove: the last live particle fills the hole and is checked next
+		count--;
+		for (int a = 0; a < AttributeCount; ++a)
+		{
+			arrays[a][i] = arrays[a][count];
+		}
+	}
+}
+
+void ParticleSystem::Update(float dt)
+{
+	if (count == 0 || dt <= 0.0f)
+		return;
+
+	stepDt = dt;
+	if (pool && count >= parallelThreshold)
+		pool->ParallelFor(count, IntegrateTask, this);
+	else
+		Integrate(0, count);
+
+	Compact();
+}
+
+bool ParticleSystem::InitGL(GLint attribCorner, GLint attribInstance)
+{
+	static const GLfloat corners[] = { -1.0f, -1.0f,  1.0f, -1.0f,  -1.0f, 1.0f,  1.0f, 1.0f };
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &quadVbo);
+	glGenBuffers(1, &instanceVbo);
+	if (!vao || !quadVbo || !instanceVbo)
+		return false;
+
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, quadVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(attribCorner);
+	glVertexAttribPointer(attribCorner, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+	// one region per SoA array, so the arrays upload without interleaving
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)capacity * drawAttributes * sizeof(float), NULL, GL_STREAM_DRAW);
+	for (int a = 0; a < drawAttributes; ++a)
+	{
+		glEnableVertexAttribArray(attribInstance + a);
+		glVertexAttribPointer(attribInstance + a, 1, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET((size_t)a * capacity * sizeof(float)));
+		glVertexAttribDivisor(attribInstance + a, 1);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void ParticleSystem::Draw(GLuint program)
+{
+	if (!vao || count == 0)
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+	// orphan last frame's storage instead of waiting for it
+	glBufferData(GL_ARRAY_BUFFER, (size_t)capacity * drawAttributes * sizeof(float), NULL, GL_STREAM_DRAW);
+	for (int a = 0; a < drawAttributes; ++a)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, (size_t)a * capacity * sizeof(float), (size_t)count * sizeof(float), arrays[a]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	PerfCounters::Add(PerfCounters::UploadBytes, (unsigned long long)drawAttributes * count * sizeof(float));
+
+	glUseProgram(program);
+	glBindVertexArray(vao);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	PerfCounters::Add(PerfCounters::ProgramBinds, 2);
+	PerfCounters::CountDraws(1, 4ULL * count, false);
+}
+
+void ParticleSystem::FreeGL()
+{
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	if (quadVbo)
+		glDeleteBuffers(1, &quadVbo);
+	if (instanceVbo)
+		glDeleteBuffers(1, &instanceVbo);
+	vao = 0;
+	quadVbo = 0;
+	instanceVbo = 0;
+}
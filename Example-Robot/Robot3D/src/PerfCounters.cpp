@@ -0,0 +1,90 @@
+#include <cfloat>
+#include <cstdio>
+
+#include "PerfCounters.h"
+
+namespace
+{
+	// the 60 and 30 Hz budgets get their own edges
+	const float bucketLimits[PerfCounters::histogramBuckets] = { 4.0f, 8.0f, 12.0f, 16.7f, 25.0f, 33.4f, 50.0f, FLT_MAX };
+
+	const char *counterNames[PerfCounters::CounterCount] =
+	{
+		"draw calls",
+		"program binds",
+		"material changes",
+		"immediate vertices",
+		"buffer vertices",
+		"bytes uploaded"
+	};
+}
+
+unsigned long long PerfCounters::counts[PerfCounters::CounterCount];
+unsigned long long PerfCounters::lastFrame[PerfCounters::CounterCount];
+unsigned int PerfCounters::histogram[PerfCounters::histogramBuckets];
+float PerfCounters::simulationMs = 0.0f;
+float PerfCounters::lastFrameMs = 0.0f;
+float PerfCounters::lastSimulationMs = 0.0f;
+
+void PerfCounters::EndFrame(float frameMs)
+{
+	for (int i = 0; i < CounterCount; ++i)
+	{
+		lastFrame[i] = counts[i];
+		counts[i] = 0;
+	}
+	lastFrameMs = frameMs;
+	lastSimulationMs = simulationMs;
+	simulationMs = 0.0f;
+
+	int bucket = 0;
+	while (bucket < histogramBuckets - 1 && frameMs > bucketLimits[bucket])
+		bucket++;
+	histogram[bucket]++;
+}
+
+const char *PerfCounters::GetName(Counter counter)
+{
+	return counterNames[counter];
+}
+
+float PerfCounters::GetBucketLimit(int bucket)
+{
+	return bucketLimits[bucket];
+}
+
+void PerfCounters::ResetHistogram()
+{
+	for (int i = 0; i < histogramBuckets; ++i)
+		histogram[i] = 0;
+}
+
+int PerfCounters::Format(char *text, size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	int length = std::snprintf(text, size,
+		"frame %.2f ms, simulation %.2f ms\n"
+		"%llu draws, %llu program binds, %llu material changes\n"
+		"vertices: %llu immediate, %llu from buffers\n"
+		"uploaded %.1f KB\n"
+		"frame times (ms):",
+		lastFrameMs, lastSimulationMs,
+		lastFrame[DrawCalls], lastFrame[ProgramBinds], lastFrame[MaterialChanges],
+		lastFrame[ImmediateVertices], lastFrame[BufferVertices],
+		lastFrame[UploadBytes] / 1024.0);
+
+	unsigned int total = 0;
+	for (int i = 0; i < histogramBuckets; ++i)
+		total += histogram[i];
+	for (int i = 0; i < histogramBuckets && length >= 0 && (size_t)length < size; ++i)
+	{
+		float share = total ? 100.0f * histogram[i] / total : 0.0f;
+		if (i < histogramBuckets - 1)
+			length += std::snprintf(text + length, size - length, "%s<%g:%.0f%%", i % 4 == 0 ? "\n  " : "  ", bucketLimits[i], share);
+		else
+			length += std::snprintf(text + length, size - length, "  more:%.0f%%", share);
+	}
+	return length < 0 ? 0 : ((size_t)length < size ? length : (int)size - 1);
+}
@@ -0,0 +1,566 @@
+#include <cstdio>
+#include <string>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "ShaderUtil.h"
+#include "PerfCounters.h"
+#include "PostProcess.h"
+
+namespace
+{
+	const char *modeNames[PostProcess::ModeCount] =
+	{
+		"off",
+		"FXAA",
+		"SMAA-lite",
+		"MSAA"
+	};
+
+	// the passes draw a quad already in clip space
+	const char *vertexSrc =
+		"#version 120\n"
+		"void main()\n"
+		"{\n"
+		"    gl_Position = gl_Vertex;\n"
+		"}\n";
+
+	const char *fxaaSrc =
+		"#version 120\n"
+		"uniform sampler2D uColor;\n"
+		"uniform vec2 uTexel;\n"
+		"const vec3 lumaWeights = vec3(0.299, 0.587, 0.114);\n"
+		"const float spanMax = 4.0;\n"
+		"const float reduceMul = 1.0 / 8.0;\n"
+		"const float reduceMin = 1.0 / 128.0;\n"
+		"void main()\n"
+		"{\n"
+		"    vec2 uv = gl_FragCoord.xy * uTexel;\n"
+		"    vec3 rgbM = texture2D(uColor, uv).rgb;\n"
+		"    float lumaM = dot(rgbM, lumaWeights);\n"
+		"    float lumaNW = dot(texture2D(uColor, uv + vec2(-1.0, -1.0) * uTexel).rgb, lumaWeights);\n"
+		"    float lumaNE = dot(texture2D(uColor, uv + vec2(1.0, -1.0) * uTexel).rgb, lumaWeights);\n"
+		"    float lumaSW = dot(texture2D(uColor, uv + vec2(-1.0, 1.0) * uTexel).rgb, lumaWeights);\n"
+		"    float lumaSE = dot(texture2D(uColor, uv + vec2(1.0, 1.0) * uTexel).rgb, lumaWeights);\n"
+		"    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));\n"
+		"    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));\n"
+		// blur along the edge, which runs across the luma gradient
+		"    vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));\n"
+		"    float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * reduceMul, reduceMin);\n"
+		"    float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);\n"
+		"    dir = clamp(dir * rcpDirMin, -spanMax, spanMax) * uTexel;\n"
+		"    vec3 rgbA = 0.5 * (texture2D(uColor, uv + dir * (1.0 / 3.0 - 0.5)).rgb + texture2D(uColor, uv + dir * (2.0 / 3.0 - 0.5)).rgb);\n"
+		"    vec3 rgbB = rgbA * 0.5 + 0.25 * (texture2D(uColor, uv - dir * 0.5).rgb + texture2D(uColor, uv + dir * 0.5).rgb);\n"
+		// the wide tap strayed over another edge
+		"    float lumaB = dot(rgbB, lumaWeights);\n"
+		"    gl_FragColor = vec4((lumaB < lumaMin || lumaB > lumaMax) ? rgbA : rgbB, 1.0);\n"
+		"}\n";
+
+	// red marks an edge with the pixel to the left, green with the one below
+	const char *edgeSrc =
+		"#version 120\n"
+		"uniform sampler2D uColor;\n"
+		"uniform vec2 uTexel;\n"
+		"const float threshold = 0.1;\n"
+		"float luma(vec2 pixel)\n"
+		"{\n"
+		"    return dot(texture2D(uColor, (pixel + 0.5) * uTexel).rgb, vec3(0.299, 0.587, 0.114));\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"    vec2 pixel = floor(gl_FragCoord.xy);\n"
+		"    float center = luma(pixel);\n"
+		"    vec2 delta = abs(center - vec2(luma(pixel - vec2(1.0, 0.0)), luma(pixel - vec2(0.0, 1.0))));\n"
+		"    gl_FragColor = vec4(step(threshold, delta), 0.0, 0.0);\n"
+		"}\n";
+
+	// For each edge of the pixel, walk along it to both ends, look at the
+	// edges crossing it there and rebuild the silhouette as MLAA does: a
+	// line from half a pixel off the edge at an end with a step to the
+	// far end (L), between two opposite steps (Z), or to the middle from
+	// both ends when they step the same way (U). The part of the pixel on
+	// the far side of that line takes the colour from across the edge.
+	const char *blendSrc =
+		"uniform sampler2D uColor;\n"
+		"uniform sampler2D uEdges;\n"
+		"uniform vec2 uTexel;\n"
+		"float edgeFlag(vec2 pixel, vec2 mask)\n"
+		"{\n"
+		"    return dot(texture2D(uEdges, (pixel + 0.5) * uTexel).rg, mask);\n"
+		"}\n"
+		"float lineHeight(float t, float len, float reach, float backStep, float aheadStep)\n"
+		"{\n"
+		"    return 0.5 * backStep * max(0.0, 1.0 - t / reach) + 0.5 * aheadStep * max(0.0, 1.0 - (len - t) / reach);\n"
+		"}\n"
+		// integral of max(h, 0) over the pixel for h linear from h0 to h1
+		"float positiveArea(float h0, float h1)\n"
+		"{\n"
+		"    if (h0 >= 0.0 && h1 >= 0.0)\n"
+		"        return 0.5 * (h0 + h1);\n"
+		"    if (h0 <= 0.0 && h1 <= 0.0)\n"
+		"        return 0.0;\n"
+		"    float h = max(h0, h1);\n"
+		"    return 0.5 * h * h / abs(h1 - h0);\n"
+		"}\n"
+		// edgePixel stores the edge, other is the pixel across it, along
+		// is +x or +y; a step is +1 when it turns into this pixel's side
+		"float coverage(vec2 pixel, vec2 edgePixel, vec2 other, vec2 along, vec2 edgeMask, vec2 crossMask)\n"
+		"{\n"
+		"    float back = 0.0;\n"
+		"    for (int i = 1; i <= MAX_SEARCH; ++i)\n"
+		"    {\n"
+		"        if (edgeFlag(edgePixel - along * float(i), edgeMask) < 0.5)\n"
+		"            break;\n"
+		"        back += 1.0;\n"
+		"    }\n"
+		"    float ahead = 0.0;\n"
+		"    for (int i = 1; i <= MAX_SEARCH; ++i)\n"
+		"    {\n"
+		"        if (edgeFlag(edgePixel + along * float(i), edgeMask) < 0.5)\n"
+		"            break;\n"
+		"        ahead += 1.0;\n"
+		"    }\n"
+		"    float backStep = 0.0;\n"
+		"    if (back < float(MAX_SEARCH))\n"
+		"        backStep = edgeFlag(pixel - along * back, crossMask) - edgeFlag(other - along * back, crossMask);\n"
+		"    float aheadStep = 0.0;\n"
+		"    if (ahead < float(MAX_SEARCH))\n"
+		"        aheadStep = edgeFlag(pixel + along * (ahead + 1.0), crossMask) - edgeFlag(other + along * (ahead + 1.0), crossMask);\n"
+		"    float len = back + ahead + 1.0;\n"
+		"    float reach = (backStep != 0.0 && backStep == aheadStep) ? 0.5 * len : len;\n"
+		"    return positiveArea(lineHeight(back, len, reach, backStep, aheadStep), lineHeight(back + 1.0, len, reach, backStep, aheadStep));\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"    vec2 pixel = floor(gl_FragCoord.xy);\n"
+		"    vec2 dx = vec2(1.0, 0.0);\n"
+		"    vec2 dy = vec2(0.0, 1.0);\n"
+		"    vec4 color = texture2D(uColor, (pixel + 0.5) * uTexel);\n"
+		"    vec4 sum = vec4(0.0);\n"
+		"    float total = 0.0;\n"
+		"    float w;\n"
+		"    if (edgeFlag(pixel, dy) > 0.5)\n"
+		"    {\n"
+		"        w = coverage(pixel, pixel, pixel - dy, dx, dy, dx);\n"
+		"        sum += w * texture2D(uColor, (pixel - dy + 0.5) * uTexel);\n"
+		"        total += w;\n"
+		"    }\n"
+		"    if (edgeFlag(pixel + dy, dy) > 0.5)\n"
+		"    {\n"
+		"        w = coverage(pixel, pixel + dy, pixel + dy, dx, dy, dx);\n"
+		"        sum += w * texture2D(uColor, (pixel + dy + 0.5) * uTexel);\n"
+		"        total += w;\n"
+		"    }\n"
+		"    if (edgeFlag(pixel, dx) > 0.5)\n"
+		"    {\n"
+		"        w = coverage(pixel, pixel, pixel - dx, dy, dx, dy);\n"
+		"        sum += w * texture2D(uColor, (pixel - dx + 0.5) * uTexel);\n"
+		"        total += w;\n"
+		"    }\n"
+		"    if (edgeFlag(pixel + dx, dx) > 0.5)\n"
+		"    {\n"
+		"        w = coverage(pixel, pixel + dx, pixel + dx, dy, dx, dy);\n"
+		"        sum += w * texture2D(uColor, (pixel + dx + 0.5) * uTexel);\n"
+		"        total += w;\n"
+		"    }\n"
+		"    if (total > 1.0)\n"
+		"    {\n"
+		"        sum /= total;\n"
+		"        total = 1.0;\n"
+		"    }\n"
+		"    gl_FragColor = color * (1.0 - total) + sum;\n"
+		"}\n";
+
+	void setTextureParameters(GLint filter)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+}
+
+PostProcess::PostProcess()
+{
+	width = height = 0;
+	mode = Off;
+	samples = 0;
+
+	sceneFbo = sceneColor = sceneDepth = 0;
+	edgeFbo = edgeTexture = 0;
+	msaaFbo = msaaColor = msaaDepth = 0;
+	fxaaProgram = edgeProgram = blendProgram = 0;
+
+	for (int i = 0; i < queryFrames; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+			timestampQueries[i][j] = 0;
+		queryMode[i] = Off;
+		queryIssued[i] = false;
+	}
+	currentQuery = 0;
+	useTimerQueries = false;
+
+	for (int i = 0; i < ModeCount; ++i)
+	{
+		sceneMs[i] = 0.0f;
+		postMs[i] = 0.0f;
+	}
+}
+
+PostProcess::~PostProcess()
+{
+	FreeMemory();
+}
+
+bool PostProcess::Init(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+
+	useTimerQueries = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (useTimerQueries)
+		glGenQueries(queryFrames * 3, &timestampQueries[0][0]);
+
+	GLint maxFboSamples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxFboSamples);
+	samples = maxFboSamples < maxSamples ? maxFboSamples : maxSamples;
+
+	if (!CreateTargets())
+	{
+		FreeMemory();
+		return false;
+	}
+	BuildPrograms();
+	return true;
+}
+
+bool PostProcess::CreateTargets()
+{
+	if (width <= 0 || height <= 0)
+		return false;
+
+	if (!sceneFbo)
+	{
+		glGenFramebuffers(1, &sceneFbo);
+		glGenTextures(1, &sceneColor);
+		glGenRenderbuffers(1, &sceneDepth);
+		glGenFramebuffers(1, &edgeFbo);
+		glGenTextures(1, &edgeTexture);
+	}
+
+	// filtered, since FXAA reads between texels
+	glBindTexture(GL_TEXTURE_2D, sceneColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	setTextureParameters(GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, edgeTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	setTextureParameters(GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneColor, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepth);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, edgeFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, edgeTexture, 0);
+	complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (complete && msaaFbo && !CreateMsaaTarget())
+	{
+		if (mode == Msaa)
+			mode = Off;
+	}
+	return complete;
+}
+
+bool PostProcess::CreateMsaaTarget()
+{
+	if (samples < 2)
+		return false;
+
+	if (!msaaFbo)
+	{
+		glGenFramebuffers(1, &msaaFbo);
+		glGenRenderbuffers(1, &msaaColor);
+		glGenRenderbuffers(1, &msaaDepth);
+	}
+
+	glBindRenderbuffer(GL_RENDERBUFFER, msaaColor);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, msaaDepth);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, msaaFbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msaaColor);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, msaaDepth);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::fprintf(stderr, "Multisampled target incomplete, MSAA unavailable\n");
+		samples = 0;
+		return false;
+	}
+	return true;
+}
+
+void PostProcess::BuildPrograms()
+{
+	GLint location;
+
+	fxaaProgram = buildProgram(vertexSrc, fxaaSrc, NULL, 0);
+	edgeProgram = buildProgram(vertexSrc, edgeSrc, NULL, 0);
+	std::string blend = "#version 120\n#define MAX_SEARCH " + std::to_string(maxSearch) + "\n" + blendSrc;
+	blendProgram = buildProgram(vertexSrc, blend.c_str(), NULL, 0);
+
+	// the samplers never change
+	GLuint programs[] = { fxaaProgram, edgeProgram, blendProgram };
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!programs[i])
+			continue;
+		glUseProgram(programs[i]);
+		location = glGetUniformLocation(programs[i], "uColor");
+		if (location >= 0)
+			glUniform1i(location, 0);
+		location = glGetUniformLocation(programs[i], "uEdges");
+		if (location >= 0)
+			glUniform1i(location, 1);
+	}
+	glUseProgram(0);
+}
+
+void PostProcess::Resize(int width, int height)
+{
+	// minimising reshapes to 0x0, which no target can be created at
+	if (width <= 0 || height <= 0 || (width == this->width && height == this->height))
+		return;
+
+	this->width = width;
+	this->height = height;
+	if (sceneFbo && !CreateTargets())
+		FreeMemory();
+}
+
+void PostProcess::FreeMemory()
+{
+	GLuint framebuffers[] = { sceneFbo, edgeFbo, msaaFbo };
+	GLuint textures[] = { sceneColor, edgeTexture };
+	GLuint renderbuffers[] = { sceneDepth, msaaColor, msaaDepth };
+	glDeleteFramebuffers(3, framebuffers);
+	glDeleteTextures(2, textures);
+	glDeleteRenderbuffers(3, renderbuffers);
+	if (fxaaProgram)
+		glDeleteProgram(fxaaProgram);
+	if (edgeProgram)
+		glDeleteProgram(edgeProgram);
+	if (blendProgram)
+		glDeleteProgram(blendProgram);
+	if (timestampQueries[0][0])
+		glDeleteQueries(queryFrames * 3, &timestampQueries[0][0]);
+
+	sceneFbo = sceneColor = sceneDepth = 0;
+	edgeFbo = edgeTexture = 0;
+	msaaFbo = msaaColor = msaaDepth = 0;
+	fxaaProgram = edgeProgram = blendProgram = 0;
+	for (int i = 0; i < queryFrames; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+			timestampQueries[i][j] = 0;
+		queryIssued[i] = false;
+	}
+	useTimerQueries = false;
+	mode = Off;
+}
+
+bool PostProcess::IsSupported(Mode mode) const
+{
+	switch (mode)
+	{
+	case Off:
+		return true;
+	case Fxaa:
+		return sceneFbo && fxaaProgram;
+	case SmaaLite:
+		return sceneFbo && edgeProgram && blendProgram;
+	case Msaa:
+		return sceneFbo && samples >= 2;
+	default:
+		return false;
+	}
+}
+
+bool PostProcess::SetMode(Mode mode)
+{
+	if (!IsSupported(mode))
+		return false;
+	if (mode == Msaa && !msaaFbo && !CreateMsaaTarget())
+		return false;
+
+	this->mode = mode;
+	return true;
+}
+
+void PostProcess::CycleMode()
+{
+	for (int i = 1; i < ModeCount; ++i)
+	{
+		if (SetMode((Mode)((mode + i) % ModeCount)))
+			return;
+	}
+}
+
+const char *PostProcess::GetModeName(Mode mode)
+{
+	return modeNames[mode];
+}
+
+void PostProcess::BeginFrame()
+{
+	if (useTimerQueries)
+		glQueryCounter(timestampQueries[currentQuery][0], GL_TIMESTAMP);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, GetTarget());
+	glViewport(0, 0, width, height);
+}
+
+GLuint PostProcess::GetTarget() const
+{
+	switch (mode)
+	{
+	case Fxaa:
+	case SmaaLite:
+		return sceneFbo;
+	case Msaa:
+		return msaaFbo;
+	default:
+		return 0;
+	}
+}
+
+void PostProcess::EndFrame()
+{
+	if (useTimerQueries)
+		glQueryCounter(timestampQueries[currentQuery][1], GL_TIMESTAMP);
+
+	if (mode == Msaa)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, msaaFbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	else if (mode == Fxaa || mode == SmaaLite)
+	{
+		glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_LIGHTING);
+		glDisable(GL_BLEND);
+		glDisable(GL_CULL_FACE);
+		glViewport(0, 0, width, height);
+		if (mode == Fxaa)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			DrawPass(fxaaProgram, sceneColor, 0);
+		}
+		else
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, edgeFbo);
+			DrawPass(edgeProgram, sceneColor, 0);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			DrawPass(blendProgram, sceneColor, edgeTexture);
+		}
+		glPopAttrib();
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (useTimerQueries)
+	{
+		glQueryCounter(timestampQueries[currentQuery][2], GL_TIMESTAMP);
+		queryMode[currentQuery] = mode;
+		queryIssued[currentQuery] = true;
+		currentQuery = (currentQuery + 1) % queryFrames;
+		ReadTimestamps();
+	}
+}
+
+void PostProcess::DrawPass(GLuint program, GLuint colorTexture, GLuint edges)
+{
+	PerfCounters::Add(PerfCounters::ProgramBinds);
+	glUseProgram(program);
+	GLint texel = glGetUniformLocation(program, "uTexel");
+	if (texel >= 0)
+		glUniform2f(texel, 1.0f / width, 1.0f / height);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, edges);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+
+	PerfCounters::CountDraws(1, 4, true);
+	glBegin(GL_QUADS);
+	glVertex2f(-1.0f, -1.0f);
+	glVertex2f(1.0f, -1.0f);
+	glVertex2f(1.0f, 1.0f);
+	glVertex2f(-1.0f, 1.0f);
+	glEnd();
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+}
+
+// the oldest frame in the ring was issued a few frames ago; read it only if
+// its last timestamp has landed
+void PostProcess::ReadTimestamps()
+{
+	if (!queryIssued[currentQuery])
+		return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(timestampQueries[currentQuery][2], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	GLuint64 stamps[3];
+	for (int i = 0; i < 3; ++i)
+		glGetQueryObjectui64v(timestampQueries[currentQuery][i], GL_QUERY_RESULT, &stamps[i]);
+	queryIssued[currentQuery] = false;
+
+	Mode measured = queryMode[currentQuery];
+	float scene = (stamps[1] - stamps[0]) * 1.0e-6f;
+	float post = (stamps[2] - stamps[1]) * 1.0e-6f;
+	sceneMs[measured] = sceneMs[measured] <= 0.0f ? scene : sceneMs[measured] * 0.9f + scene * 0.1f;
+	postMs[measured] = postMs[measured] <= 0.0f ? post : postMs[measured] * 0.9f + post * 0.1f;
+}
+
+int PostProcess::Format(char *text, size_t size) const
+{
+	if (size == 0)
+		return 0;
+
+	int length;
+	if (mode == Msaa)
+		length = std::snprintf(text, size, "AA %s %dx", modeNames[mode], samples);
+	else
+		length = std::snprintf(text, size, "AA %s", modeNames[mode]);
+	if (!useTimerQueries && length >= 0 && (size_t)length < size)
+		length += std::snprintf(text + length, size - length, ", no GPU timers");
+
+	// scene + post GPU ms for every mode measured so far
+	for (int i = 0; i < ModeCount && useTimerQueries && length >= 0 && (size_t)length < size; ++i)
+	{
+		if (sceneMs[i] > 0.0f)
+			length += std::snprintf(text + length, size - length, "%s%s %.2f+%.2f ms", i == 0 ? "\n  " : "  ", modeNames[i], sceneMs[i], postMs[i]);
+		else
+			length += std::snprintf(text + length, size - length, "%s%s -", i == 0 ? "\n  " : "  ", modeNames[i]);
+	}
+	return length < 0 ? 0 : ((size_t)length < size ? length : (int)size - 1);
+}
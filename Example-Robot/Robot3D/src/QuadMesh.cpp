@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -20,13 +22,20 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "Vectors.h"
+#include "FrameArena.h"
+#include "CommandBuffer.h"
+#include "GeometryArena.h"
+#include "VertexCache.h"
 #include "QuadMesh.h"
+#include "PerfCounters.h"
 
 #define POSITION_ATTRIBUTE 0
 #define NORMAL_ATTRIBUTE 2
 
 #define BUFFER_OFFSET(offset) ((void*)(offset))
 #define MEMBER_OFFSET(s,m) ((char*)NULL + (offsetof(s,m)))
+
+const unsigned int QuadMesh::restartIndex;
 
 QuadMesh::QuadMesh(int maxMeshSize, float meshDim)
 {
@@ -43,6 +52,11 @@ QuadMesh::QuadMesh(int maxMeshSize, float meshDim)
         vao = 0;
         vbos[0] = vbos[1] = vbos[2] = 0;
         indexCount = 0;
+        inArena = false;
+        blockSize = 0;
+        topology = TriangleList;
+        procedural = false;
+        heightTexture = 0;
 
 	// setup the material and lights used for the mesh
 	mat_ambient[0] = 0.0;
@@ -127,7 +141,7 @@ void QuadMesh::addIndices(unsigned int i1, unsigned int i2, unsigned int i3, uns
 }
 
 
-bool QuadMesh::InitMesh(int meshSize,Vector3 origin,double meshLength,double meshWidth,Vector3 dir1, Vector3 dir2)
+bool QuadMesh::InitMesh(int meshSize,Vector3 origin,double meshLength,double meshWidth,Vector3 dir1, Vector3 dir2, Topology topology, int blockSize)
 {
 	Vector3 o;
 	int currentVertex = 0; 	  
@@ -160,7 +174,16 @@ bool QuadMesh::InitMesh(int meshSize,Vector3 origin,double meshLength,double mes
         std::vector<float>().swap(normalsVBO);
         std::vector<unsigned int>().swap(indices);
         std::vector<unsigned int>().swap(triangleIndices);
+        std::vector<unsigned int>().swap(blockFirstIndex);
+        this->blockSize = 0;
+        this->topology = topology;
+        procedural = false;
 
+        // size everything once instead of growing it a push_back at a time
+        verticesVBO.reserve(numVertices * 3);
+        normalsVBO.reserve(numVertices * 3);
+        indices.reserve(meshSize * meshSize * 4);
+        triangleIndices.reserve(topology == TriangleStrip ? meshSize * (2 * meshSize + 3) : meshSize * meshSize * 6);
 
         for(int i=0; i< meshSize+1; i++)
 	{
@@ -205,24 +228,159 @@ bool QuadMesh::InitMesh(int meshSize,Vector3 origin,double meshLength,double mes
                 addNormal(vertices[j].normal.x, vertices[j].normal.y, vertices[j].normal.z);
         }
 
-        triangleIndices.reserve(meshSize * meshSize * 6);
-        triangleIndices.clear();
-        for (size_t idx = 0; idx + 3 < indices.size(); idx += 4)
+        if (topology == TriangleStrip)
         {
-                unsigned int i0 = indices[idx];
-                unsigned int i1 = indices[idx + 1];
-                unsigned int i2 = indices[idx + 2];
-                unsigned int i3 = indices[idx + 3];
-                triangleIndices.push_back(i0);
-                triangleIndices.push_back(i1);
-                triangleIndices.push_back(i2);
-                triangleIndices.push_back(i0);
-                triangleIndices.push_back(i2);
-                triangleIndices.push_back(i3);
+                // (row + 1, col), (row, col) pairs give the same triangles
+                // and winding as the list below, with restart between rows
+                for (int j = 0; j < meshSize; j++)
+                {
+                        for (int k = 0; k <= meshSize; k++)
+                        {
+                                triangleIndices.push_back((j + 1) * (meshSize + 1) + k);
+                                triangleIndices.push_back(j * (meshSize + 1) + k);
+                        }
+                        triangleIndices.push_back(restartIndex);
+                }
+                indexCount = static_cast<GLsizei>(triangleIndices.size());
+                return true;
         }
+
+        auto addQuadTriangles = [&](size_t quad)
+        {
+                unsigned int i0 = indices[quad * 4];
+                unsigned int i1 = indices[quad * 4 + 1];
+                unsigned int i2 = indices[quad * 4 + 2];
+                unsigned int i3 = indices[quad * 4 + 3];
+                unsigned int triangles[6] = { i0, i1, i2, i0, i2, i3 };
+                triangleIndices.insert(triangleIndices.end(), triangles, triangles + 6);
+        };
+
+        if (blockSize <= 0 || meshSize % blockSize != 0)
+        {
+                for (size_t quad = 0; quad < (size_t)numQuads; quad++)
+                {
+                        addQuadTriangles(quad);
+                }
+                indexCount = static_cast<GLsizei>(triangleIndices.size());
+                return true;
+        }
+
+        // same layout as Simplify(): blocks in row-major order, each one
+        // contiguous and row-major inside
+        int blocksPerSide = meshSize / blockSize;
+        blockFirstIndex.reserve(blocksPerSide * blocksPerSide + 1);
+        for (int br = 0; br < blocksPerSide; br++)
+        {
+                for (int bc = 0; bc < blocksPerSide; bc++)
+                {
+                        blockFirstIndex.push_back((unsigned int)triangleIndices.size());
+                        for (int row = br * blockSize; row < (br + 1) * blockSize; row++)
+                        {
+                                for (int col = bc * blockSize; col < (bc + 1) * blockSize; col++)
+                                {
+                                        addQuadTriangles((size_t)row * meshSize + col);
+                                }
+                        }
+                }
+        }
+        blockFirstIndex.push_back((unsigned int)triangleIndices.size());
+        this->blockSize = blockSize;
         indexCount = static_cast<GLsizei>(triangleIndices.size());
         return true;
 }
+
+bool QuadMesh::InitProceduralMesh(int meshSize, Vector3 origin, double meshLength, double meshWidth, Vector3 dir1, Vector3 dir2)
+{
+        if (meshSize < 1)
+        {
+                return false;
+        }
+
+        std::vector<float>().swap(verticesVBO);
+        std::vector<float>().swap(normalsVBO);
+        std::vector<unsigned int>().swap(indices);
+        std::vector<unsigned int>().swap(triangleIndices);
+        std::vector<unsigned int>().swap(blockFirstIndex);
+        blockSize = 0;
+        topology = TriangleList;
+        procedural = true;
+        numVertices = 0;
+        numQuads = meshSize * meshSize;
+        indexCount = 0;
+
+        Vector3 step1 = dir1 * (float)(meshLength / meshSize);
+        Vector3 step2 = dir2 * (float)(meshWidth / meshSize);
+        gridOrigin[0] = origin.x;
+        gridOrigin[1] = origin.y;
+        gridOrigin[2] = origin.z;
+        gridOrigin[3] = (float)meshSize;
+        gridStep1[0] = step1.x;
+        gridStep1[1] = step1.y;
+        gridStep1[2] = step1.z;
+        gridStep1[3] = 0.0f;
+        gridStep2[0] = step2.x;
+        gridStep2[1] = step2.y;
+        gridStep2[2] = step2.z;
+        gridStep2[3] = 0.0f;
+        return true;
+}
+
+void QuadMesh::SetHeightTexture(GLuint texture, float heightScale)
+{
+        heightTexture = texture;
+        gridStep2[3] = texture ? heightScale : 0.0f;
+}
+
+const char *QuadMesh::GetProceduralVertexPrelude()
+{
+        // vertex i is corner i % 6 of quad i / 6, corners in the order of
+        // the triangle list (two triangles sharing the row-major diagonal)
+        return
+                "#version 130\n"
+                "uniform vec4 uGridOrigin;\n"
+                "uniform vec4 uGridStep1;\n"
+                "uniform vec4 uGridStep2;\n"
+                "uniform sampler2D uGridHeight;\n"
+                "const ivec2 gridCorners[6] = ivec2[6](ivec2(0, 0), ivec2(1, 0), ivec2(1, 1), ivec2(0, 0), ivec2(1, 1), ivec2(0, 1));\n"
+                "float gridHeight(ivec2 v)\n"
+                "{\n"
+                "    return texelFetch(uGridHeight, v, 0).r * uGridStep2.w;\n"
+                "}\n"
+                "void proceduralGridVertex(out vec3 position, out vec3 normal)\n"
+                "{\n"
+                "    int size = int(uGridOrigin.w);\n"
+                "    int quad = gl_VertexID / 6;\n"
+                "    ivec2 v = ivec2(quad % size, quad / size) + gridCorners[gl_VertexID % 6];\n"
+                "    vec3 up = normalize(cross(uGridStep1.xyz, uGridStep2.xyz));\n"
+                "    position = uGridOrigin.xyz + float(v.x) * uGridStep1.xyz + float(v.y) * uGridStep2.xyz;\n"
+                "    normal = up;\n"
+                "    if (uGridStep2.w != 0.0)\n"
+                "    {\n"
+                "        ivec2 last = ivec2(size);\n"
+                "        float dx = gridHeight(min(v + ivec2(1, 0), last)) - gridHeight(max(v - ivec2(1, 0), ivec2(0)));\n"
+                "        float dy = gridHeight(min(v + ivec2(0, 1), last)) - gridHeight(max(v - ivec2(0, 1), ivec2(0)));\n"
+                "        position += gridHeight(v) * up;\n"
+                "        normal = normalize(cross(2.0 * uGridStep1.xyz + dx * up, 2.0 * uGridStep2.xyz + dy * up));\n"
+                "    }\n"
+                "}\n";
+}
+
+void QuadMesh::SetupProceduralProgram(GLuint program) const
+{
+        if (!program)
+        {
+                return;
+        }
+
+        GLint previous = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+        glUseProgram(program);
+        glUniform4fv(glGetUniformLocation(program, "uGridOrigin"), 1, gridOrigin);
+        glUniform4fv(glGetUniformLocation(program, "uGridStep1"), 1, gridStep1);
+        glUniform4fv(glGetUniformLocation(program, "uGridStep2"), 1, gridStep2);
+        glUniform1i(glGetUniformLocation(program, "uGridHeight"), heightTextureUnit);
+        glUseProgram(previous);
+}
 
 // Immediate Mode Draw
 void QuadMesh::DrawMesh(int meshSize)
@@ -233,6 +391,8 @@ void QuadMesh::DrawMesh(int meshSize)
 	glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
 	glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
 	glMaterialfv(GL_FRONT, GL_SHININESS, mat_shininess);
+	PerfCounters::Add(PerfCounters::MaterialChanges);
+	PerfCounters::CountDraws((unsigned long long)meshSize * meshSize, 4ULL * meshSize * meshSize, true);
 
 	for(int j=0; j< meshSize; j++)
 	{
@@ -279,17 +439,524 @@ void QuadMesh::DrawMesh(int meshSize)
 // VBO Mode Draw
 void QuadMesh::DrawMeshVBO(int meshSize)
 {
+        if (procedural)
+        {
+                DrawMeshVBORegion(meshSize, 0, meshSize, 0, meshSize);
+                return;
+        }
         if (!vao || indexCount == 0)
         {
                 return;
         }
 
         glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        if (topology == TriangleStrip)
+        {
+                glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+                glDrawElements(GL_TRIANGLE_STRIP, indexCount, GL_UNSIGNED_INT, 0);
+                glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+        }
+        else
+        {
+                glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        }
+        PerfCounters::CountDraws(1, indexCount, false);
         glBindVertexArray(0);
 }
+// VBO Mode Draw of a rectangular block of quads
+void QuadMesh::DrawMeshVBORegion(int meshSize, int row0, int row1, int col0, int col1)
+{
+        CommandBuffer commands;
+        RecordMeshVBORegion(commands, meshSize, row0, row1, col0, col1);
+        commands.Replay();
+}
+
+void QuadMesh::RecordMeshVBORegion(CommandBuffer &commands, int meshSize, int row0, int row1, int col0, int col1) const
+{
+        if (procedural)
+        {
+                RecordProceduralRegion(commands, meshSize, row0, row1, col0, col1);
+                return;
+        }
+
+        if (!vao || indexCount == 0 || row0 >= row1 || col0 >= col1)
+        {
+                return;
+        }
+
+        FrameVector<unsigned int> firsts;
+        FrameVector<GLsizei> counts;
+        GetRegionRanges(meshSize, row0, row1, col0, col1, firsts, counts);
+
+        FrameVector<size_t> offsets(firsts.size());
+        for (size_t r = 0; r < firsts.size(); r++)
+        {
+                offsets[r] = firsts[r] * sizeof(unsigned int);
+        }
+
+        // every strip range stays inside one row, so no restart is needed
+        commands.BindVertexArray(vao);
+        commands.MultiDrawElements(topology == TriangleStrip ? GL_TRIANGLE_STRIP : GL_TRIANGLES,
+                                   &counts[0], GL_UNSIGNED_INT, &offsets[0], (GLsizei)counts.size());
+        commands.BindVertexArray(0);
+}
+
+// six vertex ids per quad in row-major order, as the prelude expects
+void QuadMesh::RecordProceduralRegion(CommandBuffer &commands, int meshSize, int row0, int row1, int col0, int col1) const
+{
+        if (!vao || row0 >= row1 || col0 >= col1)
+        {
+                return;
+        }
+
+        int rows = row1 - row0;
+        FrameVector<GLint> firsts(rows);
+        FrameVector<GLsizei> counts(rows);
+        for (int r = 0; r < rows; r++)
+        {
+                firsts[r] = ((row0 + r) * meshSize + col0) * 6;
+                counts[r] = (col1 - col0) * 6;
+        }
+
+        if (heightTexture)
+        {
+                commands.BindTexture(GL_TEXTURE0 + heightTextureUnit, GL_TEXTURE_2D, heightTexture);
+        }
+        commands.BindVertexArray(vao);
+        commands.MultiDrawArrays(GL_TRIANGLES, &firsts[0], &counts[0], rows);
+        commands.BindVertexArray(0);
+        if (heightTexture)
+        {
+                commands.BindTexture(GL_TEXTURE0 + heightTextureUnit, GL_TEXTURE_2D, 0);
+        }
+}
+
+void QuadMesh::GetRegionRanges(int meshSize, int row0, int row1, int col0, int col1, FrameVector<unsigned int> &firsts, FrameVector<GLsizei> &counts) const
+{
+        if (topology == TriangleStrip)
+        {
+                // a row's strip is 2 indices per column plus the restart
+                for (int r = row0; r < row1; r++)
+                {
+                        firsts.push_back((unsigned int)((size_t)r * (2 * meshSize + 3) + 2 * col0));
+                        counts.push_back(2 * (col1 - col0 + 1));
+                }
+                return;
+        }
+
+        if (blockSize == 0)
+        {
+                // triangleIndices holds 6 indices per quad in row-major
+                // order, so each row of the region is one contiguous range
+                for (int r = row0; r < row1; r++)
+                {
+                        size_t firstQuad = (size_t)r * meshSize + col0;
+                        firsts.push_back((unsigned int)(firstQuad * 6));
+                        counts.push_back((col1 - col0) * 6);
+                }
+                return;
+        }
+
+        // blocks are contiguous in row-major order, so each block row of
+        // the region is one range; partly covered blocks are drawn whole
+        int blocksPerSide = meshSize / blockSize;
+        int blockCol0 = col0 / blockSize;
+        int blockCol1 = (col1 + blockSize - 1) / blockSize;
+        for (int br = row0 / blockSize; br < (row1 + blockSize - 1) / blockSize; br++)
+        {
+                unsigned int first = blockFirstIndex[br * blocksPerSide + blockCol0];
+                unsigned int last = blockFirstIndex[br * blocksPerSide + blockCol1];
+                if (last > first)
+                {
+                        firsts.push_back(first);
+                        counts.push_back((GLsizei)(last - first));
+                }
+        }
+}
+
+namespace
+{
+        const std::vector<unsigned int> &ExpandStrips(const std::vector<unsigned int> &strips, std::vector<unsigned int> &list)
+        {
+                size_t start = 0;
+                for (size_t i = 0; i <= strips.size(); i++)
+                {
+                        if (i < strips.size() && strips[i] != QuadMesh::restartIndex)
+                        {
+                                continue;
+                        }
+                        for (size_t t = start; t + 2 < i; t++)
+                        {
+                                bool odd = ((t - start) & 1) != 0;
+                                list.push_back(strips[odd ? t + 1 : t]);
+                                list.push_back(strips[odd ? t : t + 1]);
+                                list.push_back(strips[t + 2]);
+                        }
+                        start = i + 1;
+                }
+                return list;
+        }
+
+        // Restricted quadtree over one block of the grid. leafSize holds, for
+        // every quad of the mesh, the size of the leaf that contains it.
+        struct QuadtreeBuilder
+        {
+                int meshSize;
+                const std::vector<float> *positions;
+                std::vector<int> leafSize;
+
+                Vector3 Position(int row, int col) const
+                {
+                        const float *p = &(*positions)[((size_t)row * (meshSize + 1) + col) * 3];
+                        return Vector3(p[0], p[1], p[2]);
+                }
+
+                // largest distance of the node's vertices from the plane
+                // through its centre, normal to the cross of its diagonals
+                float Deviation(int row0, int col0, int size) const
+                {
+                        Vector3 d0 = Position(row0 + size, col0 + size) - Position(row0, col0);
+                        Vector3 d1 = Position(row0 + size, col0) - Position(row0, col0 + size);
+                        Vector3 n = d0.cross(d1);
+                        if (n.length() == 0.0f)
+                        {
+                                return 0.0f;
+                        }
+                        n.normalize();
+                        Vector3 center = Position(row0 + size / 2, col0 + size / 2);
+                        float deviation = 0.0f;
+                        for (int r = row0; r <= row0 + size; r++)
+                        {
+                                for (int c = col0; c <= col0 + size; c++)
+                                {
+                                        deviation = std::max(deviation, std::fabs((Position(r, c) - center).dot(n)));
+                                }
+                        }
+                        return deviation;
+                }
+
+                // gives every quad of the node the leaf size leaf
+                void SetLeaf(int row0, int col0, int size, int leaf)
+                {
+                        for (int r = row0; r < row0 + size; r++)
+                        {
+                                for (int c = col0; c < col0 + size; c++)
+                                {
+                                        leafSize[(size_t)r * meshSize + c] = leaf;
+                                }
+                        }
+                }
+
+                void Build(int row0, int col0, int size, float maxDeviation)
+                {
+                        if (size == 1 || Deviation(row0, col0, size) <= maxDeviation)
+                        {
+                                SetLeaf(row0, col0, size, size);
+                                return;
+                        }
+                        int half = size / 2;
+                        Build(row0, col0, half, maxDeviation);
+                        Build(row0, col0 + half, half, maxDeviation);
+                        Build(row0 + half, col0, half, maxDeviation);
+                        Build(row0 + half, col0 + half, half, maxDeviation);
+                }
+
+                int LeafAt(int row, int col) const
+                {
+                        if (row < 0 || col < 0 || row >= meshSize || col >= meshSize)
+                        {
+                                return 0;
+                        }
+                        return leafSize[(size_t)row * meshSize + col];
+                }
+
+                // smallest leaf touching one edge from outside, 0 if none
+                int SmallestNeighbour(int row0, int col0, int size, int edge) const
+                {
+                        int smallest = 0;
+                        for (int i = 0; i < size; i++)
+                        {
+                                int neighbour;
+                                switch (edge)
+                                {
+                                case 0: neighbour = LeafAt(row0 - 1, col0 + i); break;
+                                case 1: neighbour = LeafAt(row0 + i, col0 + size); break;
+                                case 2: neighbour = LeafAt(row0 + size, col0 + i); break;
+                                default: neighbour = LeafAt(row0 + i, col0 - 1); break;
+                                }
+                                if (neighbour && (!smallest || neighbour < smallest))
+                                {
+                                        smallest = neighbour;
+                                }
+                        }
+                        return smallest;
+                }
+
+                // splits leaves until every neighbour is at most one level
+                // smaller; returns whether anything changed
+                bool Restrict()
+                {
+                        bool changed = false;
+                        for (int row = 0; row < meshSize; row++)
+                        {
+                                for (int col = 0; col < meshSize; col++)
+                                {
+                                        int size = leafSize[(size_t)row * meshSize + col];
+                                        if (row % size != 0 || col % size != 0 || size < 4)
+                                        {
+                                                continue;
+                                        }
+                                        for (int edge = 0; edge < 4; edge++)
+                                        {
+                                                int neighbour = SmallestNeighbour(row, col, size, edge);
+                                                if (neighbour && neighbour < size / 2)
+                                                {
+                                                        SetLeaf(row, col, size, size / 2);
+                                                        changed = true;
+                                                        break;
+                                                }
+                                        }
+                                }
+                        }
+                        return changed;
+                }
+        };
+}
+
+bool QuadMesh::Simplify(int meshSize, float maxError, int blockSize)
+{
+        if (topology != TriangleList || blockSize < 1 || (blockSize & (blockSize - 1)) != 0 || meshSize % blockSize != 0 ||
+            verticesVBO.size() != (size_t)(meshSize + 1) * (meshSize + 1) * 3)
+        {
+                return false;
+        }
+
+        QuadtreeBuilder builder;
+        builder.meshSize = meshSize;
+        builder.positions = &verticesVBO;
+        builder.leafSize.assign((size_t)meshSize * meshSize, 1);
+
+        // any triangulation of points within e of a plane stays within e
+        // of it, so the surface error is at most twice the deviation
+        int blocksPerSide = meshSize / blockSize;
+        for (int br = 0; br < blocksPerSide; br++)
+        {
+                for (int bc = 0; bc < blocksPerSide; bc++)
+                {
+                        builder.Build(br * blockSize, bc * blockSize, blockSize, 0.5f * maxError);
+                }
+        }
+        while (builder.Restrict())
+        {
+        }
+
+        std::vector<int> remap(verticesVBO.size() / 3, -1);
+        std::vector<float> newVertices;
+        std::vector<float> newNormals;
+        std::vector<unsigned int> newIndices;
+        std::vector<unsigned int> newBlockFirst;
+        newBlockFirst.reserve(blocksPerSide * blocksPerSide + 1);
+
+        // grid vertex (row, col) -> index into the compacted arrays
+        auto vertexIndex = [&](int row, int col) -> unsigned int
+        {
+                size_t old = (size_t)row * (meshSize + 1) + col;
+                if (remap[old] < 0)
+                {
+                        remap[old] = (int)(newVertices.size() / 3);
+                        newVertices.insert(newVertices.end(), &verticesVBO[old * 3], &verticesVBO[old * 3] + 3);
+                        newNormals.insert(newNormals.end(), &normalsVBO[old * 3], &normalsVBO[old * 3] + 3);
+                }
+                return (unsigned int)remap[old];
+        };
+
+        for (int br = 0; br < blocksPerSide; br++)
+        {
+                for (int bc = 0; bc < blocksPerSide; bc++)
+                {
+                        newBlockFirst.push_back((unsigned int)newIndices.size());
+                        for (int row = br * blockSize; row < (br + 1) * blockSize; row++)
+                        {
+                                for (int col = bc * blockSize; col < (bc + 1) * blockSize; col++)
+                                {
+                                        int size = builder.leafSize[(size_t)row * meshSize + col];
+                                        if (row % size != 0 || col % size != 0)
+                                        {
+                                                continue;
+                                        }
+
+                                        // boundary in the winding of the original quads, with
+                                        // the midpoint of every edge that has smaller neighbours
+                                        int half = size / 2;
+                                        int boundary[8][2];
+                                        int count = 0;
+                                        const int corners[4][2] = { { row, col }, { row, col + size }, { row + size, col + size }, { row + size, col } };
+                                        const int midpoints[4][2] = { { row, col + half }, { row + half, col + size }, { row + size, col + half }, { row + half, col } };
+                                        bool split = false;
+                                        for (int e = 0; e < 4; e++)
+                                        {
+                                                boundary[count][0] = corners[e][0];
+                                                boundary[count][1] = corners[e][1];
+                                                count++;
+                                                int neighbour = size > 1 ? builder.SmallestNeighbour(row, col, size, e) : 0;
+                                                if (neighbour && neighbour < size)
+                                                {
+                                                        boundary[count][0] = midpoints[e][0];
+                                                        boundary[count][1] = midpoints[e][1];
+                                                        count++;
+                                                        split = true;
+                                                }
+                                        }
+
+                                        if (!split)
+                                        {
+                                                unsigned int i0 = vertexIndex(row, col);
+                                                unsigned int i1 = vertexIndex(row, col + size);
+                                                unsigned int i2 = vertexIndex(row + size, col + size);
+                                                unsigned int i3 = vertexIndex(row + size, col);
+                                                unsigned int quad[6] = { i0, i1, i2, i0, i2, i3 };
+                                                newIndices.insert(newIndices.end(), quad, quad + 6);
+                                                continue;
+                                        }
+
+                                        unsigned int center = vertexIndex(row + half, col + half);
+                                        for (int i = 0; i < count; i++)
+                                        {
+                                                int next = (i + 1) % count;
+                                                newIndices.push_back(center);
+                                                newIndices.push_back(vertexIndex(boundary[i][0], boundary[i][1]));
+                                                newIndices.push_back(vertexIndex(boundary[next][0], boundary[next][1]));
+                                        }
+                                }
+                        }
+                }
+        }
+        newBlockFirst.push_back((unsigned int)newIndices.size());
+
+        verticesVBO.swap(newVertices);
+        normalsVBO.swap(newNormals);
+        triangleIndices.swap(newIndices);
+        blockFirstIndex.swap(newBlockFirst);
+        this->blockSize = blockSize;
+        indexCount = static_cast<GLsizei>(triangleIndices.size());
+        return true;
+}
+
+bool QuadMesh::AddToArena(GeometryArena &arena)
+{
+        if (triangleIndices.empty() || topology != TriangleList)
+        {
+                return false;
+        }
+
+        std::vector<GeometryArenaVertex> arenaVertices(verticesVBO.size() / 3);
+        for (size_t v = 0; v < arenaVertices.size(); v++)
+        {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                        arenaVertices[v].position[axis] = verticesVBO[v * 3 + axis];
+                        arenaVertices[v].normal[axis] = normalsVBO[v * 3 + axis];
+                }
+        }
+
+        inArena = arena.Allocate(&arenaVertices[0], (int)arenaVertices.size(), &triangleIndices[0], (int)triangleIndices.size(), arenaMesh);
+        return inArena;
+}
+
+void QuadMesh::RemoveFromArena()
+{
+        inArena = false;
+}
+
+void QuadMesh::AddArenaRegion(GeometryArena::DrawList &list, int meshSize, int row0, int row1, int col0, int col1, float material, unsigned int views) const
+{
+        if (!inArena || row0 >= row1 || col0 >= col1)
+        {
+                return;
+        }
+
+        // same ranges as RecordMeshVBORegion
+        FrameVector<unsigned int> firsts;
+        FrameVector<GLsizei> counts;
+        GetRegionRanges(meshSize, row0, row1, col0, col1, firsts, counts);
+        for (size_t r = 0; r < firsts.size(); r++)
+        {
+                list.Add(arenaMesh, firsts[r], counts[r], 0.0f, 0.0f, 0.0f, material, views);
+        }
+}
+
+void QuadMesh::OptimizeIndexOrder(int meshSize, int cacheSize)
+{
+        // a strip per row already reuses every vertex of the row above
+        if (triangleIndices.empty() || topology != TriangleList)
+        {
+                return;
+        }
+
+        FrameVector<unsigned int> firsts;
+        FrameVector<GLsizei> counts;
+        if (blockSize == 0)
+        {
+                GetRegionRanges(meshSize, 0, meshSize, 0, meshSize, firsts, counts);
+        }
+        else
+        {
+                for (size_t b = 0; b + 1 < blockFirstIndex.size(); b++)
+                {
+                        firsts.push_back(blockFirstIndex[b]);
+                        counts.push_back((GLsizei)(blockFirstIndex[b + 1] - blockFirstIndex[b]));
+                }
+        }
+
+        // the greedy order can lose to the grid's own order on small or
+        // simplified ranges, so a range only takes it if it measures better
+        std::vector<unsigned int> reordered;
+        for (size_t r = 0; r < firsts.size(); r++)
+        {
+                unsigned int *range = &triangleIndices[firsts[r]];
+                reordered.assign(range, range + counts[r]);
+                OptimizeVertexCache(&reordered[0], counts[r], cacheSize);
+                if (ComputeACMR(&reordered[0], counts[r], cacheSize) < ComputeACMR(range, counts[r], cacheSize))
+                {
+                        std::copy(reordered.begin(), reordered.end(), range);
+                }
+        }
+}
+
+int QuadMesh::GetTriangleCount() const
+{
+        return topology == TriangleStrip || procedural ? numQuads * 2 : (int)(triangleIndices.size() / 3);
+}
+
+// strips are measured as the triangle list they assemble into
+float QuadMesh::GetACMR(int cacheSize) const
+{
+        std::vector<unsigned int> list;
+        const std::vector<unsigned int> &triangles = topology == TriangleStrip ? ExpandStrips(triangleIndices, list) : triangleIndices;
+        return triangles.empty() ? 0.0f : ComputeACMR(&triangles[0], triangles.size(), cacheSize);
+}
+
+float QuadMesh::GetATVR(int cacheSize) const
+{
+        std::vector<unsigned int> list;
+        const std::vector<unsigned int> &triangles = topology == TriangleStrip ? ExpandStrips(triangleIndices, list) : triangleIndices;
+        return triangles.empty() ? 0.0f : ComputeATVR(&triangles[0], triangles.size(), cacheSize);
+}
+
 void QuadMesh::CreateMeshVBO(int meshSize, GLint attribVertexPosition,GLint attribVertexNormal)
 {
+        if (procedural)
+        {
+                // nothing to upload; draws still need a VAO bound
+                if (!vao)
+                {
+                        glGenVertexArrays(1, &vao);
+                }
+                return;
+        }
+
+        OptimizeIndexOrder(meshSize);
+
         if (!vao)
         {
                 glGenVertexArrays(1, &vao);
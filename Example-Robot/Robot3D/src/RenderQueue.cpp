@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Vectors.h"
+#include "RenderQueue.h"
+
+namespace
+{
+	struct ItemFrontToBack
+	{
+		template <typename T>
+		bool operator()(const T &a, const T &b) const
+		{
+			if (a.depth != b.depth)
+				return a.depth < b.depth;
+			return a.state < b.state;
+		}
+	};
+}
+
+RenderQueue::RenderQueue()
+{
+	depthPrepass = false;
+	viewCount = 1;
+	beginView = NULL;
+	currentFrame = 0;
+	countOverdraw = false;
+	measuring = false;
+	overdraw = 0.0f;
+	itemsDrawn = 0;
+
+	for (int f = 0; f < overdrawFrames; ++f)
+	{
+		for (int q = 0; q < passQueries; ++q)
+			frames[f].queries[q] = 0;
+		frames[f].used = 0;
+		frames[f].pixels = 0;
+	}
+}
+
+RenderQueue::~RenderQueue()
+{
+	FreeMemory();
+}
+
+bool RenderQueue::Init()
+{
+	for (int f = 0; f < overdrawFrames; ++f)
+	{
+		glGenQueries(passQueries, frames[f].queries);
+		frames[f].used = 0;
+	}
+	countOverdraw = frames[0].queries[0] != 0;
+	return true;
+}
+
+void RenderQueue::FreeMemory()
+{
+	for (int f = 0; f < overdrawFrames; ++f)
+	{
+		if (frames[f].queries[0])
+			glDeleteQueries(passQueries, frames[f].queries);
+		for (int q = 0; q < passQueries; ++q)
+			frames[f].queries[q] = 0;
+		frames[f].used = 0;
+	}
+	countOverdraw = false;
+	measuring = false;
+}
+
+int RenderQueue::AddState(RenderQueueStateFunc begin, RenderQueueStateFunc end)
+{
+	State state;
+	state.begin = begin;
+	state.end = end;
+	states.push_back(state);
+	return (int)states.size() - 1;
+}
+
+void RenderQueue::SetViews(int count, RenderQueueViewFunc beginView)
+{
+	this->beginView = beginView;
+	viewCount = beginView && count > 1 ? count : 1;
+}
+
+void RenderQueue::BeginFrame(const Vector3 &eye, const Vector3 &lookAt)
+{
+	this->eye = eye;
+	forward = lookAt - eye;
+	forward.normalize();
+
+	// last frame's storage belongs to an arena that has been reset
+	for (int l = 0; l < LayerCount; ++l)
+	{
+		FrameVector<Item>().swap(items[l]);
+		items[l].reserve(128);
+	}
+	itemsDrawn = 0;
+
+	measuring = false;
+	if (countOverdraw)
+	{
+		// this slot was last used overdrawFrames ago; if its results are
+		// still in flight it keeps them and this frame goes unmeasured
+		OverdrawFrame &frame = frames[currentFrame];
+		CollectOverdraw(frame);
+		measuring = frame.used == 0;
+		if (measuring)
+		{
+			GLint viewport[4];
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			frame.pixels = (long long)viewport[2] * viewport[3];
+		}
+	}
+}
+
+void RenderQueue::Submit(Layer layer, const Vector3 &center, int state, RenderQueueDrawFunc draw, RenderQueueDrawFunc drawDepth, int param, unsigned int views)
+{
+	if (views == 0)
+		return;
+
+	Item item;
+	item.depth = forward.dot(center - eye);
+	item.state = state;
+	item.param = param;
+	item.views = views;
+	item.draw = draw;
+	item.drawDepth = drawDepth;
+	items[layer].push_back(item);
+}
+
+void RenderQueue::SwitchState(int &current, int next)
+{
+	if (current == next)
+		return;
+	if (current >= 0 && states[current].end)
+		states[current].end();
+	if (next >= 0 && states[next].begin)
+		states[next].begin();
+	current = next;
+}
+
+void RenderQueue::Flush(Layer layer)
+{
+	FrameVector<Item> &list = items[layer];
+	if (list.empty())
+		return;
+
+	std::sort(list.begin(), list.end(), ItemFrontToBack());
+
+	if (viewCount == 1)
+	{
+		itemsDrawn += DrawPass(list, 1u | Broadcast);
+	}
+	else
+	{
+		bool broadcast = false;
+		for (size_t i = 0; i < list.size() && !broadcast; ++i)
+			broadcast = (list[i].views & Broadcast) != 0;
+		if (broadcast)
+		{
+			beginView(-1);
+			itemsDrawn += DrawPass(list, Broadcast);
+		}
+		for (int v = 0; v < viewCount; ++v)
+		{
+			beginView(v);
+			itemsDrawn += DrawPass(list, 1u << v);
+		}
+	}
+}
+
+// pre-pass and colour pass over the items matching views; returns the
+// number drawn
+int RenderQueue::DrawPass(const FrameVector<Item> &list, unsigned int views)
+{
+	if (depthPrepass)
+	{
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		for (size_t i = 0; i < list.size(); ++i)
+		{
+			if ((list[i].views & views) && list[i].drawDepth)
+				list[i].drawDepth(list[i].param);
+		}
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthFunc(GL_LEQUAL);
+	}
+
+	// only the colour pass counts towards overdraw
+	OverdrawFrame &frame = frames[currentFrame];
+	bool counting = measuring && frame.used < passQueries;
+	if (counting)
+		glBeginQuery(GL_SAMPLES_PASSED, frame.queries[frame.used]);
+
+	int drawn = 0;
+	int current = -1;
+	for (size_t i = 0; i < list.size(); ++i)
+	{
+		if (!(list[i].views & views))
+			continue;
+		SwitchState(current, list[i].state);
+		list[i].draw(list[i].param);
+		drawn++;
+	}
+	SwitchState(current, -1);
+
+	if (counting)
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		frame.used++;
+	}
+
+	if (depthPrepass)
+		glDepthFunc(GL_LESS);
+	return drawn;
+}
+
+void RenderQueue::EndFrame()
+{
+	currentFrame = (currentFrame + 1) % overdrawFrames;
+}
+
+// Reads nothing until every query of the frame has landed; until then the
+// frame keeps its queries and BeginFrame() comes back to it on the slot's
+// next turn.
+void RenderQueue::CollectOverdraw(OverdrawFrame &frame)
+{
+	if (frame.used == 0)
+		return;
+
+	for (int q = 0; q < frame.used; ++q)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return;
+	}
+
+	GLuint64 samples = 0;
+	for (int q = 0; q < frame.used; ++q)
+	{
+		GLuint64 result = 0;
+		glGetQueryObjectui64v(frame.queries[q], GL_QUERY_RESULT, &result);
+		samples += result;
+	}
+	if (frame.pixels > 0)
+		overdraw = (float)((double)samples / (double)frame.pixels);
+	frame.used = 0;
+}
@@ -0,0 +1,283 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "ReplayLog.h"
+
+namespace
+{
+	const char magic[4] = { 'R', '3', 'D', 'L' };
+	const unsigned char version = 1;
+	const size_t flushSize = 64 * 1024;
+
+	unsigned long long ZigZag(long long value)
+	{
+		return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+	}
+
+	long long UnZigZag(unsigned long long value)
+	{
+		return (long long)(value >> 1) ^ -(long long)(value & 1);
+	}
+}
+
+ReplayLog::ReplayLog()
+{
+	file = NULL;
+	writing = false;
+	readPos = 0;
+	corrupt = false;
+	lastDt = 0;
+	lastX = 0;
+	lastY = 0;
+	tickCount = 0;
+}
+
+ReplayLog::~ReplayLog()
+{
+	Close();
+}
+
+bool ReplayLog::OpenWrite(const char *path)
+{
+	Close();
+	file = std::fopen(path, "wb");
+	if (!file)
+		return false;
+
+	writing = true;
+	buffer.assign(magic, magic + 4);
+	buffer.push_back(version);
+	return true;
+}
+
+bool ReplayLog::OpenRead(const char *path)
+{
+	Close();
+	std::FILE *in = std::fopen(path, "rb");
+	if (!in)
+		return false;
+
+	buffer.clear();
+	unsigned char chunk[4096];
+	size_t got;
+	while ((got = std::fread(chunk, 1, sizeof(chunk), in)) > 0)
+		buffer.insert(buffer.end(), chunk, chunk + got);
+	std::fclose(in);
+
+	if (buffer.size() < 5 || std::memcmp(&buffer[0], magic, 4) != 0 || buffer[4] != version)
+	{
+		buffer.clear();
+		return false;
+	}
+	readPos = 5;
+	corrupt = false;
+	return true;
+}
+
+void ReplayLog::Close(unsigned long long finalHash)
+{
+	if (file && writing)
+	{
+		PutHeader(EventEnd, 0);
+		for (int i = 0; i < 8; ++i)
+			buffer.push_back((unsigned char)(finalHash >> (i * 8)));
+		Flush();
+		std::fclose(file);
+	}
+	file = NULL;
+	writing = false;
+	buffer.clear();
+	readPos = 0;
+	lastDt = 0;
+	lastX = 0;
+	lastY = 0;
+	tickCount = 0;
+}
+
+void ReplayLog::Flush()
+{
+	if (!buffer.empty())
+		std::fwrite(&buffer[0], 1, buffer.size(), file);
+	std::fflush(file);
+	buffer.clear();
+}
+
+void ReplayLog::PutVarint(unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		buffer.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back((unsigned char)value);
+}
+
+void ReplayLog::PutHeader(EventType type, unsigned int value)
+{
+	PutVarint(((unsigned long long)value << 3) | (unsigned long long)type);
+}
+
+void ReplayLog::PutPointer(int x, int y)
+{
+	PutVarint(ZigZag((long long)x - lastX));
+	PutVarint(ZigZag((long long)y - lastY));
+	lastX = x;
+	lastY = y;
+}
+
+void ReplayLog::WriteTick(int dtMs)
+{
+	if (!IsWriting())
+		return;
+
+	PutHeader(EventTick, (unsigned int)ZigZag((long long)dtMs - lastDt));
+	lastDt = dtMs;
+	tickCount++;
+	if (buffer.size() >= flushSize)
+		Flush();
+}
+
+void ReplayLog::WriteKey(unsigned char key, int x, int y, int time)
+{
+	if (!IsWriting())
+		return;
+
+	PutHeader(EventKey, (unsigned int)(time > 0 ? time : 0));
+	buffer.push_back(key);
+	PutPointer(x, y);
+}
+
+void ReplayLog::WriteMouse(int button, int state, int x, int y, int time)
+{
+	if (!IsWriting())
+		return;
+
+	PutHeader(EventMouse, (unsigned int)(time > 0 ? time : 0));
+	buffer.push_back((unsigned char)button);
+	buffer.push_back((unsigned char)state);
+	PutPointer(x, y);
+}
+
+void ReplayLog::WriteMotion(int x, int y, int time)
+{
+	if (!IsWriting())
+		return;
+
+	PutHeader(EventMotion, (unsigned int)(time > 0 ? time : 0));
+	PutPointer(x, y);
+}
+
+void ReplayLog::WriteCheckpoint(unsigned long long hash)
+{
+	if (!IsWriting())
+		return;
+
+	PutHeader(EventCheckpoint, 0);
+	for (int i = 0; i < 8; ++i)
+		buffer.push_back((unsigned char)(hash >> (i * 8)));
+}
+
+bool ReplayLog::GetVarint(unsigned long long &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (readPos >= buffer.size())
+			return false;
+		unsigned char byte = buffer[readPos++];
+		value |= (unsigned long long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool ReplayLog::GetPointer(int &x, int &y)
+{
+	unsigned long long dx, dy;
+	if (!GetVarint(dx) || !GetVarint(dy))
+		return false;
+	lastX += (int)UnZigZag(dx);
+	lastY += (int)UnZigZag(dy);
+	x = lastX;
+	y = lastY;
+	return true;
+}
+
+bool ReplayLog::Read(Event &event)
+{
+	if (writing || corrupt || readPos >= buffer.size())
+		return false;
+
+	unsigned long long header;
+	if (!GetVarint(header))
+	{
+		corrupt = true;
+		return false;
+	}
+	event.type = (EventType)(header & 7);
+	unsigned long long value = header >> 3;
+	event.time = 0;
+	event.code = 0;
+	event.state = 0;
+	event.x = lastX;
+	event.y = lastY;
+	event.hash = 0;
+
+	bool ok = true;
+	switch (event.type)
+	{
+	case EventTick:
+		lastDt += (int)UnZigZag(value);
+		event.time = lastDt;
+		tickCount++;
+		break;
+	case EventKey:
+		event.time = (int)value;
+		ok = readPos < buffer.size();
+		if (ok)
+			event.code = buffer[readPos++];
+		ok = ok && GetPointer(event.x, event.y);
+		break;
+	case EventMouse:
+		event.time = (int)value;
+		ok = readPos + 2 <= buffer.size();
+		if (ok)
+		{
+			event.code = buffer[readPos++];
+			event.state = buffer[readPos++];
+		}
+		ok = ok && GetPointer(event.x, event.y);
+		break;
+	case EventMotion:
+		event.time = (int)value;
+		ok = GetPointer(event.x, event.y);
+		break;
+	case EventCheckpoint:
+	case EventEnd:
+		ok = readPos + 8 <= buffer.size();
+		for (int i = 0; ok && i < 8; ++i)
+			event.hash |= (unsigned long long)buffer[readPos++] << (i * 8);
+		break;
+	default:
+		ok = false;
+		break;
+	}
+
+	if (!ok)
+		corrupt = true;
+	return ok;
+}
+
+unsigned long long ReplayLog::Hash(const void *bytes, size_t size, unsigned long long seed)
+{
+	const unsigned char *p = (const unsigned char *)bytes;
+	unsigned long long hash = seed;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
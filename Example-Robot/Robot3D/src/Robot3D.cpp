@@ -1,8 +1,13 @@
 #define _USE_MATH_DEFINES
 #include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <vector>
 
 #define GLEW_STATIC
@@ -12,6 +17,28 @@
 
 #include "Vectors.h"
 #include "QuadMesh.h"
+#include "ShadowMap.h"
+#include "ShaderUtil.h"
+#include "StaticBatch.h"
+#include "DynamicResolution.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+#include "WorkerPool.h"
+#include "WaterSim.h"
+#include "ParticleSystem.h"
+#include "FrameArena.h"
+#include "CommandBuffer.h"
+#include "GeometryArena.h"
+#include "TessellatedSurface.h"
+#include "MultiView.h"
+#include "ReplayLog.h"
+#include "GallerySession.h"
+#include "StateExport.h"
+#include "PerfCounters.h"
+#include "SceneGraph.h"
+#include "CollisionWorld.h"
+#include "TargetPool.h"
+#include "PostProcess.h"
 
 const int vWidth = 800;
 const int vHeight = 600;
@@ -20,92 +47,130 @@ const float boothWidth = 18.0f;
 const float boothDepth = 10.0f;
 const float boothHeight = 12.0f;
 
-const float waterWidth = 14.0f;
-const float waterDepth = 4.0f;
-const float waterSurfaceY = 5.8f;
 const float waterBottomY = 4.0f;
-const float waterCenterZ = 1.5f;
 
-const float waterLeftX = -waterWidth * 0.5f;
-const float waterRightX = waterWidth * 0.5f;
-const float waterBackZ = waterCenterZ - waterDepth * 0.5f;
-const float waterFrontZ = waterCenterZ + waterDepth * 0.5f;
+// the simulation this window shows; the layout constants come with it
+GallerySession gallery;
 
-const float pathLeftX = waterLeftX + 0.6f;
-const float pathRightX = waterRightX - 0.6f;
-const float pathZ = waterCenterZ;
-
-const float objectFloatOffset = 1.0f;
-const float objectGroundRestY = 1.1f;
+QuadMesh *groundMesh = NULL;
+int meshSize = 32;
+const Vector3 groundOrigin = Vector3(-30.0f, -0.02f, 30.0f);
+const float groundExtent = 60.0f;
+// flat or gently curved ground collapses to a few large quads per tile
+const float groundSimplifyError = 0.01f;
+// --strips draws the full-resolution ground as restart-separated strips
+QuadMesh::Topology groundTopology = QuadMesh::TriangleList;
+// the same plane as a procedural grid: no vertex or index buffers, every
+// vertex comes from gl_VertexID and the grid uniforms
+QuadMesh *groundGrid = NULL;
+bool proceduralGround = false;
+
+struct GroundShader
+{
+GLuint program;
+GLint colorLocation;
+GLint shadowMatrixLocation[2];
+GLint shadowMapLocation[2];
+GLint shadowStrengthLocation;
+};
 
-const float moveSpeed = 4.6f;
-const float gravityAccel = 28.0f;
-const float groundPauseDuration = 1.6f;
+GroundShader groundShader = { 0, -1, { -1, -1 }, { -1, -1 }, -1 };
+Vector3 groundBaseColor = Vector3(0.12f, 0.45f, 0.2f);
 
-const float waveAmplitude = 0.65f;
-const float waveSpeed = 1.3f;
-const float primaryWaveFrequency = 2.0f * static_cast<float>(M_PI);
-const float secondaryWaveFrequency = 1.1f * static_cast<float>(M_PI);
+GLfloat light_position0[] = { -12.0F, 18.0F, 18.0F, 1.0F };
+GLfloat light_position1[] = { 12.0F, 18.0F, 18.0F, 1.0F };
+GLfloat light_diffuse[] = { 1.0F, 1.0F, 1.0F, 1.0F };
+GLfloat light_specular[] = { 1.0F, 1.0F, 1.0F, 1.0F };
+GLfloat light_ambient[] = { 0.9F, 0.9F, 0.9F, 1.0F };
 
-enum class WaterState
+// one cached shadow map per light; the booth, water volume and rail are
+// static casters, only the active target is re-rendered each frame
+const int shadowMapSize = 1024;
+const float shadowFieldOfView = 70.0f;
+const float shadowNearPlane = 1.0f;
+const float shadowFarPlane = 80.0f;
+const float shadowStrength = 0.75f;
+const Vector3 shadowTarget = Vector3(0.0f, 4.5f, 0.0f);
+
+ShadowMap *shadowMaps[2] = { NULL, NULL };
+bool shadowsEnabled = true;
+
+// the booth, water volume and front rail never move; they are described
+// once as boxes and baked into a single static batch at startup
+enum StaticMaterialId
 {
-Wavy,
-Flat
+BoothMaterial,
+BeamMaterial,
+TrimMaterial,
+WaterMaterial,
+RailMaterial,
+StaticMaterialCount
 };
 
-enum class ObjectState
+struct StaticPart
 {
-Duck,
-TargetOnly
+Vector3 center;
+Vector3 size;
+StaticMaterialId material;
 };
 
-enum class CameraState
+const StaticBatchMaterial staticMaterials[StaticMaterialCount] =
 {
-Front,
-Perspective
+{ { 0.22f, 0.22f, 0.25f, 1.0f }, { 0.62f, 0.62f, 0.66f, 1.0f }, { 0.35f, 0.35f, 0.4f, 1.0f }, 48.0f },
+{ { 0.12f, 0.12f, 0.14f, 1.0f }, { 0.4f, 0.4f, 0.45f, 1.0f }, { 0.2f, 0.2f, 0.25f, 1.0f }, 24.0f },
+{ { 0.18f, 0.08f, 0.08f, 1.0f }, { 0.7f, 0.25f, 0.25f, 1.0f }, { 0.3f, 0.2f, 0.2f, 1.0f }, 32.0f },
+{ { 0.0f, 0.08f, 0.18f, 1.0f }, { 0.2f, 0.45f, 0.8f, 1.0f }, { 0.5f, 0.6f, 0.7f, 1.0f }, 48.0f },
+{ { 0.12f, 0.12f, 0.12f, 1.0f }, { 0.35f, 0.35f, 0.38f, 1.0f }, { 0.5f, 0.5f, 0.55f, 1.0f }, 56.0f }
 };
 
-enum class MovementPhase
+std::vector<StaticPart> staticParts;
+std::vector<Vector3> boothInstanceOffsets;
+// 'n' swaps the single booth for a row of copies side by side
+const int boothRowCount = 3;
+const float boothRowSpacing = boothWidth + 4.0f;
+bool boothRow = false;
+StaticBatch *staticBatch = NULL;
+GLuint staticBatchProgram = 0;
+
+// The duck and the standalone target are parts hung off a scene graph
+// whose root follows the gallery's target. World matrices are only
+// recomputed when the root moves, and each part is drawn with one
+// glMultMatrixf of its cached world matrix instead of a chain of
+// translate/rotate/scale calls.
+enum TargetMaterialId
 {
-MoveAcross,
-Falling,
-GroundPause
+DuckBodyMaterial,
+DuckWingMaterial,
+DuckBeakMaterial,
+DuckEyeMaterial,
+TargetWhiteMaterial,
+TargetRedMaterial,
+TargetMaterialCount
 };
 
-WaterState waterState = WaterState::Wavy;
-ObjectState objectState = ObjectState::Duck;
-CameraState cameraState = CameraState::Front;
-MovementPhase movementPhase = MovementPhase::MoveAcross;
-
-float wavePhase = 0.0f;
-float objectPosX = pathLeftX;
-float objectPosY = waterSurfaceY + objectFloatOffset;
-float objectPosZ = pathZ;
-float verticalVelocity = 0.0f;
-float groundPauseTimer = 0.0f;
-
-QuadMesh *groundMesh = NULL;
-int meshSize = 32;
-
-GLuint groundProgram = 0;
-GLint groundColorLocation = -1;
-Vector3 groundBaseColor = Vector3(0.12f, 0.45f, 0.2f);
+const StaticBatchMaterial targetMaterials[TargetMaterialCount] =
+{
+{ { 0.28f, 0.2f, 0.05f, 1.0f }, { 0.95f, 0.78f, 0.18f, 1.0f }, { 0.5f, 0.5f, 0.3f, 1.0f }, 40.0f },
+{ { 0.26f, 0.18f, 0.05f, 1.0f }, { 0.85f, 0.7f, 0.2f, 1.0f }, { 0.35f, 0.35f, 0.2f, 1.0f }, 28.0f },
+{ { 0.4f, 0.2f, 0.02f, 1.0f }, { 0.95f, 0.5f, 0.05f, 1.0f }, { 0.6f, 0.4f, 0.2f, 1.0f }, 25.0f },
+{ { 0.05f, 0.05f, 0.05f, 1.0f }, { 0.1f, 0.1f, 0.1f, 1.0f }, { 0.5f, 0.5f, 0.5f, 1.0f }, 80.0f },
+{ { 0.6f, 0.6f, 0.6f, 1.0f }, { 0.9f, 0.9f, 0.9f, 1.0f }, { 0.3f, 0.3f, 0.3f, 1.0f }, 30.0f },
+{ { 0.4f, 0.0f, 0.0f, 1.0f }, { 0.9f, 0.1f, 0.1f, 1.0f }, { 0.5f, 0.2f, 0.2f, 1.0f }, 30.0f }
+};
 
-GLfloat light_position0[] = { -12.0F, 18.0F, 18.0F, 1.0F };
-GLfloat light_position1[] = { 12.0F, 18.0F, 18.0F, 1.0F };
-GLfloat light_diffuse[] = { 1.0F, 1.0F, 1.0F, 1.0F };
-GLfloat light_specular[] = { 1.0F, 1.0F, 1.0F, 1.0F };
-GLfloat light_ambient[] = { 0.9F, 0.9F, 0.9F, 1.0F };
+struct TargetPart
+{
+int node;
+TargetMaterialId material;
+CommandBufferFunc shape;
+float args[4];
+};
 
-float cameraAzimuth = 0.0f;
-float cameraElevation = 18.0f;
-float cameraRadius = 34.0f;
-float cameraTargetRadius = 34.0f;
+SceneGraph targetGraph;
+int targetRootNode = -1;
+std::vector<TargetPart> duckParts;
+std::vector<TargetPart> standaloneTargetParts;
 
-const float minRadius = 20.0f;
-const float maxRadius = 46.0f;
-const float minElevation = 10.0f;
-const float maxElevation = 55.0f;
 const float orbitSensitivity = 0.25f;
 const float elevationSensitivity = 0.2f;
 const float zoomSensitivity = 0.2f;
@@ -117,8 +182,215 @@ int lastMouseY = 0;
 
 int lastFrameTime = 0;
 
+// on-demand rendering: while nothing animates the timer is not re-armed,
+// so neither simulation ticks nor frames run until input wakes it
+const int animationIntervalMs = 16;
+bool onDemandRendering = true;
+bool animationTimerActive = false;
+
+// the scene renders offscreen at a resolution scaled to hold this budget
+const float targetFrameTimeMs = 1000.0f / 60.0f;
+DynamicResolution *dynamicResolution = NULL;
+
+// the finished scene goes through an anti-aliasing stage on its way to the
+// single-sampled window; --aa off|fxaa|smaa|msaa picks the starting mode
+PostProcess *postProcess = NULL;
+PostProcess::Mode startAntiAliasing = PostProcess::Off;
+
+// occlusion culling: the booth is drawn first as the occluder, then ground
+// tiles and the active target are tested with bounding-box queries
+const int groundTilesPerSide = 8;
+OcclusionCuller *occlusionCuller = NULL;
+int groundTileQueries[groundTilesPerSide * groundTilesPerSide];
+int targetQuery = -1;
+int groundTilesDrawn = 0;
+
+// opaque draws are sorted front-to-back; the optional depth pre-pass uses a
+// position-only program so heavy shaders only run on visible fragments
+RenderQueue *renderQueue = NULL;
+int groundRenderState = -1;
+GLuint depthOnlyProgram = 0;
+const Vector3 cameraLookAt = Vector3(0.0f, 4.5f, 0.0f);
+const Vector3 boothCenter = Vector3(0.0f, boothHeight * 0.5f, 0.0f);
+int lastStatsTime = 0;
+
+// operator new calls from the end of one frame to the end of the next; with
+// transient data in the frame arena the steady state should show 0. Direct
+// malloc() calls, from the driver for instance, are not seen.
+unsigned long long frameEndAllocations = 0;
+unsigned long long peakFrameAllocations = 0;
+
+// 'h' shows the PerfCounters HUD. Its text is compiled into a display list
+// a couple of times a second, so drawing it is one glCallList per frame.
+bool hudVisible = false;
+GLuint hudList = 0;
+int lastHudTime = 0;
+const int hudRefreshMs = 500;
+const int hudMargin = 10;
+const int hudLineHeight = 15;
+
+// Scene partitions (ground tiles, booths, water, target) are recorded into
+// command buffers on the worker pool, then replayed in sorted order by the
+// render queue on the GL thread. Each render queue item's param is its slot.
+typedef void (*RecordFunc)(CommandBuffer &commands, int param);
+struct RecordJob
+{
+RecordFunc record;
+int param;
+};
+const int maxRecordJobs = groundTilesPerSide * groundTilesPerSide + 8;
+RecordJob recordJobs[maxRecordJobs];
+CommandBuffer recordedCommands[maxRecordJobs];
+int recordJobCount = 0;
+bool parallelRecording = true;
+float recordTimeMs = 0.0f;
+
+// Ground and booth meshes also live in one shared arena. In indirect mode
+// the visible ground rows and every booth instance x material each become
+// one entry of a single glMultiDrawElementsIndirect per partition.
+const int arenaVertexCapacity = 65536;
+const int arenaIndexCapacity = 262144;
+const int arenaMaxDraws = 4096;
+// arena programs read the booth offset and material from the per-draw data
+const char *arenaInstanceDefines =
+"#define instanceOffset getDrawData().xyz\n"
+"#define materialId getDrawData().w\n";
+GeometryArena *geometryArena = NULL;
+GroundShader arenaGroundShader = { 0, -1, { -1, -1 }, { -1, -1 }, -1 };
+GLuint arenaStaticProgram = 0;
+GLuint arenaDepthProgram = 0;
+bool indirectDrawing = true;
+GroundShader proceduralGroundShader = { 0, -1, { -1, -1 }, { -1, -1 }, -1 };
+GLuint proceduralDepthProgram = 0;
+// visible tiles of the single ground item (indirect or tessellated)
+int batchedGroundTiles[groundTilesPerSide * groundTilesPerSide];
+int batchedGroundTileCount = 0;
+// view mask of every tile this frame
+unsigned int groundTileViews[groundTilesPerSide * groundTilesPerSide];
+
+// Split screen: the player's orbit camera, a spectator in the stands and an
+// overhead operator view. The scene is culled against every view, then
+// submitted and recorded once; items are replayed per view, except the
+// arena draws, which reach all viewports in one call where the vertex
+// shader can pick the viewport.
+const int splitViewCount = 3;
+const Vector3 spectatorEye = Vector3(-27.0f, 13.0f, 25.0f);
+const float operatorHalfHeight = 20.0f;
+MultiView *multiView = NULL;
+bool splitScreen = false;
+GroundShader broadcastGroundShader = { 0, -1, { -1, -1 }, { -1, -1 }, -1 };
+GLuint broadcastStaticProgram = 0;
+GLuint broadcastDepthProgram = 0;
+
+// GPU tessellation: ground and water are coarse patches subdivided by edge
+// length on screen, heights and normals come from the evaluation shader.
+// The ground has one patch per tile; the ripples reach the shader through
+// a float texture that is only uploaded while the simulation is moving.
+const int waterPatchesX = 16;
+const int waterPatchesZ = 4;
+const float tessPixelsPerSegment = 8.0f;
+const float tessMaxLevel = 64.0f;
+const GLenum waterRippleTextureUnit = GL_TEXTURE6;
+TessellatedSurface *groundSurface = NULL;
+TessellatedSurface *waterSurface = NULL;
+GroundShader tessGroundShader = { 0, -1, { -1, -1 }, { -1, -1 }, -1 };
+GLuint tessWaterProgram = 0;
+GLuint waterRippleTexture = 0;
+bool waterRippleTextureLive = false;
+bool tessellation = false;
+
+// interactive ripples on top of the analytic waves, stepped at a fixed rate
+const int waterSimCellsX = 1024;
+const int waterSimCellsZ = 256;
+const float waterSimStepHz = 120.0f;
+const float splashRadius = 0.6f;
+const float splashDepth = -0.5f;
+WorkerPool *workerPool = NULL;
+WaterSim *waterSim = NULL;
+
+// splashes and debris share one fixed pool; 'b' fills it to stress test
+const int particleCapacity = 1 << 20;
+const int splashParticles = 400;
+const int debrisParticles = 250;
+const float particleSize = 0.06f;
+ParticleSystem *particles = NULL;
+GLuint particleProgram = 0;
+
 GLUquadric *targetQuadric = NULL;
 
+// --record FILE logs every input event and tick dt; --replay FILE drives
+// the simulation from such a log instead of live input, and with
+// --fast-forward runs its ticks back to back. Checkpoint hashes of the
+// simulation state show where a replay stopped matching.
+const int replayCheckpointTicks = 240;
+ReplayLog *inputLog = NULL;
+ReplayLog *replayLog = NULL;
+bool fastForward = false;
+int replayDivergedTick = -1;
+int replayStartTime = 0;
+int replayFrames = 0;
+
+// --headless N [TICKS] steps N independent galleries on the worker pool
+// without a window and reports session-ticks per second. Workers step
+// their contiguous run of sessions a batch of ticks at a time, each
+// session for the whole batch before the next, so only one pool round
+// trip is paid per batch and a session stays in cache while it steps.
+const int headlessDefaultTicks = 3600;
+const int headlessBatchTicks = 64;
+
+struct HeadlessBatch
+{
+GallerySession *sessions;
+int ticks;
+float dt;
+};
+
+// --collision-bench N [TICKS] runs N ground-level targets on crossing lanes
+// through a field of booths without a window and reports the collision
+// world's time per tick against the animation tick. A target that touches
+// another target or a booth part turns around. Like the gallery, the field
+// is shallow and grows along x, the lane axis the broad phase sweeps.
+// Targets live in a pool and turn over all the time: a few are shot every
+// tick and those reaching the end of their lane retire, each replaced by a
+// new one popping up somewhere on a lane of the same kind.
+const int collisionBenchDefaultTicks = 600;
+const float collisionLaneSpacing = 3.0f;
+const float collisionFieldDepth = 96.0f;
+// ground area per target
+const float collisionTargetArea = 36.0f;
+const float collisionTargetSpeed = 4.6f;
+const float collisionBoothSpacing = 128.0f;
+const int collisionShotsPerTick = 8;
+// the duck's body sphere as buildTargetGraph() scales it
+const Vector3 duckRadii = Vector3(0.8f, 0.9f, 1.3f);
+
+// --mesh-bench [SIZE] builds a SIZE x SIZE ground grid without a window, in
+// rows and in the tile blocks the ground uses, and reports the vertex cache
+// figures before and after OptimizeIndexOrder(). The ground itself is
+// simplified to a few triangles per tile, which leaves the reorder nothing
+// to gain there.
+const int meshBenchDefaultSize = 256;
+
+struct CollisionBench
+{
+CollisionWorld world;
+TargetPool pool;
+// body -> target; booth bodies hold invalid handles
+std::vector<TargetPool::Handle> bodyTargets;
+float length;
+unsigned int seed;
+};
+
+// --export NAME publishes a snapshot of the gallery every tick into a
+// shared-memory segment that scoreboards and overlays map and read
+StateExport *stateExport = NULL;
+uint64_t exportedTicks = 0;
+// --watch-export NAME is such a reader: it prints each new snapshot it
+// sees, polling at this interval, and leaves once the segment is gone
+const int watchExportIntervalMs = 100;
+// polls without a new tick before checking the segment still exists
+const int watchExportIdlePolls = 10;
+
 void initOpenGL(int w, int h);
 void display(void);
 void reshape(int w, int h);
@@ -126,28 +398,207 @@ void keyboard(unsigned char key, int x, int y);
 void mouse(int button, int state, int x, int y);
 void mouseMotionHandler(int xMouse, int yMouse);
 void animationHandler(int param);
+void keyboardInput(unsigned char key, int x, int y);
+void mouseInput(int button, int state, int x, int y);
+void mouseMotionInput(int xMouse, int yMouse);
+void replayHandler(int param);
+void finishReplay(bool matched);
+void closeInputLog();
+void closeStateExport();
+int watchStateExport(const char *name);
+unsigned long long hashSimulationState();
+int runHeadless(int sessionCount, int tickCount);
+void publishState();
+void headlessTask(void *context, int begin, int end, int worker);
+int runCollisionBench(int targetCount, int tickCount);
+int runMeshBench(int size);
+void spawnCollisionTarget(CollisionBench &bench, bool alongLane);
+bool replaceCollisionTarget(CollisionBench &bench, TargetPool::Handle handle);
+void wakeAnimation();
+void requestRedraw();
+bool isSceneAnimating();
 
 void updateAnimation(float dt);
-void resetObjectToStart();
-float getWaterSurfaceHeight(float x, float z);
-Vector3 getWaterNormal(float x, float z);
-void applyCameraPreset(CameraState state);
-
-void drawGround();
-void drawBooth();
-void drawWater();
-void drawActiveObject();
-void drawDuck();
-void drawStandaloneTarget();
-void drawTargetLayer(float innerRadius, float outerRadius);
+
+void initOcclusionCulling();
+void issueOcclusionQueries(const Vector3 &eye);
+void getGroundTileBounds(int tileX, int tileZ, Vector3 &boxMin, Vector3 &boxMax);
+void getGroundTileRange(int tile, int &first, int &last);
+void getTargetBounds(Vector3 &boxMin, Vector3 &boxMax);
+
+void initSimulation();
+void initRenderQueue();
+void submitScene();
+void updateStatsTitle();
+void drawHud();
+bool useDynamicResolution();
+void beginGroundState();
+void endGroundState();
+void drawStaticSceneDepth(int param);
+void drawParticlesItem(int param);
+void emitParticleBurst();
+
+int addRecordJob(RecordFunc record, int param);
+void recordTask(void *context, int begin, int end, int worker);
+void recordCommands();
+void replayRecordedItem(int slot);
+void replayRecordedDepth(int slot);
+void recordGroundTile(CommandBuffer &commands, int tile);
+void recordStaticSceneItem(CommandBuffer &commands, int param);
+void recordWaterItem(CommandBuffer &commands, int param);
+void recordActiveTargetItem(CommandBuffer &commands, int param);
+
+void initGroundShader(GroundShader &shader, GLuint program);
+void initGeometryArena();
+bool useIndirectDrawing();
+void initProceduralGround();
+bool useProceduralGround();
+void recordArenaGround(CommandBuffer &commands, int param);
+void recordArenaStatic(CommandBuffer &commands, int param);
+void replayArenaStatic(int slot);
+void replayArenaDepth(int slot);
+void initTessellation();
+bool useTessellation();
+void drawTessellatedGroundItem(int param);
+void drawTessellatedWaterItem(int param);
+void uploadWaterRipples();
+void setupViews(const Vector3 &eye);
+void beginViewPass(int view);
+bool useViewBroadcast();
+unsigned int cullViews(const Vector3 &boxMin, const Vector3 &boxMax, int query);
+
+void updateShadowMaps();
+void drawStaticShadowCasters();
+void drawDynamicShadowCasters();
+void invalidateStaticShadows();
+
+void buildStaticParts();
+void buildStaticBatch();
+void setBoothInstances(const std::vector<Vector3> &offsets);
+void toggleBoothRow();
+
+void drawStaticScene();
+void drawStaticPartsImmediate();
+void recordWater(CommandBuffer &commands);
+void drawActiveTarget();
+void recordActiveTarget(CommandBuffer &commands);
+void buildTargetGraph();
+void addTargetPart(std::vector<TargetPart> &parts, int node, TargetMaterialId material, CommandBufferFunc shape, float a, float b = 0.0f, float c = 0.0f, float d = 0.0f);
+void updateTargetGraph();
+Vector3 getTargetPosition();
+void drawStaticPartsCommand(const float *args);
+void solidSphereCommand(const float *args);
+void solidCubeCommand(const float *args);
+void solidConeCommand(const float *args);
+void diskCommand(const float *args);
 void setMaterial(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4], GLfloat shininess);
+void setMaterial(const StaticBatchMaterial &material);
 
-GLuint buildGroundProgram();
-GLuint compileShader(GLenum type, const char *src);
+std::string withViewFunctions(const std::string &prelude, bool broadcast);
+GLuint buildGroundProgram(const GeometryArena *arena, bool procedural = false, bool broadcast = false);
+GLuint buildStaticBatchProgram(const GeometryArena *arena, bool broadcast = false);
+GLuint buildDepthOnlyProgram(const GeometryArena *arena, bool procedural = false, bool broadcast = false);
+GLuint buildParticleProgram();
+GLuint buildTessellatedGroundProgram();
+GLuint buildTessellatedWaterProgram();
 
 int main(int argc, char **argv)
 {
+// no display needed, so this comes before glutInit()
+for (int i = 1; i < argc; ++i)
+{
+if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+{
+int ticks = (i + 2 < argc) ? std::atoi(argv[i + 2]) : headlessDefaultTicks;
+return runHeadless(std::atoi(argv[i + 1]), ticks);
+}
+if (std::strcmp(argv[i], "--collision-bench") == 0 && i + 1 < argc)
+{
+int ticks = (i + 2 < argc) ? std::atoi(argv[i + 2]) : collisionBenchDefaultTicks;
+return runCollisionBench(std::atoi(argv[i + 1]), ticks);
+}
+if (std::strcmp(argv[i], "--watch-export") == 0 && i + 1 < argc)
+{
+return watchStateExport(argv[i + 1]);
+}
+if (std::strcmp(argv[i], "--mesh-bench") == 0)
+{
+int size = (i + 1 < argc) ? std::atoi(argv[i + 1]) : meshBenchDefaultSize;
+return runMeshBench(size);
+}
+}
+
 glutInit(&argc, argv);
+for (int i = 1; i < argc; ++i)
+{
+if (std::strcmp(argv[i], "--strips") == 0)
+{
+groundTopology = QuadMesh::TriangleStrip;
+}
+else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+{
+inputLog = new ReplayLog();
+if (!inputLog->OpenWrite(argv[++i]))
+{
+std::fprintf(stderr, "Cannot write input log %s\n", argv[i]);
+delete inputLog;
+inputLog = NULL;
+}
+}
+else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+{
+replayLog = new ReplayLog();
+if (!replayLog->OpenRead(argv[++i]))
+{
+std::fprintf(stderr, "Cannot read input log %s\n", argv[i]);
+delete replayLog;
+replayLog = NULL;
+}
+}
+else if (std::strcmp(argv[i], "--fast-forward") == 0)
+{
+fastForward = true;
+}
+else if (std::strcmp(argv[i], "--aa") == 0 && i + 1 < argc)
+{
+const char *name = argv[++i];
+if (std::strcmp(name, "off") == 0)
+startAntiAliasing = PostProcess::Off;
+else if (std::strcmp(name, "fxaa") == 0)
+startAntiAliasing = PostProcess::Fxaa;
+else if (std::strcmp(name, "smaa") == 0)
+startAntiAliasing = PostProcess::SmaaLite;
+else if (std::strcmp(name, "msaa") == 0)
+startAntiAliasing = PostProcess::Msaa;
+else
+std::fprintf(stderr, "Unknown anti-aliasing mode %s, expected off, fxaa, smaa or msaa\n", name);
+}
+else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+{
+stateExport = new StateExport();
+if (!stateExport->Create(argv[++i]))
+{
+std::fprintf(stderr, "Cannot create shared state segment %s\n", argv[i]);
+delete stateExport;
+stateExport = NULL;
+}
+}
+}
+// a replay is not recorded again
+if (replayLog && inputLog)
+{
+delete inputLog;
+inputLog = NULL;
+}
+if (inputLog)
+{
+std::atexit(closeInputLog);
+}
+if (stateExport)
+{
+std::atexit(closeStateExport);
+}
+
 glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 glutInitWindowSize(vWidth, vHeight);
 glutInitWindowPosition(200, 30);
@@ -157,11 +608,21 @@ initOpenGL(vWidth, vHeight);
 
 glutDisplayFunc(display);
 glutReshapeFunc(reshape);
-glutMouseFunc(mouse);
-glutMotionFunc(mouseMotionHandler);
-glutKeyboardFunc(keyboard);
+glutMouseFunc(mouseInput);
+glutMotionFunc(mouseMotionInput);
+glutKeyboardFunc(keyboardInput);
 
-glutTimerFunc(16, animationHandler, 0);
+if (replayLog)
+{
+// the replay owns the tick; this keeps wakeAnimation() out of the way
+animationTimerActive = true;
+replayStartTime = glutGet(GLUT_ELAPSED_TIME);
+glutTimerFunc(0, replayHandler, 0);
+}
+else
+{
+wakeAnimation();
+}
 
 glutMainLoop();
 return 0;
@@ -197,19 +658,23 @@ glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
 glMatrixMode(GL_MODELVIEW);
 glLoadIdentity();
 
-Vector3 origin = Vector3(-30.0f, -0.02f, 30.0f);
+initSimulation();
+
 Vector3 dir1v = Vector3(1.0f, 0.0f, 0.0f);
 Vector3 dir2v = Vector3(0.0f, 0.0f, -1.0f);
-groundMesh = new QuadMesh(meshSize, 60.0f);
-groundMesh->InitMesh(meshSize, origin, 60.0, 60.0, dir1v, dir2v);
+groundMesh = new QuadMesh(meshSize, groundExtent);
+groundMesh->InitMesh(meshSize, groundOrigin, groundExtent, groundExtent, dir1v, dir2v, groundTopology, meshSize / groundTilesPerSide);
 
 Vector3 ambient = Vector3(0.05f, 0.16f, 0.05f);
 Vector3 diffuse = Vector3(groundBaseColor.x, groundBaseColor.y, groundBaseColor.z);
 Vector3 specular = Vector3(0.12f, 0.12f, 0.12f);
 groundMesh->SetMaterial(ambient, diffuse, specular, 6.0);
+if (groundTopology == QuadMesh::TriangleList && !groundMesh->Simplify(meshSize, groundSimplifyError, meshSize / groundTilesPerSide))
+{
+std::fprintf(stderr, "Ground mesh not simplified, tiles don't divide the mesh\n");
+}
 
-groundProgram = buildGroundProgram();
-groundColorLocation = glGetUniformLocation(groundProgram, "uBaseColor");
+initGroundShader(groundShader, buildGroundProgram(NULL));
 groundMesh->CreateMeshVBO(meshSize, 0, 1);
 
 targetQuadric = gluNewQuadric();
@@ -218,7 +683,55 @@ if (targetQuadric)
 gluQuadricNormals(targetQuadric, GLU_SMOOTH);
 }
 
-applyCameraPreset(cameraState);
+buildStaticParts();
+buildStaticBatch();
+buildTargetGraph();
+multiView = new MultiView();
+initGeometryArena();
+initProceduralGround();
+initTessellation();
+
+for (int i = 0; i < 2; ++i)
+{
+shadowMaps[i] = new ShadowMap(shadowMapSize);
+if (!shadowMaps[i]->Init())
+{
+std::fprintf(stderr, "Shadow map %d unavailable, shadows disabled\n", i);
+delete shadowMaps[i];
+shadowMaps[i] = NULL;
+shadowsEnabled = false;
+}
+}
+
+initOcclusionCulling();
+initRenderQueue();
+
+particleProgram = buildParticleProgram();
+if (!particleProgram || !particles->InitGL(0, 1))
+{
+std::fprintf(stderr, "Particle rendering unavailable, effects disabled\n");
+particleProgram = 0;
+}
+
+dynamicResolution = new DynamicResolution(targetFrameTimeMs);
+if (!dynamicResolution->Init(w, h))
+{
+std::fprintf(stderr, "Offscreen target unavailable, dynamic resolution disabled\n");
+delete dynamicResolution;
+dynamicResolution = NULL;
+}
+
+postProcess = new PostProcess();
+if (!postProcess->Init(w, h))
+{
+std::fprintf(stderr, "Offscreen target unavailable, anti-aliasing disabled\n");
+delete postProcess;
+postProcess = NULL;
+}
+else if (!postProcess->SetMode(startAntiAliasing))
+{
+std::fprintf(stderr, "%s anti-aliasing unsupported, anti-aliasing off\n", PostProcess::GetModeName(startAntiAliasing));
+}
 
 reshape(w, h);
 lastFrameTime = glutGet(GLUT_ELAPSED_TIME);
@@ -227,33 +740,76 @@ updateAnimation(0.0f);
 
 void display(void)
 {
-glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-glLoadIdentity();
+std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+FrameArena::NextFrame();
+updateTargetGraph();
 
-const float degToRad = static_cast<float>(M_PI) / 180.0f;
-float azRad = cameraAzimuth * degToRad;
-float elRad = cameraElevation * degToRad;
-float cosEl = std::cos(elRad);
-float eyeX = cameraRadius * std::sin(azRad) * cosEl;
-float eyeY = cameraRadius * std::sin(elRad);
-float eyeZ = cameraRadius * std::cos(azRad) * cosEl;
+if (shadowsEnabled)
+{
+updateShadowMaps();
+}
 
-gluLookAt(eyeX, eyeY, eyeZ, 0.0f, 4.5f, 0.0f, 0.0f, 1.0f, 0.0f);
+if (postProcess)
+{
+postProcess->BeginFrame();
+}
+if (useDynamicResolution())
+{
+dynamicResolution->BeginFrame();
+}
 
-glLightfv(GL_LIGHT0, GL_POSITION, light_position0);
-glLightfv(GL_LIGHT1, GL_POSITION, light_position1);
+glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-drawGround();
-drawBooth();
-drawWater();
-drawActiveObject();
+// the queue takes the whole frame's viewport for its overdraw figure
+Vector3 eye = gallery.GetCameraEye();
+renderQueue->BeginFrame(eye, cameraLookAt);
+setupViews(eye);
+submitScene();
+recordCommands();
+
+// occluders first so the queries below test against them; the queries
+// belong to the player's view
+renderQueue->Flush(RenderQueue::Occluders);
+if (multiView->GetViewCount() > 1)
+{
+beginViewPass(0);
+}
+issueOcclusionQueries(eye);
+renderQueue->Flush(RenderQueue::Opaque);
+renderQueue->EndFrame();
+multiView->EndViews();
+
+if (useDynamicResolution())
+{
+dynamicResolution->EndFrame(postProcess ? postProcess->GetTarget() : 0);
+}
+if (postProcess)
+{
+postProcess->EndFrame();
+}
 
+drawHud();
 glutSwapBuffers();
+PerfCounters::EndFrame(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+
+unsigned long long allocations = FrameArena::GetHeapAllocationCount();
+peakFrameAllocations = std::max(peakFrameAllocations, allocations - frameEndAllocations);
+frameEndAllocations = allocations;
+
+updateStatsTitle();
 }
 
 void reshape(int w, int h)
 {
 glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+if (dynamicResolution)
+{
+dynamicResolution->Resize(w, h);
+}
+if (postProcess)
+{
+postProcess->Resize(w, h);
+}
 
 glMatrixMode(GL_PROJECTION);
 glLoadIdentity();
@@ -273,32 +829,100 @@ break;
 case '1':
 case 'w':
 case 'W':
-waterState = (waterState == WaterState::Wavy) ? WaterState::Flat : WaterState::Wavy;
-if (movementPhase == MovementPhase::MoveAcross)
-{
-objectPosY = getWaterSurfaceHeight(objectPosX, pathZ) + objectFloatOffset;
-}
+gallery.ToggleWater();
 break;
 case '2':
 case 'd':
 case 'D':
-objectState = (objectState == ObjectState::Duck) ? ObjectState::TargetOnly : ObjectState::Duck;
+gallery.ToggleObject();
 break;
 case '3':
 case 'c':
 case 'C':
-cameraState = (cameraState == CameraState::Front) ? CameraState::Perspective : CameraState::Front;
-applyCameraPreset(cameraState);
+gallery.ToggleCamera();
+break;
+case '4':
+case 's':
+case 'S':
+shadowsEnabled = !shadowsEnabled && shadowMaps[0] && shadowMaps[1];
+break;
+case 'p':
+case 'P':
+gallery.TogglePaused();
+break;
+case 'o':
+case 'O':
+onDemandRendering = !onDemandRendering;
+break;
+case 'z':
+case 'Z':
+renderQueue->SetDepthPrepass(!renderQueue->IsDepthPrepass());
+break;
+case 'u':
+case 'U':
+if (occlusionCuller)
+{
+occlusionCuller->SetEnabled(!occlusionCuller->IsEnabled());
+}
+break;
+case 'v':
+case 'V':
+if (dynamicResolution)
+{
+dynamicResolution->SetEnabled(!dynamicResolution->IsEnabled());
+}
+break;
+case 'a':
+case 'A':
+if (postProcess)
+{
+postProcess->CycleMode();
+}
+break;
+case 'b':
+case 'B':
+emitParticleBurst();
+break;
+case 'n':
+case 'N':
+toggleBoothRow();
+break;
+case 'm':
+case 'M':
+parallelRecording = !parallelRecording;
+break;
+case 'i':
+case 'I':
+indirectDrawing = !indirectDrawing;
+break;
+case 'g':
+case 'G':
+proceduralGround = !proceduralGround;
+break;
+case 't':
+case 'T':
+tessellation = !tessellation;
+break;
+case 'l':
+case 'L':
+splitScreen = !splitScreen;
 break;
 case 'r':
 case 'R':
-resetObjectToStart();
+gallery.ResetTarget();
 break;
-default:
+case 'h':
+case 'H':
+hudVisible = !hudVisible;
+// the histogram covers the frames the HUD has been up for
+PerfCounters::ResetHistogram();
+lastHudTime = glutGet(GLUT_ELAPSED_TIME) - hudRefreshMs;
 break;
+default:
+return;
 }
 
-glutPostRedisplay();
+requestRedraw();
 }
 
 void mouse(int button, int state, int x, int y)
@@ -316,442 +940,1722 @@ lastMouseX = x;
 lastMouseY = y;
 }
 
+// pressing or releasing a button alone changes nothing on screen
+if (!onDemandRendering)
+{
 glutPostRedisplay();
 }
+}
 
 void mouseMotionHandler(int xMouse, int yMouse)
 {
 int dx = xMouse - lastMouseX;
 int dy = yMouse - lastMouseY;
 
+if ((dx == 0 && dy == 0) || (!leftButtonDown && !rightButtonDown))
+{
+return;
+}
+
 if (leftButtonDown)
 {
-cameraAzimuth += dx * orbitSensitivity;
-cameraElevation -= dy * elevationSensitivity;
-if (cameraAzimuth > 70.0f)
-cameraAzimuth = 70.0f;
-if (cameraAzimuth < -70.0f)
-cameraAzimuth = -70.0f;
-if (cameraElevation > maxElevation)
-cameraElevation = maxElevation;
-if (cameraElevation < minElevation)
-cameraElevation = minElevation;
+gallery.Orbit(dx * orbitSensitivity, -dy * elevationSensitivity);
 }
 
 if (rightButtonDown)
 {
-cameraTargetRadius += dy * zoomSensitivity;
-if (cameraTargetRadius > maxRadius)
-cameraTargetRadius = maxRadius;
-if (cameraTargetRadius < minRadius)
-cameraTargetRadius = minRadius;
+gallery.Zoom(dy * zoomSensitivity);
 }
 
 lastMouseX = xMouse;
 lastMouseY = yMouse;
 
-glutPostRedisplay();
+requestRedraw();
 }
 
 void animationHandler(int param)
 {
 int current = glutGet(GLUT_ELAPSED_TIME);
-float dt = (current - lastFrameTime) * 0.001f;
+int elapsed = current - lastFrameTime;
 lastFrameTime = current;
-if (dt < 0.0f)
-dt = 0.0f;
+if (elapsed < 0)
+elapsed = 0;
 
-updateAnimation(dt);
-
-glutPostRedisplay();
-glutTimerFunc(16, animationHandler, 0);
+if (onDemandRendering && !isSceneAnimating())
+{
+// idle: stop ticking until requestRedraw() wakes us up again
+animationTimerActive = false;
+return;
 }
 
-void updateAnimation(float dt)
+// whole milliseconds, so a replay computes exactly the same dt
+if (inputLog)
 {
-const float twoPi = 2.0f * static_cast<float>(M_PI);
-wavePhase += dt * waveSpeed;
-if (wavePhase > twoPi)
+if (inputLog->GetTickCount() % replayCheckpointTicks == 0)
 {
-wavePhase = std::fmod(wavePhase, twoPi);
+inputLog->WriteCheckpoint(hashSimulationState());
+}
+inputLog->WriteTick(elapsed);
 }
+updateAnimation(elapsed * 0.001f);
 
-float smoothing = std::min(1.0f, dt * 5.0f);
-cameraRadius += (cameraTargetRadius - cameraRadius) * smoothing;
+glutPostRedisplay();
+glutTimerFunc(animationIntervalMs, animationHandler, 0);
+}
 
-switch (movementPhase)
+// GLUT input goes through these: recorded when logging, ignored while a
+// replay is driving (except Esc)
+void keyboardInput(unsigned char key, int x, int y)
+{
+if (replayLog && key != 27)
+return;
+if (inputLog)
 {
-case MovementPhase::MoveAcross:
+inputLog->WriteKey(key, x, y, glutGet(GLUT_ELAPSED_TIME) - lastFrameTime);
+}
+keyboard(key, x, y);
+}
+
+void mouseInput(int button, int state, int x, int y)
 {
-objectPosX += moveSpeed * dt;
-if (objectPosX >= pathRightX)
+if (replayLog)
+return;
+if (inputLog)
 {
-objectPosX = pathRightX;
-movementPhase = MovementPhase::Falling;
-verticalVelocity = 0.0f;
+inputLog->WriteMouse(button, state, x, y, glutGet(GLUT_ELAPSED_TIME) - lastFrameTime);
 }
-objectPosY = getWaterSurfaceHeight(objectPosX, pathZ) + objectFloatOffset;
-break;
+mouse(button, state, x, y);
 }
-case MovementPhase::Falling:
+
+void mouseMotionInput(int xMouse, int yMouse)
 {
-verticalVelocity += gravityAccel * dt;
-objectPosY -= verticalVelocity * dt;
-if (objectPosY <= objectGroundRestY)
+if (replayLog)
+return;
+if (inputLog)
 {
-objectPosY = objectGroundRestY;
-movementPhase = MovementPhase::GroundPause;
-groundPauseTimer = 0.0f;
+inputLog->WriteMotion(xMouse, yMouse, glutGet(GLUT_ELAPSED_TIME) - lastFrameTime);
 }
-break;
+mouseMotionHandler(xMouse, yMouse);
 }
-case MovementPhase::GroundPause:
+
+// Applies logged input up to the next tick, then runs that tick and waits
+// for its recorded dt (or not at all when fast-forwarding). Idle periods
+// had no ticks, so they simply vanish.
+void replayHandler(int param)
+{
+ReplayLog::Event event;
+while (replayLog->Read(event))
 {
-groundPauseTimer += dt;
-if (groundPauseTimer >= groundPauseDuration)
+switch (event.type)
+{
+case ReplayLog::EventTick:
+updateAnimation(event.time * 0.001f);
+replayFrames++;
+glutPostRedisplay();
+glutTimerFunc(fastForward ? 0 : event.time, replayHandler, 0);
+return;
+case ReplayLog::EventKey:
+// Esc ended the recording; the end record follows
+if (event.code != 27)
 {
-resetObjectToStart();
+keyboard((unsigned char)event.code, event.x, event.y);
 }
 break;
+case ReplayLog::EventMouse:
+mouse(event.code, event.state, event.x, event.y);
+break;
+case ReplayLog::EventMotion:
+mouseMotionHandler(event.x, event.y);
+break;
+case ReplayLog::EventCheckpoint:
+if (replayDivergedTick < 0 && event.hash != hashSimulationState())
+{
+replayDivergedTick = replayLog->GetTickCount();
+std::fprintf(stderr, "Replay diverged before tick %d\n", replayDivergedTick);
 }
+break;
+case ReplayLog::EventEnd:
+finishReplay(replayDivergedTick < 0 && event.hash == hashSimulationState());
+return;
 }
 }
 
-void resetObjectToStart()
+if (replayLog->IsCorrupt())
+{
+std::fprintf(stderr, "Input log is damaged after tick %d\n", replayLog->GetTickCount());
+}
+else
 {
-movementPhase = MovementPhase::MoveAcross;
-objectPosX = pathLeftX;
-objectPosZ = pathZ;
-verticalVelocity = 0.0f;
-groundPauseTimer = 0.0f;
-objectPosY = getWaterSurfaceHeight(objectPosX, pathZ) + objectFloatOffset;
+std::fprintf(stderr, "Input log ends without an end record\n");
+}
+finishReplay(false);
 }
 
-float getWaterSurfaceHeight(float x, float z)
+// prints the run's figures; a fast-forward benchmark exits, a normal replay
+// hands the scene back to live input
+void finishReplay(bool matched)
 {
-float height = waterSurfaceY;
-if (waterState == WaterState::Wavy)
+float seconds = (glutGet(GLUT_ELAPSED_TIME) - replayStartTime) * 0.001f;
+std::printf("Replay: %d ticks, %d frames in %.2f s (%.2f ms/frame), state %s\n",
+replayLog->GetTickCount(), replayFrames, seconds,
+replayFrames > 0 ? seconds * 1000.0f / replayFrames : 0.0f,
+matched ? "matches the recording" : "DIFFERS from the recording");
+std::fflush(stdout);
+
+if (fastForward)
 {
-float xRatio = (x - waterLeftX) / (waterRightX - waterLeftX);
-float zRatio = (z - waterBackZ) / (waterFrontZ - waterBackZ);
-float primary = std::sin(primaryWaveFrequency * xRatio + wavePhase);
-float secondary = std::sin(secondaryWaveFrequency * zRatio + wavePhase * 0.6f);
-height += waveAmplitude * (0.7f * primary + 0.3f * secondary);
+std::exit(matched ? 0 : EXIT_FAILURE);
 }
-return height;
+
+delete replayLog;
+replayLog = NULL;
+animationTimerActive = false;
+wakeAnimation();
 }
 
-Vector3 getWaterNormal(float x, float z)
+// atexit: Esc and closing the window both leave through exit()
+void closeInputLog()
 {
-if (waterState == WaterState::Flat)
+if (!inputLog)
+return;
+int ticks = inputLog->GetTickCount();
+inputLog->Close(hashSimulationState());
+std::printf("Recorded %d ticks\n", ticks);
+delete inputLog;
+inputLog = NULL;
+}
+
+// atexit, like closeInputLog(); removes the segment's name
+void closeStateExport()
 {
-return Vector3(0.0f, 1.0f, 0.0f);
+if (!stateExport)
+return;
+stateExport->Close();
+delete stateExport;
+stateExport = NULL;
 }
 
-const float eps = 0.1f;
-float hL = getWaterSurfaceHeight(x - eps, z);
-float hR = getWaterSurfaceHeight(x + eps, z);
-float hB = getWaterSurfaceHeight(x, z - eps);
-float hF = getWaterSurfaceHeight(x, z + eps);
+int watchStateExport(const char *name)
+{
+StateExport reader;
+if (!reader.Attach(name))
+{
+std::fprintf(stderr, "No shared state segment %s\n", name);
+return EXIT_FAILURE;
+}
 
-Vector3 tangentX(2.0f * eps, hR - hL, 0.0f);
-Vector3 tangentZ(0.0f, hF - hB, 2.0f * eps);
-Vector3 normal = tangentZ.cross(tangentX);
-normal.normalize();
-return normal;
+bool seen = false;
+uint64_t lastTick = 0;
+int idlePolls = 0;
+for (;;)
+{
+StateExport::Snapshot snapshot;
+if (reader.Read(snapshot) && (!seen || snapshot.tick != lastTick))
+{
+std::printf("tick %llu  %u ms  phase %u  water %u  object %u  camera %u%s  target (%.2f, %.2f, %.2f)  wave %.3f  eye (%.2f, %.2f, %.2f)\n",
+(unsigned long long)snapshot.tick, snapshot.timeMs, snapshot.movementPhase, snapshot.waterState,
+snapshot.objectState, snapshot.cameraState, snapshot.paused ? "  paused" : "",
+snapshot.targetPosition[0], snapshot.targetPosition[1], snapshot.targetPosition[2], snapshot.wavePhase,
+snapshot.cameraEye[0], snapshot.cameraEye[1], snapshot.cameraEye[2]);
+std::fflush(stdout);
+seen = true;
+lastTick = snapshot.tick;
+idlePolls = 0;
+}
+else if (++idlePolls >= watchExportIdlePolls)
+{
+// the gallery stops ticking while nothing moves, so quiet alone
+// doesn't mean it left; a missing name does, and a new publisher
+// under the same name gets picked up
+idlePolls = 0;
+if (!reader.Attach(name))
+{
+std::printf("Shared state segment %s closed\n", name);
+return 0;
+}
+}
+std::this_thread::sleep_for(std::chrono::milliseconds(watchExportIntervalMs));
+}
 }
 
-void applyCameraPreset(CameraState state)
+// everything updateAnimation() and the input handlers touch
+unsigned long long hashSimulationState()
 {
-if (state == CameraState::Front)
+unsigned long long hash = gallery.Hash();
+if (waterSim)
 {
-cameraAzimuth = 0.0f;
-cameraElevation = 18.0f;
-cameraRadius = cameraTargetRadius = 34.0f;
+hash = ReplayLog::Hash(waterSim->GetHeights(), (size_t)waterSim->GetCellsX() * waterSim->GetCellsZ() * sizeof(float), hash);
 }
-else
+if (particles)
 {
-cameraAzimuth = -32.0f;
-cameraElevation = 24.0f;
-cameraRadius = cameraTargetRadius = 36.0f;
+int live = particles->GetLiveCount();
+hash = ReplayLog::Hash(&live, sizeof(live), hash);
+for (int a = 0; a < ParticleSystem::AttributeCount; ++a)
+{
+hash = ReplayLog::Hash(particles->GetArray((ParticleSystem::Attribute)a), (size_t)live * sizeof(float), hash);
+}
 }
+return hash;
 }
 
-void drawGround()
+int runHeadless(int sessionCount, int tickCount)
 {
-if (!groundMesh)
-return;
+if (sessionCount < 1 || tickCount < 1)
+{
+std::fprintf(stderr, "--headless needs a session count and a tick count above zero\n");
+return EXIT_FAILURE;
+}
 
-glPushMatrix();
-glDisable(GL_LIGHTING);
-glUseProgram(groundProgram);
-if (groundColorLocation >= 0)
+const float dt = animationIntervalMs * 0.001f;
+std::vector<GallerySession> sessions(sessionCount);
+// spread the targets along their cycle so the galleries don't run in lockstep
+for (int i = 0; i < sessionCount; ++i)
+{
+for (int t = i % 97; t > 0; --t)
 {
-glUniform3f(groundColorLocation, groundBaseColor.x, groundBaseColor.y, groundBaseColor.z);
+sessions[i].Update(dt);
 }
-groundMesh->DrawMeshVBO(meshSize);
-glUseProgram(0);
-glEnable(GL_LIGHTING);
-glPopMatrix();
 }
 
-void drawBooth()
+WorkerPool pool;
+HeadlessBatch batch = { &sessions[0], 0, dt };
+std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+for (int done = 0; done < tickCount; done += batch.ticks)
 {
-const GLfloat boothAmbient[] = { 0.22f, 0.22f, 0.25f, 1.0f };
-const GLfloat boothDiffuse[] = { 0.62f, 0.62f, 0.66f, 1.0f };
-const GLfloat boothSpecular[] = { 0.35f, 0.35f, 0.4f, 1.0f };
-const GLfloat trimAmbient[] = { 0.18f, 0.08f, 0.08f, 1.0f };
-const GLfloat trimDiffuse[] = { 0.7f, 0.25f, 0.25f, 1.0f };
-const GLfloat trimSpecular[] = { 0.3f, 0.2f, 0.2f, 1.0f };
-const GLfloat beamAmbient[] = { 0.12f, 0.12f, 0.14f, 1.0f };
-const GLfloat beamDiffuse[] = { 0.4f, 0.4f, 0.45f, 1.0f };
-const GLfloat beamSpecular[] = { 0.2f, 0.2f, 0.25f, 1.0f };
+batch.ticks = std::min(headlessBatchTicks, tickCount - done);
+pool.ParallelFor(sessionCount, headlessTask, &batch);
+}
+double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-setMaterial(boothAmbient, boothDiffuse, boothSpecular, 48.0f);
+// independent of the thread count, so runs can be compared
+unsigned long long hash = ReplayLog::Hash(NULL, 0);
+for (int i = 0; i < sessionCount; ++i)
+{
+hash = sessions[i].Hash(hash);
+}
 
-// floor platform
-glPushMatrix();
-glTranslatef(0.0f, 0.6f, 0.0f);
-glScalef(boothWidth, 1.2f, boothDepth);
-glutSolidCube(1.0f);
-glPopMatrix();
+double sessionTicks = (double)sessionCount * tickCount;
+std::printf("Headless: %d sessions x %d ticks on %d threads in %.3f s, %.0f session-ticks/s, state %016llx\n",
+sessionCount, tickCount, pool.GetThreadCount(), seconds, seconds > 0.0 ? sessionTicks / seconds : 0.0, hash);
+return 0;
+}
 
-// ceiling
-glPushMatrix();
-glTranslatef(0.0f, boothHeight - 0.6f, 0.0f);
-glScalef(boothWidth, 1.2f, boothDepth);
-glutSolidCube(1.0f);
-glPopMatrix();
+void headlessTask(void *context, int begin, int end, int worker)
+{
+const HeadlessBatch *batch = (const HeadlessBatch *)context;
+for (int i = begin; i < end; ++i)
+{
+GallerySession &session = batch->sessions[i];
+for (int t = 0; t < batch->ticks; ++t)
+{
+session.Update(batch->dt);
+}
+}
+}
 
-// side walls
-glPushMatrix();
-glTranslatef(-boothWidth * 0.5f + 0.4f, boothHeight * 0.5f, 0.0f);
-glScalef(0.8f, boothHeight - 1.2f, boothDepth);
-glutSolidCube(1.0f);
-glPopMatrix();
+int runCollisionBench(int targetCount, int tickCount)
+{
+if (targetCount < 1 || tickCount < 1)
+{
+std::fprintf(stderr, "--collision-bench needs a target count and a tick count above zero\n");
+return EXIT_FAILURE;
+}
 
-glPushMatrix();
-glTranslatef(boothWidth * 0.5f - 0.4f, boothHeight * 0.5f, 0.0f);
-glScalef(0.8f, boothHeight - 1.2f, boothDepth);
-glutSolidCube(1.0f);
-glPopMatrix();
+const float dt = animationIntervalMs * 0.001f;
+CollisionBench bench;
+bench.length = std::max(collisionFieldDepth, targetCount * collisionTargetArea / collisionFieldDepth);
+bench.seed = 12345u;
+const float halfLength = bench.length * 0.5f;
+const float halfDepth = collisionFieldDepth * 0.5f;
+CollisionWorld &world = bench.world;
+TargetPool &pool = bench.pool;
+
+// Booths go in before any target, so boxes hold body ids [0, boxCount)
+// and are never removed; targets, recycled ids included, sit above them.
+// Pairs come back with a < b and box-box pairs are skipped, so pair.b is
+// always a target and pair.a is a box only in a booth-target pair.
+buildStaticParts();
+int boothsAlong = std::max(1, (int)(bench.length / collisionBoothSpacing));
+int boothsAcross = std::max(1, (int)(collisionFieldDepth / collisionBoothSpacing));
+for (int bx = 0; bx < boothsAlong; ++bx)
+{
+for (int bz = 0; bz < boothsAcross; ++bz)
+{
+Vector3 offset((bx + 0.5f) * bench.length / boothsAlong - halfLength, 0.0f, (bz + 0.5f) * collisionFieldDepth / boothsAcross - halfDepth);
+for (size_t i = 0; i < staticParts.size(); ++i)
+{
+world.AddBox(staticParts[i].center + offset, staticParts[i].size * 0.5f);
+}
+}
+}
+const int boxCount = world.GetBodyCount();
 
-// back wall
-glPushMatrix();
-glTranslatef(0.0f, boothHeight * 0.5f, -boothDepth * 0.5f + 0.4f);
-glScalef(boothWidth - 0.8f, boothHeight - 1.2f, 0.8f);
-glutSolidCube(1.0f);
+// half the targets run along x and half cross them along z
+pool.Reserve(targetCount);
+for (int i = 0; i < targetCount; ++i)
+{
+spawnCollisionTarget(bench, i % 2 == 0);
+}
+std::vector<TargetPool::Handle> retiring;
+retiring.reserve(targetCount + collisionShotsPerTick);
+
+double collisionMs = 0.0;
+double worstMs = 0.0;
+double candidates = 0.0;
+double contacts = 0.0;
+int retired = 0;
+std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+for (int t = 0; t < tickCount; ++t)
+{
+retiring.clear();
+for (int i = 0; i < pool.GetCount(); ++i)
+{
+Target &target = pool.GetTarget(i);
+target.position += target.velocity * dt;
+if (std::fabs(target.position.x) > halfLength || std::fabs(target.position.z) > halfDepth)
+{
+retiring.push_back(pool.GetHandle(i));
+}
+else
+{
+world.SetCenter(target.body, target.position);
+}
+}
+// a shot can land on a target already leaving, or twice on one target;
+// the second retirement then meets a stale handle and does nothing
+for (int i = 0; i < collisionShotsPerTick && pool.GetCount() > 0; ++i)
+{
+bench.seed = bench.seed * 1664525u + 1013904223u;
+retiring.push_back(pool.GetHandle((bench.seed >> 8) % pool.GetCount()));
+}
+for (size_t i = 0; i < retiring.size(); ++i)
+{
+retired += replaceCollisionTarget(bench, retiring[i]) ? 1 : 0;
+}
+
+std::chrono::steady_clock::time_point collisionStart = std::chrono::steady_clock::now();
+world.Update();
+double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - collisionStart).count();
+collisionMs += ms;
+worstMs = std::max(worstMs, ms);
+candidates += world.GetCandidateCount();
+
+// only pairs still closing in turn around, so they can separate
+const std::vector<CollisionWorld::Pair> &pairs = world.GetPairs();
+contacts += pairs.size();
+for (size_t i = 0; i < pairs.size(); ++i)
+{
+const CollisionWorld::Pair &pair = pairs[i];
+Target *b = pool.Get(bench.bodyTargets[pair.b]);
+assert(b && pair.b >= boxCount);
+Vector3 offset = world.GetCenter(pair.b) - world.GetCenter(pair.a);
+if (world.IsBox(pair.a))
+{
+if (offset.dot(b->velocity) < 0.0f)
+{
+b->velocity = -b->velocity;
+}
+}
+else
+{
+Target *a = pool.Get(bench.bodyTargets[pair.a]);
+assert(a);
+if (offset.dot(b->velocity - a->velocity) < 0.0f)
+{
+a->velocity = -a->velocity;
+b->velocity = -b->velocity;
+}
+}
+}
+}
+double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+std::printf("Collision: %d targets and %d booth boxes x %d ticks, %.3f ms/tick in collision (worst %.3f) and %.3f ms in all of a %d ms tick, "
+"%.0f candidate and %.0f touching pairs per tick, %d targets replaced\n",
+targetCount, boxCount, tickCount, collisionMs / tickCount, worstMs, totalMs / tickCount, animationIntervalMs,
+candidates / tickCount, contacts / tickCount, retired);
+return 0;
+}
+
+// alongLane picks an x lane, otherwise a crossing z lane
+void spawnCollisionTarget(CollisionBench &bench, bool alongLane)
+{
+bench.seed = bench.seed * 1664525u + 1013904223u;
+unsigned int lane = bench.seed >> 8;
+bench.seed = bench.seed * 1664525u + 1013904223u;
+float along = (bench.seed >> 8) / 16777216.0f - 0.5f;
+float direction = (bench.seed & 1) ? collisionTargetSpeed : -collisionTargetSpeed;
+
+Target target;
+if (alongLane)
+{
+int lanes = (int)(collisionFieldDepth / collisionLaneSpacing);
+target.position = Vector3(along * bench.length, objectGroundRestY, (lane % lanes + 0.5f) * collisionLaneSpacing - collisionFieldDepth * 0.5f);
+target.velocity = Vector3(direction, 0.0f, 0.0f);
+}
+else
+{
+int lanes = std::max(1, (int)(bench.length / collisionLaneSpacing));
+target.position = Vector3((lane % lanes + 0.5f) * collisionLaneSpacing - bench.length * 0.5f, objectGroundRestY, along * collisionFieldDepth);
+target.velocity = Vector3(0.0f, 0.0f, direction);
+}
+target.body = bench.world.AddEllipsoid(target.position, duckRadii);
+if (target.body >= (int)bench.bodyTargets.size())
+{
+bench.bodyTargets.resize(target.body + 1);
+}
+bench.bodyTargets[target.body] = bench.pool.Spawn(target);
+}
+
+// false if the handle had already gone stale
+bool replaceCollisionTarget(CollisionBench &bench, TargetPool::Handle handle)
+{
+Target *target = bench.pool.Get(handle);
+if (!target)
+return false;
+
+bool alongLane = target->velocity.x != 0.0f;
+bench.world.RemoveBody(target->body);
+bench.pool.Despawn(handle);
+spawnCollisionTarget(bench, alongLane);
+return true;
+}
+
+int runMeshBench(int size)
+{
+if (size < groundTilesPerSide || size % groundTilesPerSide != 0)
+{
+std::fprintf(stderr, "--mesh-bench needs a size that is a multiple of %d\n", groundTilesPerSide);
+return EXIT_FAILURE;
+}
+
+Vector3 dir1v = Vector3(1.0f, 0.0f, 0.0f);
+Vector3 dir2v = Vector3(0.0f, 0.0f, -1.0f);
+QuadMesh rows(size, groundExtent);
+rows.InitMesh(size, groundOrigin, groundExtent, groundExtent, dir1v, dir2v);
+QuadMesh blocks(size, groundExtent);
+blocks.InitMesh(size, groundOrigin, groundExtent, groundExtent, dir1v, dir2v, QuadMesh::TriangleList, size / groundTilesPerSide);
+
+float rowsACMR = rows.GetACMR();
+float blocksACMR = blocks.GetACMR();
+float blocksATVR = blocks.GetATVR();
+std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+rows.OptimizeIndexOrder(size);
+blocks.OptimizeIndexOrder(size);
+double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+std::printf("Mesh: %d x %d grid, %d triangles, %d vertices, vertex cache ACMR in rows %.3f -> %.3f, "
+"in %d x %d blocks %.3f -> %.3f (ATVR %.3f -> %.3f), reordered in %.1f ms\n",
+size, size, blocks.GetTriangleCount(), blocks.GetVertexCount(), rowsACMR, rows.GetACMR(),
+size / groundTilesPerSide, size / groundTilesPerSide, blocksACMR, blocks.GetACMR(), blocksATVR, blocks.GetATVR(), ms);
+return 0;
+}
+
+// (re)starts the animation timer if it went idle
+void wakeAnimation()
+{
+if (animationTimerActive)
+return;
+
+animationTimerActive = true;
+// don't let the idle period show up as one huge time step
+lastFrameTime = glutGet(GLUT_ELAPSED_TIME);
+glutTimerFunc(animationIntervalMs, animationHandler, 0);
+}
+
+// marks the scene dirty after a state change made outside the animation tick
+void requestRedraw()
+{
+glutPostRedisplay();
+wakeAnimation();
+}
+
+// true while anything on screen can still change without input
+bool isSceneAnimating()
+{
+if (waterSim && !waterSim->IsAtRest())
+return true;
+if (particles && particles->GetLiveCount() > 0)
+return true;
+return gallery.IsAnimating();
+}
+
+void updateAnimation(float dt)
+{
+std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+if (waterSim)
+{
+waterSim->Advance(dt);
+}
+
+if (particles)
+{
+particles->Update(dt);
+}
+
+unsigned int events = gallery.Update(dt);
+Vector3 target = gallery.GetObjectPosition();
+if (events & GallerySession::SplashEvent)
+{
+if (waterSim)
+{
+waterSim->AddImpulse(target.x, pathZ, splashRadius, splashDepth);
+}
+if (particles)
+{
+particles->Emit(Vector3(target.x, waterSurfaceY, pathZ), Vector3(0.0f, 3.5f, 0.0f), 1.8f, splashParticles, 1.2f, 0.0f);
+}
+}
+// no shooting yet, so the landing stands in for a hit
+if ((events & GallerySession::LandingEvent) && particles)
+{
+particles->Emit(target, Vector3(0.0f, 4.0f, 0.0f), 2.5f, debrisParticles, 1.5f, 1.0f);
+}
+
+if (stateExport)
+{
+publishState();
+}
+PerfCounters::AddSimulationTime(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+void publishState()
+{
+StateExport::Snapshot snapshot;
+std::memset(&snapshot, 0, sizeof(snapshot));
+snapshot.tick = exportedTicks++;
+snapshot.timeMs = (uint32_t)glutGet(GLUT_ELAPSED_TIME);
+snapshot.movementPhase = (uint32_t)gallery.GetMovementPhase();
+snapshot.waterState = (uint32_t)gallery.GetWaterState();
+snapshot.objectState = (uint32_t)gallery.GetObjectState();
+snapshot.cameraState = (uint32_t)gallery.GetCameraState();
+snapshot.paused = gallery.IsPaused() ? 1 : 0;
+Vector3 target = gallery.GetObjectPosition();
+snapshot.targetPosition[0] = target.x;
+snapshot.targetPosition[1] = target.y;
+snapshot.targetPosition[2] = target.z;
+snapshot.wavePhase = gallery.GetWavePhase();
+Vector3 eye = gallery.GetCameraEye();
+snapshot.cameraEye[0] = eye.x;
+snapshot.cameraEye[1] = eye.y;
+snapshot.cameraEye[2] = eye.z;
+stateExport->Publish(snapshot);
+}
+
+void updateShadowMaps()
+{
+GLfloat *lightPositions[2] = { light_position0, light_position1 };
+for (int i = 0; i < 2; ++i)
+{
+ShadowMap *map = shadowMaps[i];
+if (!map)
+continue;
+
+// a moved light invalidates the cached static depth
+map->SetLight(lightPositions[i], shadowTarget, shadowFieldOfView, shadowNearPlane, shadowFarPlane);
+
+if (!map->IsStaticValid())
+{
+map->BeginStaticPass();
+drawStaticShadowCasters();
+map->EndStaticPass();
+}
+
+map->BeginDynamicPass();
+drawDynamicShadowCasters();
+map->EndDynamicPass();
+}
+}
+
+void drawStaticShadowCasters()
+{
+drawStaticScene();
+}
+
+void drawDynamicShadowCasters()
+{
+drawActiveTarget();
+}
+
+// must be called whenever booth, water volume or rail geometry changes
+void invalidateStaticShadows()
+{
+for (int i = 0; i < 2; ++i)
+{
+if (shadowMaps[i])
+shadowMaps[i]->Invalidate();
+}
+}
+
+void initOcclusionCulling()
+{
+occlusionCuller = new OcclusionCuller();
+if (!occlusionCuller->Init())
+{
+std::fprintf(stderr, "Occlusion culling unavailable\n");
+delete occlusionCuller;
+occlusionCuller = NULL;
+return;
+}
+
+for (int i = 0; i < groundTilesPerSide * groundTilesPerSide; ++i)
+{
+groundTileQueries[i] = occlusionCuller->Register();
+}
+targetQuery = occlusionCuller->Register();
+}
+
+// results are consumed next frame, so this never waits on the GPU
+void issueOcclusionQueries(const Vector3 &eye)
+{
+if (!occlusionCuller || !occlusionCuller->IsEnabled())
+return;
+
+Vector3 boxMin, boxMax;
+occlusionCuller->BeginQueries(eye);
+for (int tz = 0; tz < groundTilesPerSide; ++tz)
+{
+for (int tx = 0; tx < groundTilesPerSide; ++tx)
+{
+getGroundTileBounds(tx, tz, boxMin, boxMax);
+occlusionCuller->Query(groundTileQueries[tz * groundTilesPerSide + tx], boxMin, boxMax);
+}
+}
+getTargetBounds(boxMin, boxMax);
+occlusionCuller->Query(targetQuery, boxMin, boxMax);
+occlusionCuller->EndQueries();
+}
+
+// quads [first, last) of the ground mesh along one axis belonging to a tile
+void getGroundTileRange(int tile, int &first, int &last)
+{
+first = tile * meshSize / groundTilesPerSide;
+last = (tile + 1) * meshSize / groundTilesPerSide;
+}
+
+// mesh columns run along +x from the origin, rows along -z
+void getGroundTileBounds(int tileX, int tileZ, Vector3 &boxMin, Vector3 &boxMax)
+{
+int col0, col1, row0, row1;
+getGroundTileRange(tileX, col0, col1);
+getGroundTileRange(tileZ, row0, row1);
+float step = groundExtent / meshSize;
+boxMin.set(groundOrigin.x + col0 * step, groundOrigin.y - 0.05f, groundOrigin.z - row1 * step);
+boxMax.set(groundOrigin.x + col1 * step, groundOrigin.y + 0.05f, groundOrigin.z - row0 * step);
+}
+
+// loose box around the duck or the standalone target
+void getTargetBounds(Vector3 &boxMin, Vector3 &boxMax)
+{
+Vector3 target = getTargetPosition();
+boxMin.set(target.x - 1.3f, target.y - 1.2f, target.z - 1.6f);
+boxMax.set(target.x + 1.3f, target.y + 1.8f, target.z + 1.8f);
+}
+
+void initSimulation()
+{
+workerPool = new WorkerPool();
+waterSim = new WaterSim(waterSimCellsX, waterSimCellsZ, waterLeftX, waterBackZ, waterWidth, waterDepth, waterSimStepHz);
+waterSim->SetWorkerPool(workerPool);
+
+particles = new ParticleSystem(particleCapacity);
+particles->SetWorkerPool(workerPool);
+particles->SetFloor(0.0f);
+
+gallery.SetRipples(waterSim);
+}
+
+void initRenderQueue()
+{
+renderQueue = new RenderQueue();
+renderQueue->Init();
+groundRenderState = renderQueue->AddState(beginGroundState, endGroundState);
+depthOnlyProgram = buildDepthOnlyProgram(NULL);
+}
+
+// Occlusion results come from earlier frames, so hidden items are simply
+// not submitted; every item carries the views whose frustum it touches.
+// Sort keys use the centre of each item's bounds.
+void submitScene()
+{
+recordJobCount = 0;
+bool indirect = useIndirectDrawing();
+// the procedural grid has nothing in the arena and draws per tile
+bool groundIndirect = indirect && !useProceduralGround();
+bool groundBatched = groundIndirect || useTessellation();
+bool broadcast = useViewBroadcast();
+
+int slot;
+if (indirect)
+{
+slot = addRecordJob(recordArenaStatic, 0);
+renderQueue->Submit(RenderQueue::Occluders, boothCenter, -1, replayArenaStatic, replayArenaDepth, slot,
+broadcast ? RenderQueue::Broadcast : RenderQueue::AllViews);
+}
+else
+{
+slot = addRecordJob(recordStaticSceneItem, 0);
+renderQueue->Submit(RenderQueue::Occluders, boothCenter, -1,
+replayRecordedItem, depthOnlyProgram ? drawStaticSceneDepth : NULL, slot);
+}
+
+if (groundMesh)
+{
+groundTilesDrawn = 0;
+batchedGroundTileCount = 0;
+Vector3 boxMin, boxMax;
+for (int tz = 0; tz < groundTilesPerSide; ++tz)
+{
+for (int tx = 0; tx < groundTilesPerSide; ++tx)
+{
+int tile = tz * groundTilesPerSide + tx;
+getGroundTileBounds(tx, tz, boxMin, boxMax);
+groundTileViews[tile] = cullViews(boxMin, boxMax, groundTileQueries[tile]);
+if (!groundTileViews[tile])
+continue;
+
+groundTilesDrawn++;
+if (groundBatched)
+{
+batchedGroundTiles[batchedGroundTileCount++] = tile;
+continue;
+}
+
+slot = addRecordJob(recordGroundTile, tile);
+renderQueue->Submit(RenderQueue::Opaque, (boxMin + boxMax) * 0.5f, groundRenderState,
+replayRecordedItem, depthOnlyProgram ? replayRecordedDepth : NULL, slot, groundTileViews[tile]);
+}
+}
+
+// one item for all visible tiles; the tiles keep their near-to-far order
+// inside the multi-draw
+if (batchedGroundTileCount > 0)
+{
+Vector3 eye = gallery.GetCameraEye();
+float tileDistance[groundTilesPerSide * groundTilesPerSide];
+unsigned int groundViews = 0;
+for (int i = 0; i < batchedGroundTileCount; ++i)
+{
+int tile = batchedGroundTiles[i];
+getGroundTileBounds(tile % groundTilesPerSide, tile / groundTilesPerSide, boxMin, boxMax);
+Vector3 d = (boxMin + boxMax) * 0.5f - eye;
+tileDistance[tile] = d.x * d.x + d.y * d.y + d.z * d.z;
+groundViews |= groundTileViews[tile];
+}
+std::sort(batchedGroundTiles, batchedGroundTiles + batchedGroundTileCount,
+[&tileDistance](int a, int b) { return tileDistance[a] < tileDistance[b]; });
+
+Vector3 groundCenter = groundOrigin + Vector3(0.5f * groundExtent, 0.0f, -0.5f * groundExtent);
+if (useTessellation())
+{
+// patches are generated on the GPU, so there's no depth-only version
+renderQueue->Submit(RenderQueue::Opaque, groundCenter, groundRenderState, drawTessellatedGroundItem, NULL, 0, groundViews);
+}
+else
+{
+// broadcast draws carry each tile's own view mask
+slot = addRecordJob(recordArenaGround, 0);
+renderQueue->Submit(RenderQueue::Opaque, groundCenter, groundRenderState, replayRecordedItem, replayArenaDepth, slot,
+broadcast ? RenderQueue::Broadcast : groundViews);
+}
+}
+}
+
+// waves and ripples stay within a metre or so of the rest level
+Vector3 waterMin(waterLeftX, waterBottomY, waterBackZ);
+Vector3 waterMax(waterRightX, waterSurfaceY + GallerySession::waveAmplitude + 1.0f, waterFrontZ);
+unsigned int waterViews = cullViews(waterMin, waterMax, -1);
+if (useTessellation())
+{
+renderQueue->Submit(RenderQueue::Opaque, Vector3(0.0f, waterSurfaceY, waterCenterZ), -1, drawTessellatedWaterItem, NULL, 0, waterViews);
+}
+else if (waterViews)
+{
+slot = addRecordJob(recordWaterItem, 0);
+renderQueue->Submit(RenderQueue::Opaque, Vector3(0.0f, waterSurfaceY, waterCenterZ), -1, replayRecordedItem, NULL, slot, waterViews);
+}
+
+if (particleProgram && particles->GetLiveCount() > 0)
+{
+renderQueue->Submit(RenderQueue::Opaque, Vector3(0.0f, waterSurfaceY, waterCenterZ), -1, drawParticlesItem, NULL, 0);
+}
+
+Vector3 targetMin, targetMax;
+getTargetBounds(targetMin, targetMax);
+unsigned int targetViews = cullViews(targetMin, targetMax, targetQuery);
+if (targetViews)
+{
+slot = addRecordJob(recordActiveTargetItem, 0);
+renderQueue->Submit(RenderQueue::Opaque, getTargetPosition(), -1,
+replayRecordedItem, replayRecordedItem, slot, targetViews);
+}
+}
+
+// shows the render statistics in the title bar about once a second
+void updateStatsTitle()
+{
+int now = glutGet(GLUT_ELAPSED_TIME);
+if (now - lastStatsTime < 1000)
+return;
+lastStatsTime = now;
+
+PostProcess::Mode antiAliasing = postProcess ? postProcess->GetMode() : PostProcess::Off;
+char title[256];
+std::snprintf(title, sizeof(title), "Shooting Gallery - overdraw %.2fx, %d draws, %d/%d ground tiles (%d tris), record %.2f ms on %d threads, %llu operator new/frame, arena %u KB%s%s%s%s%s",
+renderQueue->GetOverdraw(), renderQueue->GetItemsDrawn(),
+groundTilesDrawn, groundTilesPerSide * groundTilesPerSide, (useProceduralGround() ? groundGrid : groundMesh)->GetTriangleCount(),
+recordTimeMs, parallelRecording ? workerPool->GetThreadCount() : 1,
+peakFrameAllocations, (unsigned int)(FrameArena::Current().GetHighWater() / 1024),
+renderQueue->IsDepthPrepass() ? ", depth pre-pass" : "",
+useTessellation() ? ", tessellated" : useProceduralGround() ? ", vertex pulling" : useIndirectDrawing() ? ", indirect" : "",
+multiView->GetViewCount() == 1 ? "" : useViewBroadcast() ? ", split screen broadcast" : ", split screen",
+antiAliasing == PostProcess::Off ? "" : ", ", antiAliasing == PostProcess::Off ? "" : PostProcess::GetModeName(antiAliasing));
+glutSetWindowTitle(title);
+peakFrameAllocations = 0;
+}
+
+void drawHud()
+{
+if (!hudVisible)
+return;
+
+if (!hudList)
+{
+hudList = glGenLists(1);
+}
+int now = glutGet(GLUT_ELAPSED_TIME);
+if (now - lastHudTime >= hudRefreshMs)
+{
+lastHudTime = now;
+char text[1024];
+int length = PerfCounters::Format(text, sizeof(text));
+if (postProcess && length + 1 < (int)sizeof(text))
+{
+text[length++] = '\n';
+postProcess->Format(text + length, sizeof(text) - length);
+}
+glNewList(hudList, GL_COMPILE);
+int line = 0;
+for (char *start = text; *start; ++line)
+{
+char *end = std::strchr(start, '\n');
+if (end)
+{
+*end = '\0';
+}
+glRasterPos2i(hudMargin, hudMargin + hudLineHeight * (line + 1));
+glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char *)start);
+start = end ? end + 1 : start + std::strlen(start);
+}
+glEndList();
+}
+
+// window pixels, origin top left
+glMatrixMode(GL_PROJECTION);
+glPushMatrix();
+glLoadIdentity();
+gluOrtho2D(0.0, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT), 0.0);
+glMatrixMode(GL_MODELVIEW);
+glPushMatrix();
+glLoadIdentity();
+glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+glDisable(GL_LIGHTING);
+glDisable(GL_DEPTH_TEST);
+glDisable(GL_TEXTURE_2D);
+glColor3f(1.0f, 1.0f, 0.6f);
+glCallList(hudList);
+glPopAttrib();
+glPopMatrix();
+glMatrixMode(GL_PROJECTION);
 glPopMatrix();
+glMatrixMode(GL_MODELVIEW);
+}
+
+// MSAA renders the scene at full resolution into its own multisampled
+// target, which a scaled blit can't write to, so dynamic resolution sits out
+bool useDynamicResolution()
+{
+return dynamicResolution && !(postProcess && postProcess->GetMode() == PostProcess::Msaa);
+}
+
+void beginGroundState()
+{
+PerfCounters::Add(PerfCounters::ProgramBinds);
+const GroundShader &shader = useTessellation() ? tessGroundShader :
+useProceduralGround() ? proceduralGroundShader :
+useViewBroadcast() ? broadcastGroundShader :
+useIndirectDrawing() ? arenaGroundShader : groundShader;
+glDisable(GL_LIGHTING);
+glUseProgram(shader.program);
+if (shader.colorLocation >= 0)
+{
+glUniform3f(shader.colorLocation, groundBaseColor.x, groundBaseColor.y, groundBaseColor.z);
+}
+if (shader.shadowStrengthLocation >= 0)
+{
+glUniform1f(shader.shadowStrengthLocation, shadowsEnabled ? shadowStrength : 0.0f);
+}
+for (int i = 0; i < 2; ++i)
+{
+glActiveTexture(GL_TEXTURE1 + i);
+glBindTexture(GL_TEXTURE_2D, shadowMaps[i] ? shadowMaps[i]->GetDepthTexture() : 0);
+if (shader.shadowMapLocation[i] >= 0)
+{
+glUniform1i(shader.shadowMapLocation[i], 1 + i);
+}
+if (shader.shadowMatrixLocation[i] >= 0 && shadowMaps[i])
+{
+glUniformMatrix4fv(shader.shadowMatrixLocation[i], 1, GL_FALSE, shadowMaps[i]->GetShadowMatrix());
+}
+}
+glActiveTexture(GL_TEXTURE0);
+}
+
+void endGroundState()
+{
+for (int i = 0; i < 2; ++i)
+{
+glActiveTexture(GL_TEXTURE1 + i);
+glBindTexture(GL_TEXTURE_2D, 0);
+}
+glActiveTexture(GL_TEXTURE0);
+glUseProgram(0);
+PerfCounters::Add(PerfCounters::ProgramBinds);
+glEnable(GL_LIGHTING);
+}
+
+int addRecordJob(RecordFunc record, int param)
+{
+int slot = recordJobCount++;
+recordJobs[slot].record = record;
+recordJobs[slot].param = param;
+return slot;
+}
+
+void recordTask(void *context, int begin, int end, int worker)
+{
+for (int i = begin; i < end; ++i)
+{
+recordedCommands[i].Reset();
+recordJobs[i].record(recordedCommands[i], recordJobs[i].param);
+}
+}
+
+// records every partition submitted this frame, spread over the worker pool
+void recordCommands()
+{
+std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+// buffer uploads can't be recorded, do them here on the GL thread
+if (staticBatch)
+{
+staticBatch->UploadInstances();
+}
+
+if (parallelRecording && workerPool)
+{
+workerPool->ParallelFor(recordJobCount, recordTask, NULL);
+}
+else
+{
+recordTask(NULL, 0, recordJobCount, 0);
+}
+
+recordTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void replayRecordedItem(int slot)
+{
+recordedCommands[slot].Replay();
+}
+
+// ground tiles record no program, so the depth pass only swaps it in
+void replayRecordedDepth(int slot)
+{
+glUseProgram(useProceduralGround() ? proceduralDepthProgram : depthOnlyProgram);
+recordedCommands[slot].Replay();
+glUseProgram(0);
+PerfCounters::Add(PerfCounters::ProgramBinds, 2);
+}
+
+void recordGroundTile(CommandBuffer &commands, int tile)
+{
+int col0, col1, row0, row1;
+getGroundTileRange(tile % groundTilesPerSide, col0, col1);
+getGroundTileRange(tile / groundTilesPerSide, row0, row1);
+(useProceduralGround() ? groundGrid : groundMesh)->RecordMeshVBORegion(commands, meshSize, row0, row1, col0, col1);
+}
+
+void recordStaticSceneItem(CommandBuffer &commands, int param)
+{
+if (staticBatch)
+{
+staticBatch->Record(commands, staticBatchProgram);
+}
+else
+{
+commands.Call(drawStaticPartsCommand);
+}
+}
+
+void initGroundShader(GroundShader &shader, GLuint program)
+{
+shader.program = program;
+shader.colorLocation = glGetUniformLocation(program, "uBaseColor");
+shader.shadowMatrixLocation[0] = glGetUniformLocation(program, "uShadowMatrix0");
+shader.shadowMatrixLocation[1] = glGetUniformLocation(program, "uShadowMatrix1");
+shader.shadowMapLocation[0] = glGetUniformLocation(program, "uShadowMap0");
+shader.shadowMapLocation[1] = glGetUniformLocation(program, "uShadowMap1");
+shader.shadowStrengthLocation = glGetUniformLocation(program, "uShadowStrength");
+}
+
+// needs the ground mesh and the static batch; without either (or without
+// multi-draw indirect) everything keeps the per-partition draws
+void initGeometryArena()
+{
+if (!groundMesh || !staticBatch)
+return;
+
+geometryArena = new GeometryArena(arenaVertexCapacity, arenaIndexCapacity, arenaMaxDraws);
+bool ok = geometryArena->Init();
+if (ok)
+{
+initGroundShader(arenaGroundShader, buildGroundProgram(geometryArena));
+arenaStaticProgram = buildStaticBatchProgram(geometryArena);
+arenaDepthProgram = buildDepthOnlyProgram(geometryArena);
+ok = arenaGroundShader.program && arenaStaticProgram && arenaDepthProgram &&
+groundMesh->AddToArena(*geometryArena) && staticBatch->AddToArena(*geometryArena);
+}
+if (!ok)
+{
+std::fprintf(stderr, "Multi-draw indirect unavailable, drawing meshes separately\n");
+glDeleteProgram(arenaGroundShader.program);
+glDeleteProgram(arenaStaticProgram);
+glDeleteProgram(arenaDepthProgram);
+arenaGroundShader.program = 0;
+arenaStaticProgram = 0;
+arenaDepthProgram = 0;
+groundMesh->RemoveFromArena();
+staticBatch->RemoveFromArena();
+delete geometryArena;
+geometryArena = NULL;
+return;
+}
+
+geometryArena->SetupProgram(arenaGroundShader.program);
+geometryArena->SetupProgram(arenaStaticProgram);
+geometryArena->SetupProgram(arenaDepthProgram);
+staticBatch->BindMaterials(arenaStaticProgram);
+
+// split screen still works without these, replaying the arena per view
+if (!MultiView::IsBroadcastSupported())
+return;
+GLuint groundProgram = buildGroundProgram(geometryArena, false, true);
+broadcastStaticProgram = buildStaticBatchProgram(geometryArena, true);
+broadcastDepthProgram = buildDepthOnlyProgram(geometryArena, false, true);
+if (!groundProgram || !broadcastStaticProgram || !broadcastDepthProgram)
+{
+std::fprintf(stderr, "Viewport broadcast shaders unavailable, views drawn one at a time\n");
+glDeleteProgram(groundProgram);
+glDeleteProgram(broadcastStaticProgram);
+glDeleteProgram(broadcastDepthProgram);
+broadcastStaticProgram = 0;
+broadcastDepthProgram = 0;
+return;
+}
+initGroundShader(broadcastGroundShader, groundProgram);
+geometryArena->SetupProgram(broadcastGroundShader.program);
+geometryArena->SetupProgram(broadcastStaticProgram);
+geometryArena->SetupProgram(broadcastDepthProgram);
+staticBatch->BindMaterials(broadcastStaticProgram);
+}
+
+bool useIndirectDrawing()
+{
+return geometryArena && indirectDrawing;
+}
+
+// Places the views in the current frame and captures their cameras; ends
+// with the player's view set up.
+void setupViews(const Vector3 &eye)
+{
+multiView->SetViewCount(splitScreen ? splitViewCount : 1);
+if (splitScreen)
+{
+multiView->SetRect(0, 0.0f, 0.0f, 2.0f / 3.0f, 1.0f);
+multiView->SetRect(1, 2.0f / 3.0f, 0.5f, 1.0f / 3.0f, 0.5f);
+multiView->SetRect(2, 2.0f / 3.0f, 0.0f, 1.0f / 3.0f, 0.5f);
+}
+else
+{
+multiView->SetRect(0, 0.0f, 0.0f, 1.0f, 1.0f);
+}
+multiView->BeginFrame();
+
+for (int v = 0; v < multiView->GetViewCount(); ++v)
+{
+float aspect = multiView->GetAspect(v);
+glMatrixMode(GL_PROJECTION);
+glLoadIdentity();
+if (v == 2)
+{
+glOrtho(-operatorHalfHeight * aspect, operatorHalfHeight * aspect, -operatorHalfHeight, operatorHalfHeight, 1.0, 120.0);
+}
+else
+{
+gluPerspective(v == 0 ? 60.0 : 45.0, aspect, 0.2, 200.0);
+}
+glMatrixMode(GL_MODELVIEW);
+glLoadIdentity();
+if (v == 0)
+{
+gluLookAt(eye.x, eye.y, eye.z, cameraLookAt.x, cameraLookAt.y, cameraLookAt.z, 0.0f, 1.0f, 0.0f);
+}
+else if (v == 1)
+{
+gluLookAt(spectatorEye.x, spectatorEye.y, spectatorEye.z, cameraLookAt.x, cameraLookAt.y, cameraLookAt.z, 0.0f, 1.0f, 0.0f);
+}
+else
+{
+gluLookAt(0.0f, 60.0f, waterCenterZ, 0.0f, 0.0f, waterCenterZ, 0.0f, 0.0f, -1.0f);
+}
+multiView->CaptureCamera(v);
+}
+
+renderQueue->SetViews(multiView->GetViewCount(), beginViewPass);
+if (useViewBroadcast())
+{
+multiView->SetUniforms(broadcastGroundShader.program);
+multiView->SetUniforms(broadcastStaticProgram);
+multiView->SetUniforms(broadcastDepthProgram);
+}
+beginViewPass(0);
+}
+
+// render queue view callback; -1 sets up every viewport for broadcasting
+void beginViewPass(int view)
+{
+if (view < 0)
+{
+multiView->BeginBroadcast();
+}
+else
+{
+multiView->BeginView(view);
+}
+// lights are stored in eye space, so every view needs its own
+glLightfv(GL_LIGHT0, GL_POSITION, light_position0);
+glLightfv(GL_LIGHT1, GL_POSITION, light_position1);
+}
+
+bool useViewBroadcast()
+{
+return broadcastStaticProgram && useIndirectDrawing() && multiView->GetViewCount() > 1;
+}
+
+// views whose frustum the box touches; the occlusion query only speaks for
+// the player's view
+unsigned int cullViews(const Vector3 &boxMin, const Vector3 &boxMax, int query)
+{
+unsigned int views = multiView->CullBox(boxMin, boxMax);
+if (occlusionCuller && query >= 0 && !occlusionCuller->IsVisible(query))
+{
+views &= ~1u;
+}
+return views;
+}
+
+// needs gl_VertexID and texelFetch (GLSL 1.30)
+void initProceduralGround()
+{
+if (!GLEW_VERSION_3_0)
+return;
+
+GLuint program = buildGroundProgram(NULL, true);
+proceduralDepthProgram = buildDepthOnlyProgram(NULL, true);
+if (!program || !proceduralDepthProgram)
+{
+std::fprintf(stderr, "Procedural ground shaders unavailable\n");
+return;
+}
+initGroundShader(proceduralGroundShader, program);
+
+// no CPU-side grid either, so the mesh's own size limit doesn't matter
+groundGrid = new QuadMesh(1, groundExtent);
+groundGrid->InitProceduralMesh(meshSize, groundOrigin, groundExtent, groundExtent, Vector3(1.0f, 0.0f, 0.0f), Vector3(0.0f, 0.0f, -1.0f));
+groundGrid->CreateMeshVBO(meshSize, 0, 1);
+groundGrid->SetupProceduralProgram(proceduralGroundShader.program);
+groundGrid->SetupProceduralProgram(proceduralDepthProgram);
+}
+
+bool useProceduralGround()
+{
+return groundGrid && proceduralGround;
+}
+
+// needs tessellation shaders (GL 4.0); the CPU-built ground and water stay
+// as they are and 't' switches between the two
+void initTessellation()
+{
+if (!TessellatedSurface::IsSupported())
+return;
+
+GLuint groundProgram = buildTessellatedGroundProgram();
+tessWaterProgram = buildTessellatedWaterProgram();
+if (!groundProgram || !tessWaterProgram)
+{
+std::fprintf(stderr, "Tessellation shaders unavailable\n");
+return;
+}
+initGroundShader(tessGroundShader, groundProgram);
+
+// negative z sizes number the patches like the ground tiles, along dir2
+groundSurface = new TessellatedSurface(groundOrigin.x, groundOrigin.z, groundExtent, -groundExtent,
+groundTilesPerSide, groundTilesPerSide, groundOrigin.y);
+waterSurface = new TessellatedSurface(waterLeftX, waterFrontZ, waterWidth, -waterDepth,
+waterPatchesX, waterPatchesZ, waterSurfaceY);
+groundSurface->SetDetail(tessPixelsPerSegment, tessMaxLevel);
+waterSurface->SetDetail(tessPixelsPerSegment, tessMaxLevel);
+if (!groundSurface->Init() || !waterSurface->Init())
+{
+std::fprintf(stderr, "Tessellated surfaces unavailable\n");
+delete groundSurface;
+delete waterSurface;
+groundSurface = NULL;
+waterSurface = NULL;
+return;
+}
+
+if (waterSim)
+{
+glGenTextures(1, &waterRippleTexture);
+glBindTexture(GL_TEXTURE_2D, waterRippleTexture);
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, waterSim->GetCellsX(), waterSim->GetCellsZ(), 0, GL_RED, GL_FLOAT, waterSim->GetHeights());
+glBindTexture(GL_TEXTURE_2D, 0);
+}
+}
+
+bool useTessellation()
+{
+return groundSurface && tessellation;
+}
+
+void drawTessellatedGroundItem(int param)
+{
+groundSurface->Draw(tessGroundShader.program, batchedGroundTiles, batchedGroundTileCount);
+}
+
+// the surface keeps the last ripples it was given, so one more upload
+// after the simulation settles leaves it matching the CPU heights
+void uploadWaterRipples()
+{
+if (!waterRippleTexture)
+return;
+
+bool active = !waterSim->IsAtRest();
+if (!active && !waterRippleTextureLive)
+return;
+
+glBindTexture(GL_TEXTURE_2D, waterRippleTexture);
+glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, waterSim->GetCellsX(), waterSim->GetCellsZ(), GL_RED, GL_FLOAT, waterSim->GetHeights());
+PerfCounters::Add(PerfCounters::UploadBytes, (unsigned long long)waterSim->GetCellsX() * waterSim->GetCellsZ() * sizeof(float));
+glBindTexture(GL_TEXTURE_2D, 0);
+waterRippleTextureLive = active;
+}
+
+void drawTessellatedWaterItem(int param)
+{
+uploadWaterRipples();
+setMaterial(staticMaterials[WaterMaterial]);
+
+glUseProgram(tessWaterProgram);
+glUniform1f(glGetUniformLocation(tessWaterProgram, "uWaveAmplitude"), gallery.GetWaterState() == WaterState::Wavy ? GallerySession::waveAmplitude : 0.0f);
+glUniform1f(glGetUniformLocation(tessWaterProgram, "uWavePhase"), gallery.GetWavePhase());
+glUniform2f(glGetUniformLocation(tessWaterProgram, "uWaveFrequency"), GallerySession::primaryWaveFrequency, GallerySession::secondaryWaveFrequency);
+glUniform4f(glGetUniformLocation(tessWaterProgram, "uWaterRect"), waterLeftX, waterBackZ, waterWidth, waterDepth);
+glUniform1f(glGetUniformLocation(tessWaterProgram, "uRippleScale"), waterRippleTexture ? 1.0f : 0.0f);
+glUniform2f(glGetUniformLocation(tessWaterProgram, "uRippleCells"),
+waterSim ? (GLfloat)waterSim->GetCellsX() : 1.0f, waterSim ? (GLfloat)waterSim->GetCellsZ() : 1.0f);
+glUniform1i(glGetUniformLocation(tessWaterProgram, "uRipples"), waterRippleTextureUnit - GL_TEXTURE0);
+glActiveTexture(waterRippleTextureUnit);
+glBindTexture(GL_TEXTURE_2D, waterRippleTexture);
+
+waterSurface->Draw(tessWaterProgram, NULL, 0);
+
+glBindTexture(GL_TEXTURE_2D, 0);
+glActiveTexture(GL_TEXTURE0);
+glUseProgram(0);
+PerfCounters::Add(PerfCounters::ProgramBinds, 2);
+}
+
+// the arena items record no program: the ground state or the replay
+// callbacks below pick it
+void recordArenaGround(CommandBuffer &commands, int param)
+{
+GeometryArena::DrawList list;
+for (int i = 0; i < batchedGroundTileCount; ++i)
+{
+int tile = batchedGroundTiles[i];
+int col0, col1, row0, row1;
+getGroundTileRange(tile % groundTilesPerSide, col0, col1);
+getGroundTileRange(tile / groundTilesPerSide, row0, row1);
+groundMesh->AddArenaRegion(list, meshSize, row0, row1, col0, col1, 0.0f,
+useViewBroadcast() ? groundTileViews[tile] : 1u);
+}
+geometryArena->Record(commands, list);
+}
+
+void recordArenaStatic(CommandBuffer &commands, int param)
+{
+GeometryArena::DrawList list;
+staticBatch->AddArenaDraws(list, useViewBroadcast() ? multiView->GetAllViews() : 1u);
+geometryArena->Record(commands, list);
+}
+
+void replayArenaStatic(int slot)
+{
+glUseProgram(useViewBroadcast() ? broadcastStaticProgram : arenaStaticProgram);
+recordedCommands[slot].Replay();
+glUseProgram(0);
+PerfCounters::Add(PerfCounters::ProgramBinds, 2);
+}
+
+void replayArenaDepth(int slot)
+{
+glUseProgram(useViewBroadcast() ? broadcastDepthProgram : arenaDepthProgram);
+recordedCommands[slot].Replay();
+glUseProgram(0);
+PerfCounters::Add(PerfCounters::ProgramBinds, 2);
+}
+
+void drawStaticSceneDepth(int param)
+{
+if (staticBatch)
+{
+staticBatch->Draw(depthOnlyProgram);
+}
+else
+{
+drawStaticPartsImmediate();
+}
+}
+
+void recordWaterItem(CommandBuffer &commands, int param)
+{
+recordWater(commands);
+}
+
+void recordActiveTargetItem(CommandBuffer &commands, int param)
+{
+recordActiveTarget(commands);
+}
+
+void drawParticlesItem(int param)
+{
+particles->Draw(particleProgram);
+}
 
+// fills the rest of the pool with splashes spread along the water
+void emitParticleBurst()
+{
+const int bursts = 256;
+int perBurst = (particles->GetCapacity() - particles->GetLiveCount()) / bursts;
+for (int i = 0; i < bursts; ++i)
+{
+float x = waterLeftX + waterWidth * (i + 0.5f) / bursts;
+float z = waterBackZ + waterDepth * ((i * 37) % bursts + 0.5f) / bursts;
+particles->Emit(Vector3(x, waterSurfaceY, z), Vector3(0.0f, 4.0f, 0.0f), 2.0f, perBurst, 1.5f, (float)(i & 1));
+}
+}
+
+void buildStaticParts()
+{
+const StaticPart parts[] =
+{
+// floor platform
+{ Vector3(0.0f, 0.6f, 0.0f), Vector3(boothWidth, 1.2f, boothDepth), BoothMaterial },
+// ceiling
+{ Vector3(0.0f, boothHeight - 0.6f, 0.0f), Vector3(boothWidth, 1.2f, boothDepth), BoothMaterial },
+// side walls
+{ Vector3(-boothWidth * 0.5f + 0.4f, boothHeight * 0.5f, 0.0f), Vector3(0.8f, boothHeight - 1.2f, boothDepth), BoothMaterial },
+{ Vector3(boothWidth * 0.5f - 0.4f, boothHeight * 0.5f, 0.0f), Vector3(0.8f, boothHeight - 1.2f, boothDepth), BoothMaterial },
+// back wall
+{ Vector3(0.0f, boothHeight * 0.5f, -boothDepth * 0.5f + 0.4f), Vector3(boothWidth - 0.8f, boothHeight - 1.2f, 0.8f), BoothMaterial },
 // roof beams framing the opening
-setMaterial(beamAmbient, beamDiffuse, beamSpecular, 24.0f);
-glPushMatrix();
-glTranslatef(0.0f, boothHeight - 1.4f, boothDepth * 0.5f - 0.6f);
-glScalef(boothWidth - 1.2f, 0.8f, 0.8f);
-glutSolidCube(1.0f);
-glPopMatrix();
+{ Vector3(0.0f, boothHeight - 1.4f, boothDepth * 0.5f - 0.6f), Vector3(boothWidth - 1.2f, 0.8f, 0.8f), BeamMaterial },
+{ Vector3(0.0f, 2.4f, boothDepth * 0.5f - 0.6f), Vector3(boothWidth - 1.2f, 0.6f, 0.8f), BeamMaterial },
+// trim
+{ Vector3(0.0f, boothHeight * 0.5f, boothDepth * 0.5f - 0.2f), Vector3(boothWidth, boothHeight - 1.0f, 0.4f), TrimMaterial },
+// water volume without the animated top
+{ Vector3(0.0f, waterBottomY + 0.5f * (waterSurfaceY - waterBottomY - 0.06f), waterCenterZ),
+  Vector3(waterWidth, waterSurfaceY - waterBottomY - 0.06f, waterDepth), WaterMaterial },
+// front support rail
+{ Vector3(0.0f, waterSurfaceY + 0.15f, waterFrontZ + 0.4f), Vector3(waterWidth + 2.0f, 0.3f, 0.6f), RailMaterial }
+};
 
-glPushMatrix();
-glTranslatef(0.0f, 2.4f, boothDepth * 0.5f - 0.6f);
-glScalef(boothWidth - 1.2f, 0.6f, 0.8f);
-glutSolidCube(1.0f);
-glPopMatrix();
+staticParts.assign(parts, parts + sizeof(parts) / sizeof(parts[0]));
+boothInstanceOffsets.assign(1, Vector3(0.0f, 0.0f, 0.0f));
+}
 
-setMaterial(trimAmbient, trimDiffuse, trimSpecular, 32.0f);
-glPushMatrix();
-glTranslatef(0.0f, boothHeight * 0.5f, boothDepth * 0.5f - 0.2f);
-glScalef(boothWidth, boothHeight - 1.0f, 0.4f);
-glutSolidCube(1.0f);
-glPopMatrix();
+void buildStaticBatch()
+{
+staticBatchProgram = buildStaticBatchProgram(NULL);
+if (!staticBatchProgram)
+{
+std::fprintf(stderr, "Static batch shader unavailable, drawing booth in immediate mode\n");
+return;
+}
+
+staticBatch = new StaticBatch();
+for (int m = 0; m < StaticMaterialCount; ++m)
+{
+staticBatch->AddMaterial(staticMaterials[m]);
+}
+for (size_t i = 0; i < staticParts.size(); ++i)
+{
+staticBatch->AddBox(staticParts[i].center, staticParts[i].size, staticParts[i].material);
+}
+
+if (!staticBatch->Build(0, 1, 2, 3))
+{
+delete staticBatch;
+staticBatch = NULL;
+return;
+}
+staticBatch->BindMaterials(staticBatchProgram);
+staticBatch->SetInstances(boothInstanceOffsets);
+}
+
+// every offset is a full copy of booth, tank and rail
+void setBoothInstances(const std::vector<Vector3> &offsets)
+{
+boothInstanceOffsets = offsets;
+if (staticBatch)
+{
+staticBatch->SetInstances(boothInstanceOffsets);
+}
+invalidateStaticShadows();
 }
 
-void drawWater()
+void toggleBoothRow()
+{
+boothRow = !boothRow;
+int count = boothRow ? boothRowCount : 1;
+std::vector<Vector3> offsets;
+for (int i = 0; i < count; ++i)
 {
-const GLfloat waterAmbient[] = { 0.0f, 0.08f, 0.18f, 1.0f };
-const GLfloat waterDiffuse[] = { 0.2f, 0.45f, 0.8f, 1.0f };
-const GLfloat waterSpecular[] = { 0.5f, 0.6f, 0.7f, 1.0f };
+offsets.push_back(Vector3((i - 0.5f * (count - 1)) * boothRowSpacing, 0.0f, 0.0f));
+}
+setBoothInstances(offsets);
+}
 
-setMaterial(waterAmbient, waterDiffuse, waterSpecular, 48.0f);
+void drawStaticScene()
+{
+if (staticBatch)
+{
+staticBatch->Draw(staticBatchProgram);
+}
+else
+{
+drawStaticPartsImmediate();
+}
+}
 
-// draw the water volume without the animated top
+// fallback when the batch shader is unavailable
+void drawStaticPartsImmediate()
+{
+for (size_t instance = 0; instance < boothInstanceOffsets.size(); ++instance)
+{
+const Vector3 &offset = boothInstanceOffsets[instance];
+int currentMaterial = -1;
+for (size_t i = 0; i < staticParts.size(); ++i)
+{
+const StaticPart &part = staticParts[i];
+if (part.material != currentMaterial)
+{
+setMaterial(staticMaterials[part.material]);
+currentMaterial = part.material;
+}
 glPushMatrix();
-float volumeHeight = (waterSurfaceY - waterBottomY) - 0.06f;
-float waterCenterY = waterBottomY + 0.5f * volumeHeight;
-glTranslatef(0.0f, waterCenterY, waterCenterZ);
-glScalef(waterWidth, volumeHeight, waterDepth);
+glTranslatef(offset.x + part.center.x, offset.y + part.center.y, offset.z + part.center.z);
+glScalef(part.size.x, part.size.y, part.size.z);
 glutSolidCube(1.0f);
+PerfCounters::CountDraws(1, 24, true);
 glPopMatrix();
+}
+}
+}
+
+// The surface is computed here (possibly on a worker) and stored in the
+// command buffer as client-side arrays, one strip per row.
+void recordWater(CommandBuffer &commands)
+{
+const StaticBatchMaterial &material = staticMaterials[WaterMaterial];
+commands.Material(material.ambient, material.diffuse, material.specular, material.shininess);
 
 // animated surface
-int segmentsX = 48;
-int segmentsZ = 10;
+const int segmentsX = 48;
+const int segmentsZ = 10;
 float stepX = (waterRightX - waterLeftX) / segmentsX;
 float stepZ = (waterFrontZ - waterBackZ) / segmentsZ;
+GLfloat positions[(segmentsX + 1) * 2 * 3];
+GLfloat normals[(segmentsX + 1) * 2 * 3];
 
 for (int z = 0; z < segmentsZ; ++z)
 {
 float z0 = waterBackZ + stepZ * z;
 float z1 = z0 + stepZ;
-glBegin(GL_TRIANGLE_STRIP);
+GLfloat *position = positions;
+GLfloat *normal = normals;
 for (int x = 0; x <= segmentsX; ++x)
 {
 float worldX = waterLeftX + stepX * x;
 
-Vector3 normal0 = getWaterNormal(worldX, z0);
-float h0 = getWaterSurfaceHeight(worldX, z0);
-glNormal3f(normal0.x, normal0.y, normal0.z);
-glVertex3f(worldX, h0, z0);
+Vector3 normal0 = gallery.GetWaterNormal(worldX, z0);
+float h0 = gallery.GetWaterHeight(worldX, z0);
+*normal++ = normal0.x; *normal++ = normal0.y; *normal++ = normal0.z;
+*position++ = worldX; *position++ = h0; *position++ = z0;
 
-Vector3 normal1 = getWaterNormal(worldX, z1);
-float h1 = getWaterSurfaceHeight(worldX, z1);
-glNormal3f(normal1.x, normal1.y, normal1.z);
-glVertex3f(worldX, h1, z1);
+Vector3 normal1 = gallery.GetWaterNormal(worldX, z1);
+float h1 = gallery.GetWaterHeight(worldX, z1);
+*normal++ = normal1.x; *normal++ = normal1.y; *normal++ = normal1.z;
+*position++ = worldX; *position++ = h1; *position++ = z1;
 }
-glEnd();
+commands.DrawClientArrays(GL_TRIANGLE_STRIP, positions, normals, (segmentsX + 1) * 2);
 }
 }
 
-void drawActiveObject()
+// immediate version for the shadow pass
+void drawActiveTarget()
 {
-const GLfloat railAmbient[] = { 0.12f, 0.12f, 0.12f, 1.0f };
-const GLfloat railDiffuse[] = { 0.35f, 0.35f, 0.38f, 1.0f };
-const GLfloat railSpecular[] = { 0.5f, 0.5f, 0.55f, 1.0f };
-setMaterial(railAmbient, railDiffuse, railSpecular, 56.0f);
-
-// front support rail
-glPushMatrix();
-glTranslatef(0.0f, waterSurfaceY + 0.15f, waterFrontZ + 0.4f);
-glScalef(waterWidth + 2.0f, 0.3f, 0.6f);
-glutSolidCube(1.0f);
-glPopMatrix();
+CommandBuffer commands;
+recordActiveTarget(commands);
+commands.Replay();
+}
 
-glPushMatrix();
-glTranslatef(0.0f, objectPosY, objectPosZ);
-if (objectState == ObjectState::Duck)
+void recordActiveTarget(CommandBuffer &commands)
 {
-drawDuck();
-}
-else
+const std::vector<TargetPart> &parts = gallery.GetObjectState() == ObjectState::Duck ? duckParts : standaloneTargetParts;
+int currentMaterial = -1;
+for (size_t i = 0; i < parts.size(); ++i)
 {
-drawStandaloneTarget();
+const TargetPart &part = parts[i];
+if (part.material != currentMaterial)
+{
+const StaticBatchMaterial &material = targetMaterials[part.material];
+commands.Material(material.ambient, material.diffuse, material.specular, material.shininess);
+currentMaterial = part.material;
+}
+commands.PushMatrix();
+commands.MultMatrix(targetGraph.GetWorld(part.node));
+commands.Call(part.shape, part.args[0], part.args[1], part.args[2], part.args[3]);
+commands.PopMatrix();
 }
-glPopMatrix();
 }
 
-void drawDuck()
-{
-const GLfloat bodyAmbient[] = { 0.28f, 0.2f, 0.05f, 1.0f };
-const GLfloat bodyDiffuse[] = { 0.95f, 0.78f, 0.18f, 1.0f };
-const GLfloat bodySpecular[] = { 0.5f, 0.5f, 0.3f, 1.0f };
-const GLfloat wingAmbient[] = { 0.26f, 0.18f, 0.05f, 1.0f };
-const GLfloat wingDiffuse[] = { 0.85f, 0.7f, 0.2f, 1.0f };
-const GLfloat wingSpecular[] = { 0.35f, 0.35f, 0.2f, 1.0f };
-const GLfloat beakAmbient[] = { 0.4f, 0.2f, 0.02f, 1.0f };
-const GLfloat beakDiffuse[] = { 0.95f, 0.5f, 0.05f, 1.0f };
-const GLfloat beakSpecular[] = { 0.6f, 0.4f, 0.2f, 1.0f };
-const GLfloat eyeAmbient[] = { 0.05f, 0.05f, 0.05f, 1.0f };
-const GLfloat eyeDiffuse[] = { 0.1f, 0.1f, 0.1f, 1.0f };
-const GLfloat eyeSpecular[] = { 0.5f, 0.5f, 0.5f, 1.0f };
-const GLfloat whiteAmbient[] = { 0.6f, 0.6f, 0.6f, 1.0f };
-const GLfloat whiteDiffuse[] = { 0.9f, 0.9f, 0.9f, 1.0f };
-const GLfloat whiteSpecular[] = { 0.3f, 0.3f, 0.3f, 1.0f };
-const GLfloat redAmbient[] = { 0.4f, 0.0f, 0.0f, 1.0f };
-const GLfloat redDiffuse[] = { 0.9f, 0.1f, 0.1f, 1.0f };
-const GLfloat redSpecular[] = { 0.5f, 0.2f, 0.2f, 1.0f };
-
-float bodyLength = 2.6f;
-float bodyHeight = 1.8f;
-float bodyWidth = 1.6f;
-
-setMaterial(bodyAmbient, bodyDiffuse, bodySpecular, 40.0f);
-glPushMatrix();
-glScalef(bodyWidth, bodyHeight, bodyLength);
-glutSolidSphere(0.5f, 32, 32);
-glPopMatrix();
+// Parts are listed in drawing order; consecutive parts sharing a material
+// set it once.
+void buildTargetGraph()
+{
+typedef SceneGraph::Matrix Matrix;
+const float bodyLength = 2.6f;
+const float bodyHeight = 1.8f;
+const float bodyWidth = 1.6f;
+
+targetRootNode = targetGraph.AddNode(SceneGraph::noParent, SceneGraph::Identity());
+
+int body = targetGraph.AddNode(targetRootNode, SceneGraph::Scaling(bodyWidth, bodyHeight, bodyLength));
+addTargetPart(duckParts, body, DuckBodyMaterial, solidSphereCommand, 0.5f, 32.0f, 32.0f);
 
-setMaterial(wingAmbient, wingDiffuse, wingSpecular, 28.0f);
 for (int side = -1; side <= 1; side += 2)
 {
-glPushMatrix();
-glTranslatef(side * bodyWidth * 0.55f, 0.05f, -0.2f);
-glRotatef(side * 25.0f, 0.0f, 0.0f, 1.0f);
-glScalef(bodyWidth * 0.5f, bodyHeight * 0.7f, bodyLength * 0.35f);
-glutSolidCube(1.0f);
-glPopMatrix();
+Matrix wing = SceneGraph::Multiply(SceneGraph::Translation(side * bodyWidth * 0.55f, 0.05f, -0.2f), SceneGraph::Rotation(side * 25.0f, 0.0f, 0.0f, 1.0f));
+wing = SceneGraph::Multiply(wing, SceneGraph::Scaling(bodyWidth * 0.5f, bodyHeight * 0.7f, bodyLength * 0.35f));
+addTargetPart(duckParts, targetGraph.AddNode(targetRootNode, wing), DuckWingMaterial, solidCubeCommand, 1.0f);
 }
 
-glPushMatrix();
-glTranslatef(0.0f, -0.3f, -bodyLength * 0.45f);
-glRotatef(25.0f, 1.0f, 0.0f, 0.0f);
-glScalef(bodyWidth * 0.45f, 0.2f, bodyLength * 0.6f);
-glutSolidCube(1.0f);
-glPopMatrix();
+Matrix tail = SceneGraph::Multiply(SceneGraph::Translation(0.0f, -0.3f, -bodyLength * 0.45f), SceneGraph::Rotation(25.0f, 1.0f, 0.0f, 0.0f));
+tail = SceneGraph::Multiply(tail, SceneGraph::Scaling(bodyWidth * 0.45f, 0.2f, bodyLength * 0.6f));
+addTargetPart(duckParts, targetGraph.AddNode(targetRootNode, tail), DuckWingMaterial, solidCubeCommand, 1.0f);
 
-setMaterial(bodyAmbient, bodyDiffuse, bodySpecular, 40.0f);
-glPushMatrix();
-glTranslatef(0.0f, bodyHeight * 0.65f, bodyLength * 0.2f);
-glPushMatrix();
-glScalef(0.9f, 0.9f, 0.9f);
-glutSolidSphere(0.5f, 24, 24);
-glPopMatrix();
+int head = targetGraph.AddNode(targetRootNode, SceneGraph::Translation(0.0f, bodyHeight * 0.65f, bodyLength * 0.2f));
+addTargetPart(duckParts, targetGraph.AddNode(head, SceneGraph::Scaling(0.9f, 0.9f, 0.9f)), DuckBodyMaterial, solidSphereCommand, 0.5f, 24.0f, 24.0f);
+addTargetPart(duckParts, targetGraph.AddNode(head, SceneGraph::Translation(0.0f, -0.05f, 0.55f)), DuckBeakMaterial, solidConeCommand, 0.22f, 0.6f, 20.0f, 20.0f);
+for (int side = 1; side >= -1; side -= 2)
+{
+Matrix eye = SceneGraph::Multiply(SceneGraph::Translation(side * 0.22f, 0.15f, 0.35f), SceneGraph::Scaling(0.12f, 0.12f, 0.12f));
+addTargetPart(duckParts, targetGraph.AddNode(head, eye), DuckEyeMaterial, solidSphereCommand, 0.5f, 12.0f, 12.0f);
+}
 
-setMaterial(beakAmbient, beakDiffuse, beakSpecular, 25.0f);
-glPushMatrix();
-glTranslatef(0.0f, -0.05f, 0.55f);
-glutSolidCone(0.22f, 0.6f, 20, 20);
-glPopMatrix();
+int badge = targetGraph.AddNode(head, SceneGraph::Translation(0.0f, -0.35f, 0.55f));
+addTargetPart(duckParts, badge, TargetWhiteMaterial, diskCommand, 0.0f, 0.7f);
+addTargetPart(duckParts, badge, TargetRedMaterial, diskCommand, 0.35f, 0.55f);
+addTargetPart(duckParts, badge, TargetWhiteMaterial, diskCommand, 0.0f, 0.22f);
 
-setMaterial(eyeAmbient, eyeDiffuse, eyeSpecular, 80.0f);
-glPushMatrix();
-glTranslatef(0.22f, 0.15f, 0.35f);
-glScalef(0.12f, 0.12f, 0.12f);
-glutSolidSphere(0.5f, 12, 12);
-glPopMatrix();
+addTargetPart(standaloneTargetParts, targetRootNode, TargetWhiteMaterial, diskCommand, 0.0f, 0.75f);
+addTargetPart(standaloneTargetParts, targetRootNode, TargetRedMaterial, diskCommand, 0.4f, 0.6f);
+addTargetPart(standaloneTargetParts, targetRootNode, TargetWhiteMaterial, diskCommand, 0.0f, 0.25f);
 
-glPushMatrix();
-glTranslatef(-0.22f, 0.15f, 0.35f);
-glScalef(0.12f, 0.12f, 0.12f);
-glutSolidSphere(0.5f, 12, 12);
-glPopMatrix();
+updateTargetGraph();
+}
 
-glPushMatrix();
-glTranslatef(0.0f, -0.35f, 0.55f);
-setMaterial(whiteAmbient, whiteDiffuse, whiteSpecular, 30.0f);
-drawTargetLayer(0.0f, 0.7f);
-setMaterial(redAmbient, redDiffuse, redSpecular, 30.0f);
-drawTargetLayer(0.35f, 0.55f);
-setMaterial(whiteAmbient, whiteDiffuse, whiteSpecular, 30.0f);
-drawTargetLayer(0.0f, 0.22f);
-glPopMatrix();
+void addTargetPart(std::vector<TargetPart> &parts, int node, TargetMaterialId material, CommandBufferFunc shape, float a, float b, float c, float d)
+{
+TargetPart part = { node, material, shape, { a, b, c, d } };
+parts.push_back(part);
+}
 
-glPopMatrix();
+// the target is drawn in the x = 0 plane, wherever it is along the path
+void updateTargetGraph()
+{
+Vector3 target = gallery.GetObjectPosition();
+targetGraph.SetLocal(targetRootNode, SceneGraph::Translation(0.0f, target.y, target.z));
+targetGraph.Update();
+}
+
+Vector3 getTargetPosition()
+{
+const float *world = targetGraph.GetWorld(targetRootNode);
+return Vector3(world[12], world[13], world[14]);
+}
+
+// fixed-function shapes that command buffers replay through Call()
+void drawStaticPartsCommand(const float *args)
+{
+drawStaticPartsImmediate();
 }
 
-void drawStandaloneTarget()
+void solidSphereCommand(const float *args)
 {
-    const GLfloat whiteAmbient[] = { 0.6f, 0.6f, 0.6f, 1.0f };
-    const GLfloat whiteDiffuse[] = { 0.9f, 0.9f, 0.9f, 1.0f };
-    const GLfloat whiteSpecular[] = { 0.3f, 0.3f, 0.3f, 1.0f };
-    const GLfloat redAmbient[] = { 0.4f, 0.0f, 0.0f, 1.0f };
-    const GLfloat redDiffuse[] = { 0.9f, 0.1f, 0.1f, 1.0f };
-    const GLfloat redSpecular[] = { 0.5f, 0.2f, 0.2f, 1.0f };
+glutSolidSphere(args[0], (int)args[1], (int)args[2]);
+// a strip per stack
+PerfCounters::CountDraws((int)args[2], (int)args[2] * ((int)args[1] + 1) * 2, true);
+}
+
+void solidCubeCommand(const float *args)
+{
+glutSolidCube(args[0]);
+PerfCounters::CountDraws(1, 24, true);
+}
 
-    glPushMatrix();
-    setMaterial(whiteAmbient, whiteDiffuse, whiteSpecular, 30.0f);
-    drawTargetLayer(0.0f, 0.75f);
-    setMaterial(redAmbient, redDiffuse, redSpecular, 30.0f);
-    drawTargetLayer(0.4f, 0.6f);
-    setMaterial(whiteAmbient, whiteDiffuse, whiteSpecular, 30.0f);
-    drawTargetLayer(0.0f, 0.25f);
-    glPopMatrix();
+void solidConeCommand(const float *args)
+{
+glutSolidCone(args[0], args[1], (int)args[2], (int)args[3]);
+// a strip per stack plus the base fan
+PerfCounters::CountDraws((int)args[3] + 1, (int)args[3] * ((int)args[2] + 1) * 2 + (int)args[2] + 2, true);
 }
 
-void drawTargetLayer(float innerRadius, float outerRadius)
+void diskCommand(const float *args)
 {
-    if (!targetQuadric)
-        return;
+if (!targetQuadric)
+return;
 
-    gluDisk(targetQuadric, innerRadius, outerRadius, 32, 1);
+gluDisk(targetQuadric, args[0], args[1], 32, 1);
+PerfCounters::CountDraws(1, 33 * 2, true);
 }
 
 void setMaterial(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4], GLfloat shininess)
@@ -761,82 +2665,338 @@ glMaterialfv(GL_FRONT, GL_AMBIENT, ambient);
 glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse);
 glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
 glMaterialfv(GL_FRONT, GL_SHININESS, shininessArray);
+PerfCounters::Add(PerfCounters::MaterialChanges);
 }
 
-GLuint buildGroundProgram()
+void setMaterial(const StaticBatchMaterial &material)
 {
-const char *vertexSrc =
-"#version 120\n"
+setMaterial(material.ambient, material.diffuse, material.specular, material.shininess);
+}
+
+// Adds selectView(), viewPosition() and viewerDirection() after a prelude
+// that starts with the version line. Broadcast programs need an arena one.
+std::string withViewFunctions(const std::string &prelude, bool broadcast)
+{
+return broadcast ? MultiView::GetBroadcastPrelude(prelude) : prelude + MultiView::GetSingleViewSource();
+}
+
+// With an arena the shaders take the arena prelude and read their offset
+// (and material) from the per-draw data; the bodies are shared. The ground
+// and depth bodies get their vertex from loadVertex(), which a procedural
+// grid rebuilds from gl_VertexID instead of reading attributes.
+const char *attributeVertexSrc =
 "attribute vec3 position;\n"
 "attribute vec3 normal;\n"
-"varying float vLight;\n"
-"void main()\n"
+"void loadVertex(out vec3 p, out vec3 n)\n"
+"{\n"
+"    p = position;\n"
+"    n = normal;\n"
+"}\n";
+
+const char *proceduralVertexSrc =
+"void loadVertex(out vec3 p, out vec3 n)\n"
+"{\n"
+"    proceduralGridVertex(p, n);\n"
+"}\n";
+
+// Ground lighting and shadow coordinates for one vertex, shared by the
+// vertex shaders and the tessellation evaluation shader; each defines
+// VERTEX_OUT and DRAW_OFFSET and includes the view functions first.
+// gl_Position is invariant to match the depth pre-pass program.
+const char *groundShadingSrc =
+"invariant gl_Position;\n"
+"uniform mat4 uShadowMatrix0;\n"
+"uniform mat4 uShadowMatrix1;\n"
+"VERTEX_OUT float vLight;\n"
+"VERTEX_OUT vec4 vShadowCoord0;\n"
+"VERTEX_OUT vec4 vShadowCoord1;\n"
+"void shadeVertex(vec3 position, vec3 normal)\n"
 "{\n"
 "    vec3 lightDir = normalize(vec3(0.3, 1.0, 0.5));\n"
 "    vLight = max(dot(normalize(normal), lightDir), 0.0);\n"
-"    gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 1.0);\n"
+"    vec4 worldPos = vec4(position + DRAW_OFFSET, 1.0);\n"
+"    vShadowCoord0 = uShadowMatrix0 * worldPos;\n"
+"    vShadowCoord1 = uShadowMatrix1 * worldPos;\n"
+"    gl_Position = viewPosition(worldPos);\n"
 "}\n";
 
-const char *fragmentSrc =
+const char *groundFragmentSrc =
 "#version 120\n"
 "varying float vLight;\n"
+"varying vec4 vShadowCoord0;\n"
+"varying vec4 vShadowCoord1;\n"
 "uniform vec3 uBaseColor;\n"
+"uniform sampler2DShadow uShadowMap0;\n"
+"uniform sampler2DShadow uShadowMap1;\n"
+"uniform float uShadowStrength;\n"
 "void main()\n"
 "{\n"
-"    vec3 color = uBaseColor * (0.35 + 0.65 * vLight);\n"
+"    float visibility = 0.5 * (shadow2DProj(uShadowMap0, vShadowCoord0).r + shadow2DProj(uShadowMap1, vShadowCoord1).r);\n"
+"    float shadow = mix(1.0, visibility, uShadowStrength);\n"
+"    vec3 color = uBaseColor * (0.35 + 0.65 * vLight * shadow);\n"
 "    gl_FragColor = vec4(color, 1.0);\n"
 "}\n";
 
-GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSrc);
-GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSrc);
-
-GLuint program = glCreateProgram();
-glAttachShader(program, vertexShader);
-glAttachShader(program, fragmentShader);
-glBindAttribLocation(program, 0, "position");
-glBindAttribLocation(program, 1, "normal");
-glLinkProgram(program);
+GLuint buildGroundProgram(const GeometryArena *arena, bool procedural, bool broadcast)
+{
+std::string header;
+if (procedural)
+{
+header = withViewFunctions(QuadMesh::GetProceduralVertexPrelude(), false) + "#define DRAW_OFFSET vec3(0.0)\n" + proceduralVertexSrc;
+}
+else if (arena)
+{
+header = withViewFunctions(arena->GetShaderPrelude(), broadcast) + "#define DRAW_OFFSET getDrawData().xyz\n" + attributeVertexSrc;
+}
+else
+{
+header = withViewFunctions("#version 120\n", false) + "#define DRAW_OFFSET vec3(0.0)\n" + attributeVertexSrc;
+}
+std::string vertexSrc = header + "#define VERTEX_OUT varying\n" + groundShadingSrc +
+"void main()\n"
+"{\n"
+"    vec3 position, normal;\n"
+"    selectView();\n"
+"    loadVertex(position, normal);\n"
+"    shadeVertex(position, normal);\n"
+"}\n";
 
-GLint linked = 0;
-glGetProgramiv(program, GL_LINK_STATUS, &linked);
-if (!linked)
+if (procedural)
 {
-GLint logLength = 0;
-glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-if (logLength > 1)
+return buildProgram(vertexSrc.c_str(), groundFragmentSrc, NULL, 0);
+}
+if (arena)
 {
-std::vector<char> log(logLength);
-glGetProgramInfoLog(program, logLength, NULL, &log[0]);
-std::fprintf(stderr, "Program link error: %s\n", &log[0]);
+return buildProgram(vertexSrc.c_str(), groundFragmentSrc, GeometryArena::GetAttributeNames(), GeometryArena::AttributeCount);
 }
-glDeleteProgram(program);
-program = 0;
+const char *attribs[] = { "position", "normal" };
+return buildProgram(vertexSrc.c_str(), groundFragmentSrc, attribs, 2);
 }
 
-glDeleteShader(vertexShader);
-glDeleteShader(fragmentShader);
-return program;
+// the ground is a plane, so the patches only add shading detail; its
+// heights would go in surfaceHeight()
+GLuint buildTessellatedGroundProgram()
+{
+std::string surfaceSrc = std::string("#define DRAW_OFFSET vec3(0.0)\n") + MultiView::GetSingleViewSource() + groundShadingSrc +
+"float surfaceHeight(vec2 xz)\n"
+"{\n"
+"    return uBaseHeight;\n"
+"}\n";
+return TessellatedSurface::BuildProgram(surfaceSrc.c_str(), groundFragmentSrc);
+}
+
+// The same waves as GallerySession::GetWaterHeight() plus the simulated ripples,
+// lit per fragment like the fixed-function water material.
+GLuint buildTessellatedWaterProgram()
+{
+const char *surfaceSrc =
+"uniform float uWaveAmplitude;\n"
+"uniform float uWavePhase;\n"
+"uniform vec2 uWaveFrequency;\n"
+"uniform vec4 uWaterRect;\n"
+"uniform sampler2D uRipples;\n"
+"uniform vec2 uRippleCells;\n"
+"uniform float uRippleScale;\n"
+"VERTEX_OUT vec3 vEyePos;\n"
+"VERTEX_OUT vec3 vEyeNormal;\n"
+"float surfaceHeight(vec2 xz)\n"
+"{\n"
+"    vec2 ratio = (xz - uWaterRect.xy) / uWaterRect.zw;\n"
+"    float primary = sin(uWaveFrequency.x * ratio.x + uWavePhase);\n"
+"    float secondary = sin(uWaveFrequency.y * ratio.y + uWavePhase * 0.6);\n"
+"    vec2 uv = (ratio * (uRippleCells - 1.0) + 0.5) / uRippleCells;\n"
+"    float ripple = uRippleScale * textureLod(uRipples, uv, 0.0).r;\n"
+"    return uBaseHeight + uWaveAmplitude * (0.7 * primary + 0.3 * secondary) + ripple;\n"
+"}\n"
+"void shadeVertex(vec3 position, vec3 normal)\n"
+"{\n"
+"    vec4 eyePos = gl_ModelViewMatrix * vec4(position, 1.0);\n"
+"    vEyePos = eyePos.xyz;\n"
+"    vEyeNormal = gl_NormalMatrix * normal;\n"
+"    gl_Position = gl_ProjectionMatrix * eyePos;\n"
+"}\n";
+
+const char *fragmentSrc =
+"#version 120\n"
+"varying vec3 vEyePos;\n"
+"varying vec3 vEyeNormal;\n"
+"vec3 shadeLight(gl_LightSourceParameters light, vec3 n)\n"
+"{\n"
+"    vec3 l = normalize(light.position.xyz - vEyePos * light.position.w);\n"
+"    float nDotL = max(dot(n, l), 0.0);\n"
+"    vec3 color = light.ambient.rgb * gl_FrontMaterial.ambient.rgb + nDotL * light.diffuse.rgb * gl_FrontMaterial.diffuse.rgb;\n"
+"    if (nDotL > 0.0)\n"
+"    {\n"
+"        vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));\n"
+"        color += pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess) * light.specular.rgb * gl_FrontMaterial.specular.rgb;\n"
+"    }\n"
+"    return color;\n"
+"}\n"
+"void main()\n"
+"{\n"
+"    vec3 n = normalize(vEyeNormal);\n"
+"    vec3 color = gl_LightModel.ambient.rgb * gl_FrontMaterial.ambient.rgb;\n"
+"    color += shadeLight(gl_LightSource[0], n);\n"
+"    color += shadeLight(gl_LightSource[1], n);\n"
+"    gl_FragColor = vec4(min(color, vec3(1.0)), gl_FrontMaterial.diffuse.a);\n"
+"}\n";
+
+return TessellatedSurface::BuildProgram(surfaceSrc, fragmentSrc);
+}
+
+// Per-vertex two-light Blinn-Phong matching the fixed-function pipeline, with
+// the material looked up from a uniform table by the per-vertex material id.
+GLuint buildStaticBatchProgram(const GeometryArena *arena, bool broadcast)
+{
+std::string header = arena ? withViewFunctions(arena->GetShaderPrelude(), broadcast) + arenaInstanceDefines
+: withViewFunctions("#version 120\n", false) + "attribute float materialId;\nattribute vec3 instanceOffset;\n";
+std::string vertexSrc = header +
+"invariant gl_Position;\n"
+"attribute vec3 position;\n"
+"attribute vec3 normal;\n"
+"uniform vec4 uAmbient[8];\n"
+"uniform vec4 uDiffuse[8];\n"
+"uniform vec4 uSpecular[8];\n"
+"uniform float uShininess[8];\n"
+"varying vec4 vColor;\n"
+"vec3 shadeLight(gl_LightSourceParameters light, vec3 eyePos, vec3 n, int m)\n"
+"{\n"
+"    vec3 l = normalize(light.position.xyz - eyePos * light.position.w);\n"
+"    float nDotL = max(dot(n, l), 0.0);\n"
+"    vec3 color = light.ambient.rgb * uAmbient[m].rgb + nDotL * light.diffuse.rgb * uDiffuse[m].rgb;\n"
+"    if (nDotL > 0.0)\n"
+"    {\n"
+"        vec3 h = normalize(l + viewerDirection());\n"
+"        color += pow(max(dot(n, h), 0.0), uShininess[m]) * light.specular.rgb * uSpecular[m].rgb;\n"
+"    }\n"
+"    return color;\n"
+"}\n"
+"void main()\n"
+"{\n"
+"    selectView();\n"
+"    int m = int(materialId + 0.5);\n"
+"    vec4 worldPos = vec4(position + instanceOffset, 1.0);\n"
+"    vec4 eyePos = gl_ModelViewMatrix * worldPos;\n"
+"    vec3 n = normalize(gl_NormalMatrix * normal);\n"
+"    vec3 color = gl_LightModel.ambient.rgb * uAmbient[m].rgb;\n"
+"    color += shadeLight(gl_LightSource[0], eyePos.xyz, n, m);\n"
+"    color += shadeLight(gl_LightSource[1], eyePos.xyz, n, m);\n"
+"    vColor = vec4(min(color, vec3(1.0)), uDiffuse[m].a);\n"
+"    gl_Position = viewPosition(worldPos);\n"
+"}\n";
+
+const char *fragmentSrc =
+"#version 120\n"
+"varying vec4 vColor;\n"
+"void main()\n"
+"{\n"
+"    gl_FragColor = vColor;\n"
+"}\n";
+
+if (arena)
+{
+return buildProgram(vertexSrc.c_str(), fragmentSrc, GeometryArena::GetAttributeNames(), GeometryArena::AttributeCount);
+}
+const char *attribs[] = { "position", "normal", "materialId", "instanceOffset" };
+return buildProgram(vertexSrc.c_str(), fragmentSrc, attribs, 4);
 }
 
-GLuint compileShader(GLenum type, const char *src)
+// Position-only program for the depth pre-pass. It computes gl_Position
+// with the same expression as the ground and batch shaders, and all three
+// declare it invariant: GLSL only promises the same depth from the same
+// expression in different programs when the output is invariant, and the
+// colour pass relies on that with GL_LEQUAL.
+GLuint buildDepthOnlyProgram(const GeometryArena *arena, bool procedural, bool broadcast)
+{
+std::string header;
+if (procedural)
 {
-GLuint shader = glCreateShader(type);
-glShaderSource(shader, 1, &src, NULL);
-glCompileShader(shader);
-GLint compiled = 0;
-glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-if (!compiled)
+header = withViewFunctions(QuadMesh::GetProceduralVertexPrelude(), false) + "#define instanceOffset vec3(0.0)\n" + proceduralVertexSrc;
+}
+else if (arena)
 {
-GLint logLength = 0;
-glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
-if (logLength > 1)
+header = withViewFunctions(arena->GetShaderPrelude(), broadcast) + arenaInstanceDefines + attributeVertexSrc;
+}
+else
 {
-std::vector<char> log(logLength);
-glGetShaderInfoLog(shader, logLength, NULL, &log[0]);
-std::fprintf(stderr, "Shader compile error: %s\n", &log[0]);
+header = withViewFunctions("#version 120\n", false) + "attribute vec3 instanceOffset;\n" + attributeVertexSrc;
 }
-glDeleteShader(shader);
-return 0;
+std::string vertexSrc = header +
+"invariant gl_Position;\n"
+"void main()\n"
+"{\n"
+"    vec3 position, normal;\n"
+"    selectView();\n"
+"    loadVertex(position, normal);\n"
+"    gl_Position = viewPosition(vec4(position + instanceOffset, 1.0));\n"
+"}\n";
+
+const char *fragmentSrc =
+"#version 120\n"
+"void main()\n"
+"{\n"
+"    gl_FragColor = vec4(1.0);\n"
+"}\n";
+
+if (procedural)
+{
+return buildProgram(vertexSrc.c_str(), fragmentSrc, NULL, 0);
+}
+if (arena)
+{
+return buildProgram(vertexSrc.c_str(), fragmentSrc, GeometryArena::GetAttributeNames(), GeometryArena::AttributeCount);
+}
+const char *attribs[] = { "position", "normal", NULL, "instanceOffset" };
+return buildProgram(vertexSrc.c_str(), fragmentSrc, attribs, 4);
+}
+
+// Camera-facing quads: the corner is pushed along the view's right and up
+// axes, taken from the rows of the modelview rotation.
+GLuint buildParticleProgram()
+{
+const char *vertexSrc =
+"#version 120\n"
+"attribute vec2 corner;\n"
+"attribute float posX;\n"
+"attribute float posY;\n"
+"attribute float posZ;\n"
+"attribute float life;\n"
+"attribute float kind;\n"
+"uniform float uSize;\n"
+"varying vec2 vCorner;\n"
+"varying float vKind;\n"
+"void main()\n"
+"{\n"
+"    vec3 right = vec3(gl_ModelViewMatrix[0][0], gl_ModelViewMatrix[1][0], gl_ModelViewMatrix[2][0]);\n"
+"    vec3 up = vec3(gl_ModelViewMatrix[0][1], gl_ModelViewMatrix[1][1], gl_ModelViewMatrix[2][1]);\n"
+"    float size = uSize * clamp(life * 2.0, 0.3, 1.0);\n"
+"    vec3 p = vec3(posX, posY, posZ) + (right * corner.x + up * corner.y) * size;\n"
+"    vCorner = corner;\n"
+"    vKind = kind;\n"
+"    gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 1.0);\n"
+"}\n";
+
+const char *fragmentSrc =
+"#version 120\n"
+"varying vec2 vCorner;\n"
+"varying float vKind;\n"
+"void main()\n"
+"{\n"
+"    float r2 = dot(vCorner, vCorner);\n"
+"    if (r2 > 1.0)\n"
+"        discard;\n"
+"    vec3 splash = vec3(0.75, 0.88, 1.0);\n"
+"    vec3 debris = vec3(0.55, 0.38, 0.2);\n"
+"    gl_FragColor = vec4(mix(splash, debris, vKind) * (1.0 - 0.3 * r2), 1.0);\n"
+"}\n";
+
+const char *attribs[] = { "corner", "posX", "posY", "posZ", "life", "kind" };
+GLuint program = buildProgram(vertexSrc, fragmentSrc, attribs, 6);
+if (program)
+{
+glUseProgram(program);
+glUniform1f(glGetUniformLocation(program, "uSize"), particleSize);
+glUseProgram(0);
 }
-return shader;
+return program;
 }
@@ -0,0 +1,109 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "SceneGraph.h"
+
+int SceneGraph::AddNode(int parent, const Matrix &local)
+{
+	if (parent != noParent && (parent < 0 || parent >= GetNodeCount()))
+		return -1;
+
+	parents.push_back(parent);
+	locals.push_back(local);
+	worlds.push_back(local);
+	dirty.push_back(1);
+	moved.push_back(0);
+	return GetNodeCount() - 1;
+}
+
+void SceneGraph::SetLocal(int node, const Matrix &local)
+{
+	if (std::memcmp(locals[node].m, local.m, sizeof(local.m)) == 0)
+		return;
+
+	locals[node] = local;
+	dirty[node] = 1;
+}
+
+void SceneGraph::Update()
+{
+	int count = GetNodeCount();
+	for (int i = 0; i < count; ++i)
+	{
+		int parent = parents[i];
+		bool parentMoved = parent != noParent && moved[parent];
+		moved[i] = dirty[i] || parentMoved;
+		if (!moved[i])
+			continue;
+
+		worlds[i] = parent == noParent ? locals[i] : Multiply(worlds[parent], locals[i]);
+		dirty[i] = 0;
+	}
+}
+
+SceneGraph::Matrix SceneGraph::Identity()
+{
+	Matrix result;
+	for (int i = 0; i < 16; ++i)
+		result.m[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+	return result;
+}
+
+SceneGraph::Matrix SceneGraph::Translation(float x, float y, float z)
+{
+	Matrix result = Identity();
+	result.m[12] = x;
+	result.m[13] = y;
+	result.m[14] = z;
+	return result;
+}
+
+SceneGraph::Matrix SceneGraph::Rotation(float degrees, float x, float y, float z)
+{
+	Matrix result = Identity();
+	float length = std::sqrt(x * x + y * y + z * z);
+	if (length == 0.0f)
+		return result;
+	x /= length;
+	y /= length;
+	z /= length;
+
+	float radians = degrees * static_cast<float>(M_PI) / 180.0f;
+	float c = std::cos(radians);
+	float s = std::sin(radians);
+	float t = 1.0f - c;
+	result.m[0] = t * x * x + c;
+	result.m[1] = t * x * y + s * z;
+	result.m[2] = t * x * z - s * y;
+	result.m[4] = t * x * y - s * z;
+	result.m[5] = t * y * y + c;
+	result.m[6] = t * y * z + s * x;
+	result.m[8] = t * x * z + s * y;
+	result.m[9] = t * y * z - s * x;
+	result.m[10] = t * z * z + c;
+	return result;
+}
+
+SceneGraph::Matrix SceneGraph::Scaling(float x, float y, float z)
+{
+	Matrix result = Identity();
+	result.m[0] = x;
+	result.m[5] = y;
+	result.m[10] = z;
+	return result;
+}
+
+SceneGraph::Matrix SceneGraph::Multiply(const Matrix &a, const Matrix &b)
+{
+	Matrix result;
+	for (int c = 0; c < 4; ++c)
+	{
+		for (int r = 0; r < 4; ++r)
+		{
+			result.m[c * 4 + r] = a.m[r] * b.m[c * 4] + a.m[4 + r] * b.m[c * 4 + 1] + a.m[8 + r] * b.m[c * 4 + 2] + a.m[12 + r] * b.m[c * 4 + 3];
+		}
+	}
+	return result;
+}
@@ -0,0 +1,87 @@
+#include <cstdio>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "FrameArena.h"
+#include "ShaderUtil.h"
+
+GLuint compileShader(GLenum type, const char *src)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled)
+	{
+		GLint logLength = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+		if (logLength > 1)
+		{
+			FrameVector<char> log(logLength);
+			glGetShaderInfoLog(shader, logLength, NULL, &log[0]);
+			std::fprintf(stderr, "Shader compile error: %s\n", &log[0]);
+		}
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+GLuint linkProgram(const GLuint *shaders, int shaderCount, const char *const *attribNames, int attribCount)
+{
+	bool complete = true;
+	for (int i = 0; i < shaderCount; ++i)
+	{
+		if (!shaders[i])
+			complete = false;
+	}
+
+	GLuint program = 0;
+	if (complete)
+	{
+		program = glCreateProgram();
+		for (int i = 0; i < shaderCount; ++i)
+		{
+			glAttachShader(program, shaders[i]);
+		}
+		for (int i = 0; i < attribCount; ++i)
+		{
+			if (attribNames[i])
+				glBindAttribLocation(program, i, attribNames[i]);
+		}
+		glLinkProgram(program);
+
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			GLint logLength = 0;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+			if (logLength > 1)
+			{
+				FrameVector<char> log(logLength);
+				glGetProgramInfoLog(program, logLength, NULL, &log[0]);
+				std::fprintf(stderr, "Program link error: %s\n", &log[0]);
+			}
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+
+	for (int i = 0; i < shaderCount; ++i)
+	{
+		if (shaders[i])
+			glDeleteShader(shaders[i]);
+	}
+	return program;
+}
+
+GLuint buildProgram(const char *vertexSrc, const char *fragmentSrc, const char *const *attribNames, int attribCount)
+{
+	GLuint shaders[2];
+	shaders[0] = compileShader(GL_VERTEX_SHADER, vertexSrc);
+	shaders[1] = compileShader(GL_FRAGMENT_SHADER, fragmentSrc);
+	return linkProgram(shaders, 2, attribNames, attribCount);
+}
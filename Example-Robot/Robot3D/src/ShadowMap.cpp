@@ -0,0 +1,224 @@
+#include <cstring>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define FREEGLUT_STATIC
+#include <GL/freeglut.h>
+
+#include "Vectors.h"
+#include "ShadowMap.h"
+
+ShadowMap::ShadowMap(int mapSize)
+{
+	this->mapSize = mapSize < 16 ? 16 : mapSize;
+	staticFbo = 0;
+	staticDepth = 0;
+	fbo = 0;
+	depthTexture = 0;
+
+	std::memset(lightPosition, 0, sizeof(lightPosition));
+	fieldOfView = 60.0f;
+	nearPlane = 1.0f;
+	farPlane = 100.0f;
+
+	std::memset(lightProjection, 0, sizeof(lightProjection));
+	std::memset(lightView, 0, sizeof(lightView));
+	std::memset(shadowMatrix, 0, sizeof(shadowMatrix));
+
+	staticValid = false;
+	hasLight = false;
+	staticRebuilds = 0;
+
+	savedFramebuffer = 0;
+	savedViewport[0] = savedViewport[1] = savedViewport[2] = savedViewport[3] = 0;
+}
+
+ShadowMap::~ShadowMap()
+{
+	FreeMemory();
+}
+
+bool ShadowMap::CreateDepthTarget(GLuint &target, GLuint &texture, bool compare)
+{
+	const GLfloat border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, mapSize, mapSize, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+	// anything outside the light frustum reads as unoccluded
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	if (compare)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &target);
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return status == GL_FRAMEBUFFER_COMPLETE;
+}
+
+bool ShadowMap::Init()
+{
+	FreeMemory();
+
+	if (!CreateDepthTarget(staticFbo, staticDepth, false) ||
+		!CreateDepthTarget(fbo, depthTexture, true))
+	{
+		FreeMemory();
+		return false;
+	}
+	staticValid = false;
+	return true;
+}
+
+void ShadowMap::FreeMemory()
+{
+	if (staticFbo)
+		glDeleteFramebuffers(1, &staticFbo);
+	if (fbo)
+		glDeleteFramebuffers(1, &fbo);
+	if (staticDepth)
+		glDeleteTextures(1, &staticDepth);
+	if (depthTexture)
+		glDeleteTextures(1, &depthTexture);
+	staticFbo = fbo = 0;
+	staticDepth = depthTexture = 0;
+	staticValid = false;
+}
+
+void ShadowMap::SetLight(const GLfloat position[4], Vector3 target, float fieldOfView, float nearPlane, float farPlane)
+{
+	if (hasLight &&
+		std::memcmp(lightPosition, position, sizeof(lightPosition)) == 0 &&
+		lightTarget == target &&
+		this->fieldOfView == fieldOfView &&
+		this->nearPlane == nearPlane &&
+		this->farPlane == farPlane)
+	{
+		return;
+	}
+
+	std::memcpy(lightPosition, position, sizeof(lightPosition));
+	lightTarget = target;
+	this->fieldOfView = fieldOfView;
+	this->nearPlane = nearPlane;
+	this->farPlane = farPlane;
+	hasLight = true;
+
+	ComputeMatrices();
+	staticValid = false;
+}
+
+// Uses the GL matrix stack so the light matrices match exactly what
+// gluPerspective/gluLookAt produce for the camera.
+void ShadowMap::ComputeMatrices()
+{
+	GLint matrixMode = GL_MODELVIEW;
+	glGetIntegerv(GL_MATRIX_MODE, &matrixMode);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	gluPerspective(fieldOfView, 1.0, nearPlane, farPlane);
+	glGetFloatv(GL_PROJECTION_MATRIX, lightProjection);
+	glPopMatrix();
+
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	gluLookAt(lightPosition[0], lightPosition[1], lightPosition[2],
+		lightTarget.x, lightTarget.y, lightTarget.z,
+		0.0, 1.0, 0.0);
+	glGetFloatv(GL_MODELVIEW_MATRIX, lightView);
+
+	glLoadIdentity();
+	glTranslatef(0.5f, 0.5f, 0.5f);
+	glScalef(0.5f, 0.5f, 0.5f);
+	glMultMatrixf(lightProjection);
+	glMultMatrixf(lightView);
+	glGetFloatv(GL_MODELVIEW_MATRIX, shadowMatrix);
+	glPopMatrix();
+
+	glMatrixMode(matrixMode);
+}
+
+void ShadowMap::BeginPass(GLuint target)
+{
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, savedViewport);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, mapSize, mapSize);
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_POLYGON_BIT | GL_LIGHTING_BIT);
+	glDisable(GL_LIGHTING);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadMatrixf(lightProjection);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadMatrixf(lightView);
+}
+
+void ShadowMap::EndPass()
+{
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+
+	glPopAttrib();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+	glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void ShadowMap::BeginStaticPass()
+{
+	BeginPass(staticFbo);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowMap::EndStaticPass()
+{
+	EndPass();
+	staticValid = true;
+	staticRebuilds++;
+}
+
+void ShadowMap::BeginDynamicPass()
+{
+	GLint previous = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+
+	// start from the cached static depth instead of re-rendering the casters
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glBlitFramebuffer(0, 0, mapSize, mapSize, 0, 0, mapSize, mapSize, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	BeginPass(fbo);
+}
+
+void ShadowMap::EndDynamicPass()
+{
+	EndPass();
+}
@@ -0,0 +1,197 @@
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "StateExport.h"
+
+namespace
+{
+	const char magic[4] = { 'R', '3', 'D', 'S' };
+	const uint32_t version = 1;
+	const uint64_t noSnapshot = ~(uint64_t)0;
+	const int readAttempts = 4;
+}
+
+StateExport::StateExport()
+{
+	header = NULL;
+	slots = NULL;
+	size = 0;
+	publishing = false;
+	published = 0;
+#ifdef _WIN32
+	mapping = NULL;
+#else
+	fd = -1;
+	name[0] = '\0';
+#endif
+}
+
+StateExport::~StateExport()
+{
+	Close();
+}
+
+bool StateExport::Create(const char *segmentName)
+{
+	Close();
+	size = sizeof(Header) + slotCount * sizeof(Slot);
+
+#ifdef _WIN32
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, segmentName);
+	if (!mapping)
+		return false;
+#else
+	fd = shm_open(segmentName, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, (off_t)size) != 0)
+	{
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	std::strncpy(name, segmentName, sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+#endif
+
+	publishing = true;
+	if (!Map(true))
+	{
+		Close();
+		return false;
+	}
+
+	// readers check the magic last, so fill in everything else first
+	header->version = version;
+	header->slotCount = slotCount;
+	header->snapshotSize = sizeof(Snapshot);
+	header->latest.store(noSnapshot, std::memory_order_relaxed);
+	for (int i = 0; i < slotCount; ++i)
+		slots[i].sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(header->magic, magic, sizeof(magic));
+	published = 0;
+	return true;
+}
+
+bool StateExport::Attach(const char *segmentName)
+{
+	Close();
+
+#ifdef _WIN32
+	mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, segmentName);
+	if (!mapping)
+		return false;
+	size = sizeof(Header) + slotCount * sizeof(Slot);
+#else
+	fd = shm_open(segmentName, O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(Header) + slotCount * sizeof(Slot))
+	{
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	size = (size_t)info.st_size;
+#endif
+
+	if (!Map(false) || std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version ||
+		header->slotCount != (uint32_t)slotCount || header->snapshotSize != sizeof(Snapshot))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool StateExport::Map(bool write)
+{
+	void *memory;
+#ifdef _WIN32
+	memory = MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if (!memory)
+		return false;
+#else
+	memory = mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (memory == MAP_FAILED)
+		return false;
+#endif
+	header = (Header *)memory;
+	slots = (Slot *)((char *)memory + sizeof(Header));
+	return true;
+}
+
+void StateExport::Close()
+{
+#ifdef _WIN32
+	if (header)
+		UnmapViewOfFile(header);
+	if (mapping)
+		CloseHandle(mapping);
+	mapping = NULL;
+#else
+	if (header)
+		munmap(header, size);
+	if (fd >= 0)
+		::close(fd);
+	if (publishing && name[0])
+		shm_unlink(name);
+	fd = -1;
+	name[0] = '\0';
+#endif
+	header = NULL;
+	slots = NULL;
+	size = 0;
+	publishing = false;
+}
+
+void StateExport::Publish(const Snapshot &snapshot)
+{
+	if (!header || !publishing)
+		return;
+
+	Slot &slot = slots[published % slotCount];
+	uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	// the odd count has to be visible before any of the new bytes
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.snapshot = snapshot;
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	header->latest.store(published, std::memory_order_release);
+	published++;
+}
+
+bool StateExport::Read(Snapshot &snapshot) const
+{
+	if (!header)
+		return false;
+
+	for (int attempt = 0; attempt < readAttempts; ++attempt)
+	{
+		uint64_t latest = header->latest.load(std::memory_order_acquire);
+		if (latest == noSnapshot)
+			return false;
+
+		const Slot &slot = slots[latest % slotCount];
+		uint32_t before = slot.sequence.load(std::memory_order_acquire);
+		if (before & 1)
+			continue;
+		snapshot = slot.snapshot;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) == before)
+			return true;
+	}
+	return false;
+}
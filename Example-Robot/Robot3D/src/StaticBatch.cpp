@@ -0,0 +1,296 @@
+#include <cstddef>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Vectors.h"
+#include "FrameArena.h"
+#include "CommandBuffer.h"
+#include "GeometryArena.h"
+#include "StaticBatch.h"
+
+#define BUFFER_OFFSET(offset) ((void*)(offset))
+
+StaticBatch::StaticBatch()
+{
+	vao = 0;
+	vbos[0] = vbos[1] = vbos[2] = 0;
+	vertexCount = 0;
+	indexCount = 0;
+	instancesDirty = true;
+	inArena = false;
+	instances.push_back(Vector3(0.0f, 0.0f, 0.0f));
+}
+
+StaticBatch::~StaticBatch()
+{
+	FreeMemory();
+}
+
+int StaticBatch::AddMaterial(const StaticBatchMaterial &material)
+{
+	if ((int)materials.size() >= maxMaterials)
+		return -1;
+	materials.push_back(material);
+	return (int)materials.size() - 1;
+}
+
+void StaticBatch::AddBox(Vector3 center, Vector3 size, int material)
+{
+	Box box;
+	box.center = center;
+	box.size = size;
+	box.material = material;
+	boxes.push_back(box);
+}
+
+void StaticBatch::Generate(std::vector<StaticBatchVertex> &vertexData, std::vector<unsigned int> &indexData)
+{
+	// face normal followed by two tangents with u x v == n, so the corners
+	// below come out counterclockwise like glutSolidCube
+	static const float faces[6][3][3] =
+	{
+		{ {  1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+		{ { -1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } },
+		{ { 0,  1, 0 }, { 0, 0, 1 }, { 1, 0, 0 } },
+		{ { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+		{ { 0, 0,  1 }, { 1, 0, 0 }, { 0, 1, 0 } },
+		{ { 0, 0, -1 }, { 0, 1, 0 }, { 1, 0, 0 } }
+	};
+	static const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+	vertexData.clear();
+	indexData.clear();
+	vertexData.reserve(boxes.size() * 24);
+	indexData.reserve(boxes.size() * 36);
+	ranges.clear();
+
+	// group by material so each material is one contiguous index range
+	for (int m = 0; m < (int)materials.size(); ++m)
+	{
+		Range range;
+		range.material = m;
+		range.first = (GLsizei)indexData.size();
+
+		for (size_t b = 0; b < boxes.size(); ++b)
+		{
+			const Box &box = boxes[b];
+			if (box.material != m)
+				continue;
+
+			float half[3] = { box.size.x * 0.5f, box.size.y * 0.5f, box.size.z * 0.5f };
+			float center[3] = { box.center.x, box.center.y, box.center.z };
+
+			for (int f = 0; f < 6; ++f)
+			{
+				unsigned int base = (unsigned int)vertexData.size();
+				for (int c = 0; c < 4; ++c)
+				{
+					StaticBatchVertex v;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						float local = faces[f][0][axis] + corners[c][0] * faces[f][1][axis] + corners[c][1] * faces[f][2][axis];
+						v.position[axis] = center[axis] + local * half[axis];
+						v.normal[axis] = faces[f][0][axis];
+					}
+					v.material = (GLfloat)m;
+					vertexData.push_back(v);
+				}
+				indexData.push_back(base);
+				indexData.push_back(base + 1);
+				indexData.push_back(base + 2);
+				indexData.push_back(base);
+				indexData.push_back(base + 2);
+				indexData.push_back(base + 3);
+			}
+		}
+
+		range.count = (GLsizei)indexData.size() - range.first;
+		if (range.count > 0)
+			ranges.push_back(range);
+	}
+}
+
+bool StaticBatch::Build(GLint attribPosition, GLint attribNormal, GLint attribMaterial, GLint attribInstance)
+{
+	std::vector<StaticBatchVertex> vertexData;
+	std::vector<unsigned int> indexData;
+	Generate(vertexData, indexData);
+
+	vertexCount = (GLsizei)vertexData.size();
+	indexCount = (GLsizei)indexData.size();
+	if (indexCount == 0)
+		return false;
+
+	if (!vao)
+		glGenVertexArrays(1, &vao);
+	if (!vbos[0])
+		glGenBuffers(3, vbos);
+
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(StaticBatchVertex), &vertexData[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(attribPosition);
+	glVertexAttribPointer(attribPosition, 3, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), BUFFER_OFFSET(offsetof(StaticBatchVertex, position)));
+	glEnableVertexAttribArray(attribNormal);
+	glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), BUFFER_OFFSET(offsetof(StaticBatchVertex, normal)));
+	glEnableVertexAttribArray(attribMaterial);
+	glVertexAttribPointer(attribMaterial, 1, GL_FLOAT, GL_FALSE, sizeof(StaticBatchVertex), BUFFER_OFFSET(offsetof(StaticBatchVertex, material)));
+
+	// per-instance offset
+	glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
+	glEnableVertexAttribArray(attribInstance);
+	glVertexAttribPointer(attribInstance, 3, GL_FLOAT, GL_FALSE, sizeof(Vector3), 0);
+	glVertexAttribDivisor(attribInstance, 1);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos[2]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size() * sizeof(unsigned int), &indexData[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	instancesDirty = true;
+	UploadInstances();
+	return true;
+}
+
+void StaticBatch::SetInstances(const std::vector<Vector3> &offsets)
+{
+	instances = offsets;
+	instancesDirty = true;
+}
+
+void StaticBatch::UploadInstances()
+{
+	if (!instancesDirty || !vbos[1] || instances.empty())
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Vector3), &instances[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	instancesDirty = false;
+}
+
+void StaticBatch::BindMaterials(GLuint program) const
+{
+	if (!program || materials.empty())
+		return;
+
+	GLfloat ambient[maxMaterials * 4];
+	GLfloat diffuse[maxMaterials * 4];
+	GLfloat specular[maxMaterials * 4];
+	GLfloat shininess[maxMaterials];
+	GLsizei count = (GLsizei)materials.size();
+	for (GLsizei m = 0; m < count; ++m)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			ambient[m * 4 + c] = materials[m].ambient[c];
+			diffuse[m * 4 + c] = materials[m].diffuse[c];
+			specular[m * 4 + c] = materials[m].specular[c];
+		}
+		shininess[m] = materials[m].shininess;
+	}
+
+	GLint previous = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+	glUseProgram(program);
+	glUniform4fv(glGetUniformLocation(program, "uAmbient"), count, ambient);
+	glUniform4fv(glGetUniformLocation(program, "uDiffuse"), count, diffuse);
+	glUniform4fv(glGetUniformLocation(program, "uSpecular"), count, specular);
+	glUniform1fv(glGetUniformLocation(program, "uShininess"), count, shininess);
+	glUseProgram(previous);
+}
+
+void StaticBatch::Draw(GLuint program)
+{
+	if (!vao || indexCount == 0 || instances.empty())
+		return;
+
+	UploadInstances();
+
+	CommandBuffer commands;
+	Record(commands, program);
+	commands.Replay();
+}
+
+void StaticBatch::Record(CommandBuffer &commands, GLuint program) const
+{
+	if (!vao || indexCount == 0 || instances.empty())
+		return;
+
+	commands.UseProgram(program);
+	commands.BindVertexArray(vao);
+	for (size_t r = 0; r < ranges.size(); ++r)
+	{
+		commands.DrawElementsInstanced(GL_TRIANGLES, ranges[r].count, GL_UNSIGNED_INT,
+			ranges[r].first * sizeof(unsigned int), (GLsizei)instances.size());
+	}
+	commands.BindVertexArray(0);
+	commands.UseProgram(0);
+}
+
+bool StaticBatch::AddToArena(GeometryArena &arena)
+{
+	std::vector<StaticBatchVertex> vertexData;
+	std::vector<unsigned int> indexData;
+	Generate(vertexData, indexData);
+	if (indexData.empty())
+		return false;
+
+	// the material moves from the vertex to the per-draw data
+	std::vector<GeometryArenaVertex> arenaVertices(vertexData.size());
+	for (size_t i = 0; i < vertexData.size(); ++i)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			arenaVertices[i].position[axis] = vertexData[i].position[axis];
+			arenaVertices[i].normal[axis] = vertexData[i].normal[axis];
+		}
+	}
+
+	arenaMesh.indexCount = 0;
+	if (!arena.Allocate(&arenaVertices[0], (int)arenaVertices.size(), &indexData[0], (int)indexData.size(), arenaMesh))
+		return false;
+	inArena = true;
+	return true;
+}
+
+void StaticBatch::RemoveFromArena()
+{
+	inArena = false;
+}
+
+void StaticBatch::AddArenaDraws(GeometryArena::DrawList &list, unsigned int views) const
+{
+	if (!inArena)
+		return;
+
+	for (size_t i = 0; i < instances.size(); ++i)
+	{
+		for (size_t r = 0; r < ranges.size(); ++r)
+		{
+			list.Add(arenaMesh, ranges[r].first, ranges[r].count,
+				instances[i].x, instances[i].y, instances[i].z, (float)ranges[r].material, views);
+		}
+	}
+}
+
+void StaticBatch::FreeMemory()
+{
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+	if (vbos[0] || vbos[1] || vbos[2])
+	{
+		glDeleteBuffers(3, vbos);
+		vbos[0] = vbos[1] = vbos[2] = 0;
+	}
+	vertexCount = 0;
+	indexCount = 0;
+	ranges.clear();
+}
@@ -0,0 +1,110 @@
+#include <cstddef>
+#include <vector>
+
+#include "Vectors.h"
+#include "TargetPool.h"
+
+TargetPool::TargetPool()
+{
+	freeSlot = noSlot;
+}
+
+void TargetPool::Reserve(int capacity)
+{
+	targets.reserve(capacity);
+	owners.reserve(capacity);
+	slots.reserve(capacity);
+}
+
+TargetPool::Handle TargetPool::Spawn(const Target &target)
+{
+	unsigned int slot = freeSlot;
+	if (slot != noSlot)
+	{
+		freeSlot = slots[slot].index;
+	}
+	else
+	{
+		slot = (unsigned int)slots.size();
+		Slot fresh = { 0, 1 };
+		slots.push_back(fresh);
+	}
+
+	slots[slot].index = (unsigned int)targets.size();
+	targets.push_back(target);
+	owners.push_back(slot);
+
+	Handle handle = { slot, slots[slot].generation };
+	return handle;
+}
+
+bool TargetPool::Despawn(Handle handle)
+{
+	unsigned int index = Find(handle);
+	if (index == noSlot)
+		return false;
+
+	Slot &slot = slots[handle.slot];
+	unsigned int last = (unsigned int)targets.size() - 1;
+	if (index != last)
+	{
+		targets[index] = targets[last];
+		owners[index] = owners[last];
+		slots[owners[index]].index = index;
+	}
+	targets.pop_back();
+	owners.pop_back();
+
+	// skip 0 when the counter wraps so zeroed handles stay invalid
+	if (++slot.generation == 0)
+		slot.generation = 1;
+	slot.index = freeSlot;
+	freeSlot = handle.slot;
+	return true;
+}
+
+void TargetPool::Clear()
+{
+	// bump every live slot so outstanding handles go stale
+	for (size_t i = 0; i < owners.size(); ++i)
+	{
+		Slot &slot = slots[owners[i]];
+		if (++slot.generation == 0)
+			slot.generation = 1;
+		slot.index = freeSlot;
+		freeSlot = owners[i];
+	}
+	targets.clear();
+	owners.clear();
+}
+
+// a free slot's index is a free-list link, so the owner check keeps a
+// forged handle from reading it as a target
+unsigned int TargetPool::Find(Handle handle) const
+{
+	if (handle.slot >= slots.size() || slots[handle.slot].generation != handle.generation)
+		return noSlot;
+	unsigned int index = slots[handle.slot].index;
+	if (index >= targets.size() || owners[index] != handle.slot)
+		return noSlot;
+	return index;
+}
+
+Target *TargetPool::Get(Handle handle)
+{
+	unsigned int index = Find(handle);
+	return index == noSlot ? NULL : &targets[index];
+}
+
+const Target *TargetPool::Get(Handle handle) const
+{
+	unsigned int index = Find(handle);
+	return index == noSlot ? NULL : &targets[index];
+}
+
+TargetPool::Handle TargetPool::GetHandle(int index) const
+{
+	unsigned int slot = owners[index];
+	Handle handle = { slot, slots[slot].generation };
+	return handle;
+}
@@ -0,0 +1,206 @@
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "FrameArena.h"
+#include "ShaderUtil.h"
+#include "PerfCounters.h"
+#include "TessellatedSurface.h"
+
+namespace
+{
+	const char *vertexSrc =
+		"#version 400 compatibility\n"
+		"in vec2 patchCorner;\n"
+		"out vec2 vCorner;\n"
+		"void main()\n"
+		"{\n"
+		"    vCorner = patchCorner;\n"
+		"}\n";
+
+	// an edge's level comes from its length over the view depth of its
+	// midpoint, so it only depends on the edge and not on the patch
+	const char *controlSrc =
+		"#version 400 compatibility\n"
+		"layout(vertices = 4) out;\n"
+		"in vec2 vCorner[];\n"
+		"out vec2 tcCorner[];\n"
+		"uniform float uBaseHeight;\n"
+		"uniform float uViewportHeight;\n"
+		"uniform float uPixelsPerSegment;\n"
+		"uniform float uMaxLevel;\n"
+		"float edgeLevel(vec2 a, vec2 b)\n"
+		"{\n"
+		"    vec4 center = vec4(0.5 * (a.x + b.x), uBaseHeight, 0.5 * (a.y + b.y), 1.0);\n"
+		"    float depth = max(-(gl_ModelViewMatrix * center).z, 0.1);\n"
+		"    float pixels = distance(a, b) * gl_ProjectionMatrix[1][1] * 0.5 * uViewportHeight / depth;\n"
+		"    return clamp(pixels / uPixelsPerSegment, 1.0, uMaxLevel);\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"    tcCorner[gl_InvocationID] = vCorner[gl_InvocationID];\n"
+		"    if (gl_InvocationID == 0)\n"
+		"    {\n"
+		"        gl_TessLevelOuter[0] = edgeLevel(vCorner[0], vCorner[3]);\n"
+		"        gl_TessLevelOuter[1] = edgeLevel(vCorner[0], vCorner[1]);\n"
+		"        gl_TessLevelOuter[2] = edgeLevel(vCorner[1], vCorner[2]);\n"
+		"        gl_TessLevelOuter[3] = edgeLevel(vCorner[3], vCorner[2]);\n"
+		"        gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);\n"
+		"        gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);\n"
+		"    }\n"
+		"}\n";
+
+	// corners run (x0,z0) (x1,z0) (x1,z1) (x0,z1), u follows x and v
+	// follows z; nothing is culled, the winding only has to be consistent
+	const char *evaluationHeader =
+		"#version 400 compatibility\n"
+		"layout(quads, fractional_even_spacing, cw) in;\n"
+		"in vec2 tcCorner[];\n"
+		"uniform float uBaseHeight;\n"
+		"#define VERTEX_OUT out\n";
+
+	const char *evaluationMain =
+		"void main()\n"
+		"{\n"
+		"    vec2 xz = mix(mix(tcCorner[0], tcCorner[1], gl_TessCoord.x), mix(tcCorner[3], tcCorner[2], gl_TessCoord.x), gl_TessCoord.y);\n"
+		"    const float e = 0.05;\n"
+		"    float dx = surfaceHeight(xz + vec2(e, 0.0)) - surfaceHeight(xz - vec2(e, 0.0));\n"
+		"    float dz = surfaceHeight(xz + vec2(0.0, e)) - surfaceHeight(xz - vec2(0.0, e));\n"
+		"    shadeVertex(vec3(xz.x, surfaceHeight(xz), xz.y), normalize(vec3(-dx, 2.0 * e, -dz)));\n"
+		"}\n";
+}
+
+TessellatedSurface::TessellatedSurface(float originX, float originZ, float sizeX, float sizeZ, int patchesX, int patchesZ, float baseHeight)
+{
+	this->originX = originX;
+	this->originZ = originZ;
+	this->sizeX = sizeX;
+	this->sizeZ = sizeZ;
+	this->patchesX = patchesX < 1 ? 1 : patchesX;
+	this->patchesZ = patchesZ < 1 ? 1 : patchesZ;
+	this->baseHeight = baseHeight;
+	pixelsPerSegment = 8.0f;
+	maxLevel = 64.0f;
+	vao = 0;
+	vbo = 0;
+}
+
+TessellatedSurface::~TessellatedSurface()
+{
+	FreeMemory();
+}
+
+bool TessellatedSurface::IsSupported()
+{
+	return GLEW_VERSION_4_0 || GLEW_ARB_tessellation_shader;
+}
+
+GLuint TessellatedSurface::BuildProgram(const char *surfaceSrc, const char *fragmentSrc)
+{
+	if (!IsSupported())
+		return 0;
+
+	std::string evaluationSrc = std::string(evaluationHeader) + surfaceSrc + evaluationMain;
+	GLuint shaders[4];
+	shaders[0] = compileShader(GL_VERTEX_SHADER, vertexSrc);
+	shaders[1] = compileShader(GL_TESS_CONTROL_SHADER, controlSrc);
+	shaders[2] = compileShader(GL_TESS_EVALUATION_SHADER, evaluationSrc.c_str());
+	shaders[3] = compileShader(GL_FRAGMENT_SHADER, fragmentSrc);
+	const char *attribs[] = { "patchCorner" };
+	return linkProgram(shaders, 4, attribs, 1);
+}
+
+bool TessellatedSurface::Init()
+{
+	if (!IsSupported())
+		return false;
+
+	std::vector<GLfloat> corners;
+	corners.reserve((size_t)patchesX * patchesZ * 8);
+	// Each patch edge is computed once from its index and shared by the
+	// patches on both sides, so neighbours meet at bit-identical corners.
+	std::vector<float> edgesX(patchesX + 1);
+	std::vector<float> edgesZ(patchesZ + 1);
+	for (int px = 0; px <= patchesX; ++px)
+		edgesX[px] = px == patchesX ? originX + sizeX : originX + sizeX * px / patchesX;
+	for (int pz = 0; pz <= patchesZ; ++pz)
+		edgesZ[pz] = pz == patchesZ ? originZ + sizeZ : originZ + sizeZ * pz / patchesZ;
+	for (int pz = 0; pz < patchesZ; ++pz)
+	{
+		float z0 = edgesZ[pz];
+		float z1 = edgesZ[pz + 1];
+		for (int px = 0; px < patchesX; ++px)
+		{
+			float x0 = edgesX[px];
+			float x1 = edgesX[px + 1];
+			const GLfloat patch[8] = { x0, z0, x1, z0, x1, z1, x0, z1 };
+			corners.insert(corners.end(), patch, patch + 8);
+		}
+	}
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vbo);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(GLfloat), &corners[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+void TessellatedSurface::FreeMemory()
+{
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+	if (vbo)
+	{
+		glDeleteBuffers(1, &vbo);
+		vbo = 0;
+	}
+}
+
+void TessellatedSurface::SetDetail(float pixelsPerSegment, float maxLevel)
+{
+	this->pixelsPerSegment = pixelsPerSegment > 0.5f ? pixelsPerSegment : 0.5f;
+	this->maxLevel = maxLevel > 1.0f ? maxLevel : 1.0f;
+}
+
+void TessellatedSurface::Draw(GLuint program, const int *patches, int patchCount) const
+{
+	if (!vao || !program)
+		return;
+
+	// the viewport changes with dynamic resolution, so read it per draw
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glUniform1f(glGetUniformLocation(program, "uBaseHeight"), baseHeight);
+	glUniform1f(glGetUniformLocation(program, "uViewportHeight"), (GLfloat)viewport[3]);
+	glUniform1f(glGetUniformLocation(program, "uPixelsPerSegment"), pixelsPerSegment);
+	glUniform1f(glGetUniformLocation(program, "uMaxLevel"), maxLevel);
+
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	glBindVertexArray(vao);
+	if (!patches)
+	{
+		glDrawArrays(GL_PATCHES, 0, GetPatchCount() * 4);
+		PerfCounters::CountDraws(1, GetPatchCount() * 4, false);
+	}
+	else if (patchCount > 0)
+	{
+		FrameVector<GLint> firsts(patchCount);
+		FrameVector<GLsizei> counts(patchCount, 4);
+		for (int i = 0; i < patchCount; ++i)
+			firsts[i] = patches[i] * 4;
+		glMultiDrawArrays(GL_PATCHES, &firsts[0], &counts[0], patchCount);
+		PerfCounters::CountDraws(1, patchCount * 4, false);
+	}
+	glBindVertexArray(0);
+}
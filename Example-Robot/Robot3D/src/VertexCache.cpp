@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "VertexCache.h"
+
+namespace
+{
+	const int maxCacheSize = 64;
+	const float cacheDecayPower = 1.5f;
+	const float lastTriangleScore = 0.75f;
+	const float valenceBoostScale = 2.0f;
+	const float valenceBoostPower = 0.5f;
+
+	struct CacheVertex
+	{
+		int cachePosition;
+		int remaining;
+		int firstTriangle;
+		float score;
+	};
+
+	float VertexScore(const CacheVertex &vertex, int cacheSize)
+	{
+		if (vertex.remaining == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (vertex.cachePosition >= 0)
+		{
+			// the last triangle's vertices score the same whatever their
+			// order, so the next one can't favour one winding
+			if (vertex.cachePosition < 3)
+				score = lastTriangleScore;
+			else
+				score = std::pow(1.0f - (float)(vertex.cachePosition - 3) / (float)(cacheSize - 3), cacheDecayPower);
+		}
+		// vertices with few triangles left are finished off first
+		score += valenceBoostScale * std::pow((float)vertex.remaining, -valenceBoostPower);
+		return score;
+	}
+
+	// local vertex ids are positions in the sorted list of used indices
+	void CompactIndices(const unsigned int *indices, size_t indexCount, std::vector<unsigned int> &unique, std::vector<int> &local)
+	{
+		unique.assign(indices, indices + indexCount);
+		std::sort(unique.begin(), unique.end());
+		unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+		local.resize(indexCount);
+		for (size_t i = 0; i < indexCount; ++i)
+			local[i] = (int)(std::lower_bound(unique.begin(), unique.end(), indices[i]) - unique.begin());
+	}
+}
+
+void OptimizeVertexCache(unsigned int *indices, size_t indexCount, int cacheSize)
+{
+	int triangleCount = (int)(indexCount / 3);
+	if (triangleCount < 2)
+		return;
+	cacheSize = std::max(4, std::min(cacheSize, maxCacheSize));
+
+	std::vector<unsigned int> unique;
+	std::vector<int> local;
+	CompactIndices(indices, (size_t)triangleCount * 3, unique, local);
+
+	// per-vertex lists of triangles not yet emitted
+	std::vector<CacheVertex> vertices(unique.size());
+	for (size_t v = 0; v < vertices.size(); ++v)
+	{
+		vertices[v].cachePosition = -1;
+		vertices[v].remaining = 0;
+		vertices[v].firstTriangle = 0;
+	}
+	for (size_t i = 0; i < local.size(); ++i)
+		vertices[local[i]].remaining++;
+	int offset = 0;
+	for (size_t v = 0; v < vertices.size(); ++v)
+	{
+		vertices[v].firstTriangle = offset;
+		offset += vertices[v].remaining;
+	}
+	std::vector<int> vertexTriangles(offset);
+	std::vector<int> fill(vertices.size(), 0);
+	for (int t = 0; t < triangleCount; ++t)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			int v = local[t * 3 + k];
+			vertexTriangles[vertices[v].firstTriangle + fill[v]++] = t;
+		}
+	}
+
+	for (size_t v = 0; v < vertices.size(); ++v)
+		vertices[v].score = VertexScore(vertices[v], cacheSize);
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (int t = 0; t < triangleCount; ++t)
+	{
+		triangleScores[t] = vertices[local[t * 3]].score + vertices[local[t * 3 + 1]].score + vertices[local[t * 3 + 2]].score;
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve((size_t)triangleCount * 3);
+
+	// room for a full cache plus the triangle that pushes it along
+	int cache[maxCacheSize + 3];
+	int cacheUsed = 0;
+	int bestTriangle = -1;
+	int scanCursor = 0;
+
+	for (int emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+	{
+		if (bestTriangle < 0)
+		{
+			// nothing in the cache is useful; take the best of the rest
+			float bestScore = -1.0f;
+			for (int t = scanCursor; t < triangleCount; ++t)
+			{
+				if (!emitted[t] && triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+			while (scanCursor < triangleCount && emitted[scanCursor])
+				scanCursor++;
+		}
+
+		int t = bestTriangle;
+		emitted[t] = true;
+		for (int k = 0; k < 3; ++k)
+		{
+			output.push_back(indices[t * 3 + k]);
+
+			// drop t from the vertex's remaining triangles
+			CacheVertex &vertex = vertices[local[t * 3 + k]];
+			int *list = &vertexTriangles[vertex.firstTriangle];
+			for (int i = 0; i < vertex.remaining; ++i)
+			{
+				if (list[i] == t)
+				{
+					list[i] = list[vertex.remaining - 1];
+					break;
+				}
+			}
+			vertex.remaining--;
+		}
+
+		// move the triangle's vertices to the front of the LRU cache
+		int newCache[maxCacheSize + 3];
+		int newUsed = 0;
+		for (int k = 0; k < 3; ++k)
+			newCache[newUsed++] = local[t * 3 + k];
+		for (int i = 0; i < cacheUsed; ++i)
+		{
+			int v = cache[i];
+			if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+				newCache[newUsed++] = v;
+		}
+
+		for (int i = 0; i < newUsed; ++i)
+		{
+			CacheVertex &vertex = vertices[newCache[i]];
+			vertex.cachePosition = i < cacheSize ? i : -1;
+			vertex.score = VertexScore(vertex, cacheSize);
+		}
+		cacheUsed = std::min(newUsed, cacheSize);
+		std::copy(newCache, newCache + cacheUsed, cache);
+
+		// rescore the triangles around everything that moved and pick the
+		// best of them for the next step
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < newUsed; ++i)
+		{
+			const CacheVertex &vertex = vertices[newCache[i]];
+			const int *list = &vertexTriangles[vertex.firstTriangle];
+			for (int j = 0; j < vertex.remaining; ++j)
+			{
+				int other = list[j];
+				float score = vertices[local[other * 3]].score + vertices[local[other * 3 + 1]].score + vertices[local[other * 3 + 2]].score;
+				triangleScores[other] = score;
+				if (i < cacheUsed && score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = other;
+				}
+			}
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+float ComputeACMR(const unsigned int *indices, size_t indexCount, int cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return 0.0f;
+
+	std::vector<unsigned int> unique;
+	std::vector<int> local;
+	CompactIndices(indices, triangleCount * 3, unique, local);
+
+	// FIFO: a hit doesn't refresh the entry, as on most hardware
+	std::vector<size_t> insertedAt(unique.size(), 0);
+	std::vector<bool> cached(unique.size(), false);
+	size_t misses = 0;
+	for (size_t i = 0; i < local.size(); ++i)
+	{
+		int v = local[i];
+		if (cached[v] && misses - insertedAt[v] < (size_t)cacheSize)
+			continue;
+		cached[v] = true;
+		insertedAt[v] = misses++;
+	}
+	return (float)misses / (float)triangleCount;
+}
+
+float ComputeATVR(const unsigned int *indices, size_t indexCount, int cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return 0.0f;
+
+	std::vector<unsigned int> unique(indices, indices + triangleCount * 3);
+	std::sort(unique.begin(), unique.end());
+	size_t vertexCount = std::unique(unique.begin(), unique.end()) - unique.begin();
+	return ComputeACMR(indices, indexCount, cacheSize) * (float)triangleCount / (float)vertexCount;
+}
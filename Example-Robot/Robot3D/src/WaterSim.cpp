@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WATERSIM_USE_SSE 1
+#endif
+
+#include "WorkerPool.h"
+#include "WaterSim.h"
+
+const float WaterSim::restThreshold = 1.0e-4f;
+
+WaterSim::WaterSim(int cellsX, int cellsZ, float originX, float originZ, float sizeX, float sizeZ, float stepHz)
+{
+	this->cellsX = std::max(cellsX, 3);
+	this->cellsZ = std::max(cellsZ, 3);
+	this->originX = originX;
+	this->originZ = originZ;
+	this->sizeX = sizeX;
+	this->sizeZ = sizeZ;
+	cellSizeX = sizeX / (this->cellsX - 1);
+	cellSizeZ = sizeZ / (this->cellsZ - 1);
+
+	current.assign(this->cellsX * this->cellsZ, 0.0f);
+	previous.assign(this->cellsX * this->cellsZ, 0.0f);
+	rowActivity.assign(this->cellsZ, 0.0f);
+	impulses.reserve(16);
+
+	stepTime = 1.0f / stepHz;
+	accumulator = 0.0f;
+	damping = 0.996f;
+	activity = 0.0f;
+	maxStepsPerAdvance = 8;
+	pool = NULL;
+
+	SetWaveSpeed(1.0f);
+}
+
+// The explicit 2D scheme is stable for coefX + coefZ <= 1; keep a margin.
+void WaterSim::SetWaveSpeed(float speed)
+{
+	waveSpeed = speed;
+	UpdateCoefficients();
+	float sum = coefX + coefZ;
+	if (sum > 0.9f)
+	{
+		waveSpeed *= std::sqrt(0.9f / sum);
+		UpdateCoefficients();
+	}
+}
+
+void WaterSim::UpdateCoefficients()
+{
+	float cx = waveSpeed * stepTime / cellSizeX;
+	float cz = waveSpeed * stepTime / cellSizeZ;
+	coefX = cx * cx;
+	coefZ = cz * cz;
+}
+
+void WaterSim::AddImpulse(float x, float z, float radius, float strength)
+{
+	Impulse impulse;
+	impulse.x = x;
+	impulse.z = z;
+	impulse.radius = radius;
+	impulse.strength = strength;
+	impulses.push_back(impulse);
+}
+
+void WaterSim::ApplyImpulses()
+{
+	for (size_t n = 0; n < impulses.size(); ++n)
+	{
+		const Impulse &impulse = impulses[n];
+		int i0 = std::max(1, (int)std::floor((impulse.x - impulse.radius - originX) / cellSizeX));
+		int i1 = std::min(cellsX - 2, (int)std::ceil((impulse.x + impulse.radius - originX) / cellSizeX));
+		int j0 = std::max(1, (int)std::floor((impulse.z - impulse.radius - originZ) / cellSizeZ));
+		int j1 = std::min(cellsZ - 2, (int)std::ceil((impulse.z + impulse.radius - originZ) / cellSizeZ));
+		float invRadius2 = 1.0f / (impulse.radius * impulse.radius);
+
+		for (int j = j0; j <= j1; ++j)
+		{
+			float dz = originZ + j * cellSizeZ - impulse.z;
+			for (int i = i0; i <= i1; ++i)
+			{
+				float dx = originX + i * cellSizeX - impulse.x;
+				float r2 = (dx * dx + dz * dz) * invRadius2;
+				if (r2 >= 1.0f)
+					continue;
+				// smooth cosine-shaped falloff
+				float falloff = 0.5f + 0.5f * std::cos(3.14159265f * std::sqrt(r2));
+				current[j * cellsX + i] += impulse.strength * falloff;
+				previous[j * cellsX + i] += impulse.strength * falloff;
+			}
+		}
+	}
+	impulses.clear();
+}
+
+void WaterSim::StepRows(int rowBegin, int rowEnd)
+{
+	const int nx = cellsX;
+	const float twoMinus = 2.0f - 2.0f * coefX - 2.0f * coefZ;
+
+	for (int j = rowBegin; j < rowEnd; ++j)
+	{
+		const float *c = &current[j * nx];
+		const float *up = c - nx;
+		const float *down = c + nx;
+		float *p = &previous[j * nx];
+		float rowMax = 0.0f;
+		int i = 1;
+
+#ifdef WATERSIM_USE_SSE
+		const __m128 vTwoMinus = _mm_set1_ps(twoMinus);
+		const __m128 vCoefX = _mm_set1_ps(coefX);
+		const __m128 vCoefZ = _mm_set1_ps(coefZ);
+		const __m128 vDamping = _mm_set1_ps(damping);
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 vMax = _mm_setzero_ps();
+		for (; i + 4 <= nx - 1; i += 4)
+		{
+			__m128 h = _mm_loadu_ps(c + i);
+			__m128 sideX = _mm_add_ps(_mm_loadu_ps(c + i - 1), _mm_loadu_ps(c + i + 1));
+			__m128 sideZ = _mm_add_ps(_mm_loadu_ps(up + i), _mm_loadu_ps(down + i));
+			__m128 next = _mm_mul_ps(vTwoMinus, h);
+			next = _mm_sub_ps(next, _mm_loadu_ps(p + i));
+			next = _mm_add_ps(next, _mm_mul_ps(vCoefX, sideX));
+			next = _mm_add_ps(next, _mm_mul_ps(vCoefZ, sideZ));
+			next = _mm_mul_ps(next, vDamping);
+			_mm_storeu_ps(p + i, next);
+
+			__m128 change = _mm_and_ps(_mm_sub_ps(next, h), absMask);
+			vMax = _mm_max_ps(vMax, _mm_max_ps(change, _mm_and_ps(next, absMask)));
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, vMax);
+		rowMax = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+
+		for (; i < nx - 1; ++i)
+		{
+			float h = c[i];
+			float next = twoMinus * h - p[i] + coefX * (c[i - 1] + c[i + 1]) + coefZ * (up[i] + down[i]);
+			next *= damping;
+			p[i] = next;
+			rowMax = std::max(rowMax, std::max(std::fabs(next - h), std::fabs(next)));
+		}
+		rowActivity[j] = rowMax;
+	}
+}
+
+void WaterSim::StepTask(void *context, int begin, int end, int worker)
+{
+	// interior rows only, the border stays at zero
+	static_cast<WaterSim *>(context)->StepRows(begin + 1, end + 1);
+}
+
+void WaterSim::Step()
+{
+	ApplyImpulses();
+
+	if (pool)
+		pool->ParallelFor(cellsZ - 2, StepTask, this);
+	else
+		StepRows(1, cellsZ - 1);
+
+	// previous now holds the new state
+	current.swap(previous);
+
+	activity = 0.0f;
+	for (int j = 1; j < cellsZ - 1; ++j)
+		activity = std::max(activity, rowActivity[j]);
+}
+
+void WaterSim::Advance(float dt)
+{
+	accumulator += dt;
+	int steps = 0;
+	while (accumulator >= stepTime && steps < maxStepsPerAdvance)
+	{
+		Step();
+		accumulator -= stepTime;
+		steps++;
+	}
+	// after a long stall drop the backlog rather than spiral
+	if (steps == maxStepsPerAdvance)
+		accumulator = 0.0f;
+}
+
+void WaterSim::Reset()
+{
+	std::fill(current.begin(), current.end(), 0.0f);
+	std::fill(previous.begin(), previous.end(), 0.0f);
+	impulses.clear();
+	accumulator = 0.0f;
+	activity = 0.0f;
+}
+
+float WaterSim::SampleHeight(float x, float z) const
+{
+	float fx = (x - originX) / cellSizeX;
+	float fz = (z - originZ) / cellSizeZ;
+	if (fx < 0.0f || fz < 0.0f || fx > (float)(cellsX - 1) || fz > (float)(cellsZ - 1))
+		return 0.0f;
+
+	int i = std::min((int)fx, cellsX - 2);
+	int j = std::min((int)fz, cellsZ - 2);
+	float tx = fx - i;
+	float tz = fz - j;
+
+	const float *row0 = &current[j * cellsX + i];
+	const float *row1 = row0 + cellsX;
+	float h0 = row0[0] + (row0[1] - row0[0]) * tx;
+	float h1 = row1[0] + (row1[1] - row1[0]) * tx;
+	return h0 + (h1 - h0) * tz;
+}
@@ -0,0 +1,98 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int threadCount)
+{
+	task = NULL;
+	context = NULL;
+	count = 0;
+	generation = 0;
+	remaining = 0;
+	stopping = false;
+
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	for (int i = 1; i < threadCount; ++i)
+	{
+		threads.push_back(std::thread(&WorkerPool::WorkerMain, this, i));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+}
+
+void WorkerPool::RunChunk(int worker)
+{
+	int workers = GetThreadCount();
+	int begin = (int)((long long)count * worker / workers);
+	int end = (int)((long long)count * (worker + 1) / workers);
+	if (begin < end)
+		task(context, begin, end, worker);
+}
+
+void WorkerPool::WorkerMain(int worker)
+{
+	unsigned int seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping && generation == seen)
+				wake.wait(lock);
+			if (stopping)
+				return;
+			seen = generation;
+		}
+
+		RunChunk(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--remaining == 0)
+			done.notify_one();
+	}
+}
+
+void WorkerPool::ParallelFor(int count, WorkerPoolTask task, void *context)
+{
+	if (count <= 0)
+		return;
+
+	if (threads.empty())
+	{
+		task(context, 0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = task;
+		this->context = context;
+		this->count = count;
+		remaining = (int)threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	RunChunk(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (remaining > 0)
+		done.wait(lock);
+}